@@ -0,0 +1,555 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+
+#include "MailBox.hxx"
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file BroadcastMailBox.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::BroadcastMailBox BroadcastMailBox: one ring, many readers
+ *
+ * SoDa::MailBox and SoDa::LockFreeMailBox both copy each message
+ * pointer into every subscriber's queue. With one producer and thirty
+ * subscribers, that's thirty queue pushes and thirty reference count
+ * bumps for every message.
+ *
+ * SoDa::BroadcastMailBox works the other way around. (If you've run
+ * across the LMAX "Disruptor" this will look familiar.) There is one
+ * ring of message slots, shared by everyone. A put claims the next
+ * sequence number, drops the message into that slot, and marks the
+ * slot as published. That's it -- the cost of a put doesn't depend on
+ * how many subscribers there are.
+ *
+ * Each subscription is just a cursor: the sequence number of the next
+ * message it will read. A get looks at the slot under the cursor, and
+ * if that slot has been published, takes a copy of the message and
+ * moves the cursor along.
+ *
+ * A producer may not reuse a slot until every subscriber has read
+ * it. The producer keeps a cached copy of the slowest cursor, and only
+ * walks the subscriber table again when the ring looks full. If the
+ * slowest subscriber really is a full ring behind, the producer waits
+ * (yielding the processor) until it catches up.
+ *
+ * Things to keep in mind:
+ *
+ * - The ring size and the maximum number of subscribers are fixed
+ *   when the mailbox is created.
+ * - A message stays in its slot until a later put overwrites it, so
+ *   the ring holds on to the last ring_size messages even after every
+ *   subscriber has read them.
+ * - Every subscriber sees every message in the same order. Unlike
+ *   SoDa::LockFreeMailBox, if thread A sends a message in response to
+ *   one from thread B, everyone sees B's message first.
+ * - A put that omits the sender's own subscription still takes a slot
+ *   in the ring. The sender's get just skips over it.
+ * - A subscriber that stops reading will stall the producers once
+ *   the ring fills.
+ */
+
+namespace SoDa {
+
+  /**
+   * @class BroadcastMailBox<T>
+   * @brief Accept messages and distribute them to multiple subscribers
+   * through a single shared sequence ring.
+   *
+   * @tparam T Type of message that will be found in this mailbox
+   */
+  template<typename T>
+  class BroadcastMailBox : public MailBoxBase, NoCopy {
+  public:
+    /**
+     * @brief Create a mailbox.
+     *
+     * @param name the name of the mailbox
+     * @param ring_size the ring will hold at least this many messages.
+     * The actual size is rounded up to a power of two.
+     * @param max_subscribers the mailbox can have at most this many subscribers
+     * at one time.
+     */
+    BroadcastMailBox(std::string name,
+		     unsigned int ring_size = 1024,
+		     unsigned int max_subscribers = 64) :
+      MailBoxBase(name), max_subscribers(max_subscribers) {
+      unsigned long sz = 2;
+      while(sz < ring_size) sz = sz << 1;
+      mask = sz - 1;
+      slots = std::unique_ptr<Slot[]>(new Slot[sz]);
+      for(unsigned long i = 0; i < sz; i++) {
+	// nothing has been published yet -- sequence 0 is not in slot 0
+	slots[i].published.store(i + 1, std::memory_order_relaxed);
+	slots[i].origin = -1;
+      }
+      cursors = std::unique_ptr<Cursor[]>(new Cursor[max_subscribers]);
+      for(unsigned int i = 0; i < max_subscribers; i++) {
+	cursors[i].active.store(false);
+	cursors[i].seq.store(0);
+      }
+      claim.store(0);
+      gating.store(0);
+      slot_limit.store(0);
+      sleepers.store(0);
+      subscriber_count = 0;
+    }
+
+    /**
+     * @brief The mailbox already has max_subscribers subscribers.
+     */
+    class TooManySubscribers : public Exception {
+    public:
+      TooManySubscribers(const std::string & name, unsigned int max_subs) :
+	Exception(name, SoDa::Format("::subscribe() limit of %0 subscribers exceeded.")
+		  .addU(max_subs).str()) {
+      }
+    };
+
+  protected:
+    class SubscriptionCl {
+    public:
+      SubscriptionCl(BroadcastMailBox<T> * mbox, int idx) {
+	this_mbox = mbox;
+	subscriber_index = idx;
+      }
+
+      ~SubscriptionCl() {
+	this_mbox->unsubscribe(subscriber_index);
+      }
+
+      int getIndex(BroadcastMailBox<T> * mbox) const {
+	if(mbox != this_mbox) {
+	  throw SubscriptionMismatch(mbox->getName(), this_mbox->getName());
+	}
+	else {
+	  return subscriber_index;
+	}
+      }
+      /// selects the cursor
+      int subscriber_index;
+      /// double check that we're referencing the right mailbox
+      BroadcastMailBox<T> * this_mbox;
+    };
+
+  public:
+    typedef std::unique_ptr<SubscriptionCl> Subscription;
+
+    /**
+     * @brief Subscribe the caller to a mailbox. The subscriber will
+     * see every message put after the subscription was made.
+     *
+     * @returns a smart pointer to a subscriber object.
+     * @throws TooManySubscribers if all the cursors are taken.
+     */
+    Subscription subscribe() {
+      std::lock_guard<std::mutex> lock(sub_mtx);
+      for(unsigned int i = 0; i < max_subscribers; i++) {
+	auto & cur = cursors[i];
+	if(!cur.active.load()) {
+	  // Join the gating set holding a sequence no producer can have
+	  // passed yet, and only then look at the claim. A producer that
+	  // scanned the cursors before we were active claimed a sequence
+	  // below the one we read, so it can't wrap the ring past us.
+	  cur.seq.store(gating.load());
+	  if(i >= slot_limit.load()) slot_limit.store(i + 1);
+	  cur.active.store(true);
+	  cur.seq.store(claim.load());
+	  subscriber_count++;
+	  return Subscription(new SubscriptionCl(this, i));
+	}
+      }
+      throw TooManySubscribers(getName(), max_subscribers);
+    }
+
+    /**
+     * Get an object out of the mailbox for this subscriber. This does
+     * not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @returns The oldest unread message, or nullptr if there isn't one.
+     */
+    std::shared_ptr<T> get(Subscription & subs) {
+      int idx = subs->getIndex(this);
+      auto & cur = cursors[idx];
+      unsigned long seq = cur.seq.load(std::memory_order_relaxed);
+      while(true) {
+	Slot & s = slots[seq & mask];
+	if(s.published.load(std::memory_order_acquire) != seq) {
+	  return nullptr;
+	}
+	// we hold the slot until we move our cursor past it.
+	bool skip = (s.origin == idx);
+	std::shared_ptr<T> ret;
+	if(!skip) ret = s.msg;
+	seq++;
+	cur.seq.store(seq, std::memory_order_release);
+	if(!skip) return ret;
+      }
+    }
+
+    /**
+     * @brief Get an object out of the mailbox for this subscriber,
+     * waiting for one to arrive if the mailbox is empty.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns The oldest unread message, or nullptr
+     * if the timeout expired before a message arrived.
+     */
+    std::shared_ptr<T> waitGet(Subscription & subs,
+			       const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      auto ret = get(subs);
+      if(ret != nullptr) return ret;
+
+      auto & cur = cursors[subs->getIndex(this)];
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      std::unique_lock<std::mutex> lock(wait_mtx);
+      sleepers.fetch_add(1);
+      // Either we see the published slot, or the producer sees that
+      // we are asleep. (The producer has a matching fence.)
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto ready = [this, &cur]() {
+	unsigned long seq = cur.seq.load(std::memory_order_relaxed);
+	return slots[seq & mask].published.load(std::memory_order_acquire) == seq;
+      };
+      while(ret == nullptr) {
+	bool ok = true;
+	if(timeout.count() == 0) {
+	  wait_cv.wait(lock, ready);
+	}
+	else {
+	  ok = wait_cv.wait_until(lock, deadline, ready);
+	}
+	if(!ok) break;
+	// the slot might have been our own message -- get will skip it.
+	ret = get(subs);
+      }
+      sleepers.fetch_sub(1);
+      return ret;
+    }
+
+    /**
+     * @brief Place a message in the ring, where every subscriber can see it.
+     *
+     * @param msg The message to be sent to every subscriber.
+     * @param subs If supplied, the sender's own subscription will skip
+     * this message.
+     */
+    void put(std::shared_ptr<T> msg, const Subscription & subs = nullptr) {
+      int origin = -1;
+      if(subs != nullptr) {
+	origin = subs->getIndex(this);
+      }
+
+      unsigned long seq = claim.fetch_add(1);
+      waitForSlot(seq);
+      publish(seq, msg, origin);
+      wakeSleepers();
+    }
+
+    /**
+     * @brief Place a run of messages in the ring.
+     *
+     * The whole run is reserved with a single claim on the ring (or
+     * one claim per ring-full, for very long runs) and sleeping
+     * subscribers are woken once per claim.
+     *
+     * @tparam Iterator anything that dereferences to a std::shared_ptr<T>
+     * @param begin the first message in the run
+     * @param end one past the last message in the run
+     * @param subs If supplied, the sender's own subscription will skip
+     * these messages.
+     */
+    template<typename Iterator>
+    void putBatch(Iterator begin, Iterator end, const Subscription & subs = nullptr) {
+      int origin = -1;
+      if(subs != nullptr) {
+	origin = subs->getIndex(this);
+      }
+
+      unsigned long ring_size = mask + 1;
+      Iterator it = begin;
+      while(it != end) {
+	// count off no more than a ring's worth of messages -- we
+	// can't wait for room for more than that.
+	Iterator run_end = it;
+	unsigned long n = 0;
+	while((run_end != end) && (n < ring_size)) {
+	  ++run_end;
+	  n++;
+	}
+	unsigned long seq = claim.fetch_add(n);
+	waitForSlot(seq + n - 1);
+	for(; it != run_end; ++it, ++seq) {
+	  publish(seq, *it, origin);
+	}
+	wakeSleepers();
+      }
+    }
+
+    /**
+     * @brief Get a run of messages out of the mailbox for this subscriber.
+     * This does not block.
+     *
+     * The subscriber's cursor is moved once, after the whole run has
+     * been copied out.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param out messages are appended to this vector, oldest first.
+     * @param max_msgs take no more than this many messages.
+     * @returns the number of messages appended to out.
+     */
+    unsigned int getBatch(Subscription & subs,
+			  std::vector<std::shared_ptr<T>> & out,
+			  unsigned int max_msgs = ~0) {
+      int idx = subs->getIndex(this);
+      auto & cur = cursors[idx];
+      unsigned long seq = cur.seq.load(std::memory_order_relaxed);
+      unsigned long start = seq;
+      unsigned int ret = 0;
+      while(ret < max_msgs) {
+	Slot & s = slots[seq & mask];
+	if(s.published.load(std::memory_order_acquire) != seq) break;
+	if(s.origin != idx) {
+	  out.push_back(s.msg);
+	  ret++;
+	}
+	seq++;
+      }
+      if(seq != start) cur.seq.store(seq, std::memory_order_release);
+      return ret;
+    }
+
+    /**
+     * @brief Take every waiting message for this subscriber and hand
+     * each one, oldest first, to a callback. This does not block.
+     *
+     * The messages are copied out of the ring before the callback is
+     * called, so the callback may put messages back into this
+     * mailbox.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param callback called once for each message
+     * @returns the number of messages passed to the callback.
+     */
+    unsigned int drain(Subscription & subs,
+		       const std::function<void(std::shared_ptr<T>)> & callback) {
+      std::vector<std::shared_ptr<T>> run;
+      getBatch(subs, run);
+      for(auto & m : run) {
+	callback(m);
+      }
+      return run.size();
+    }
+
+    /**
+     * Return the number of unread messages for this subscriber. This
+     * includes messages that have been claimed but not yet published,
+     * and messages that this subscriber will skip because it sent them.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     *
+     * @returns count of outstanding messages for this subscriber
+     */
+    unsigned int readyCount(Subscription & subs) {
+      auto & cur = cursors[subs->getIndex(this)];
+      unsigned long seq = cur.seq.load(std::memory_order_acquire);
+      unsigned long c = claim.load(std::memory_order_acquire);
+      return (c > seq) ? (c - seq) : 0;
+    }
+
+    /**
+     * Return the smallest number of unread messages over all subscribers.
+     *
+     * @returns count of outstanding messages for the subscriber that
+     * is furthest ahead.
+     */
+    unsigned int minReadyCount() {
+      unsigned int ret = ~0;
+      unsigned long c = claim.load(std::memory_order_acquire);
+      unsigned int lim = slot_limit.load(std::memory_order_acquire);
+      for(unsigned int i = 0; i < lim; i++) {
+	if(!cursors[i].active.load()) continue;
+	unsigned long seq = cursors[i].seq.load(std::memory_order_acquire);
+	unsigned int qs = (c > seq) ? (c - seq) : 0;
+	ret = (ret < qs) ? ret : qs;
+      }
+      return ret;
+    }
+
+    /**
+     * @brief Skip over every published message for this subscriber.
+     *
+     * @param subs -- identifies the subscription we're clearing
+     */
+    void clear(Subscription & subs) {
+      while(get(subs) != nullptr) { }
+    }
+
+    void unsubscribe(int subid) {
+      std::lock_guard<std::mutex> lock(sub_mtx);
+      if((subid < 0) || (subid >= int(max_subscribers)) || !cursors[subid].active.load()) {
+	throw MissingSubscriber(getName(), "unsubscribe()", subid);
+      }
+      // once we're inactive, producers won't wait for us.
+      cursors[subid].active.store(false);
+      subscriber_count--;
+    }
+
+    unsigned int subscriberCount() {
+      std::lock_guard<std::mutex> lock(sub_mtx);
+      return subscriber_count;
+    }
+
+  protected:
+    static const unsigned int cache_line = 64;
+
+    struct Slot {
+      /// the sequence number of the message in this slot
+      std::atomic<unsigned long> published;
+      std::shared_ptr<T> msg;
+      /// the subscriber that sent this message, if it asked to be skipped
+      int origin;
+    };
+
+    /**
+     * @brief Each subscriber's cursor sits on its own cache line, so
+     * that readers don't get in each other's way.
+     */
+    struct Cursor {
+      std::atomic<unsigned long> seq;
+      std::atomic<bool> active;
+      char pad[cache_line - sizeof(std::atomic<unsigned long>) - sizeof(std::atomic<bool>)];
+    };
+
+    /**
+     * @brief wait until every subscriber has read the message that used to
+     * be in the slot for sequence number seq.
+     */
+    void waitForSlot(unsigned long seq) {
+      unsigned long ring_size = mask + 1;
+      while((seq >= ring_size) && (gating.load(std::memory_order_acquire) <= (seq - ring_size))) {
+	unsigned long min_seq = slowestCursor(seq);
+	unsigned long old_gate = gating.load(std::memory_order_relaxed);
+	while((old_gate < min_seq) &&
+	      !gating.compare_exchange_weak(old_gate, min_seq)) { }
+	if(min_seq <= (seq - ring_size)) std::this_thread::yield();
+      }
+    }
+
+    void publish(unsigned long seq, const std::shared_ptr<T> & msg, int origin) {
+      Slot & s = slots[seq & mask];
+      s.msg = msg;
+      s.origin = origin;
+      s.published.store(seq, std::memory_order_release);
+    }
+
+    void wakeSleepers() {
+      // pairs with the fence in waitGet
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(sleepers.load(std::memory_order_relaxed) != 0) {
+	std::lock_guard<std::mutex> lock(wait_mtx);
+	wait_cv.notify_all();
+      }
+    }
+
+    /**
+     * @brief find the oldest unread sequence number over all subscribers.
+     * If there are no subscribers, nobody is holding any slots.
+     */
+    unsigned long slowestCursor(unsigned long seq) {
+      unsigned long ret = seq;
+      unsigned int lim = slot_limit.load(std::memory_order_acquire);
+      for(unsigned int i = 0; i < lim; i++) {
+	auto & cur = cursors[i];
+	if(!cur.active.load(std::memory_order_acquire)) continue;
+	unsigned long cs = cur.seq.load(std::memory_order_acquire);
+	ret = (cs < ret) ? cs : ret;
+      }
+      return ret;
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    unsigned long mask;
+
+    std::unique_ptr<Cursor[]> cursors;
+    unsigned int max_subscribers;
+    /// one past the highest cursor that has ever been used
+    std::atomic<unsigned int> slot_limit;
+    unsigned int subscriber_count;
+
+    char pad0[cache_line];
+    /// the next sequence number a producer will claim
+    std::atomic<unsigned long> claim;
+    char pad1[cache_line - sizeof(std::atomic<unsigned long>)];
+    /// cached copy of the slowest cursor
+    std::atomic<unsigned long> gating;
+    char pad2[cache_line - sizeof(std::atomic<unsigned long>)];
+
+    /// number of subscribers sleeping in waitGet
+    std::atomic<unsigned int> sleepers;
+    std::mutex wait_mtx;
+    std::condition_variable wait_cv;
+
+    /// subscribe and unsubscribe are serialized
+    std::mutex sub_mtx;
+  };
+
+  /**
+   * @brief Make a broadcast mailbox and return a shared pointer to it.
+   *
+   * @param mname Name of the mailbox.
+   * @param ring_size the ring will hold at least this many messages.
+   * @param max_subscribers the mailbox can have at most this many subscribers
+   * at one time.
+   * @returns shared pointer to a BroadcastMailBox object
+   */
+  template<typename T>
+  std::shared_ptr<BroadcastMailBox<T>> makeBroadcastMailBox(const std::string & mname,
+							     unsigned int ring_size = 1024,
+							     unsigned int max_subscribers = 64) {
+    return std::make_shared<BroadcastMailBox<T>>(mname, ring_size, max_subscribers);
+  }
+
+  template<typename T>
+  using BroadcastMailBoxPtr = std::shared_ptr<BroadcastMailBox<T>>;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <chrono>
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file DeliveryRate.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+namespace SoDa {
+
+  /**
+   * @class DeliveryRate
+   * @brief How much of a mailbox's traffic does a subscriber want?
+   *
+   * A display that redraws ten times a second has no use for a
+   * thousand spectra a second. A DeliveryRate, handed to
+   * SoDa::MailBox::subscribe, thins the traffic before it reaches the
+   * subscriber's queue: every Nth message, or no more than K messages
+   * a second. The ones it skips are never queued.
+   *
+   * The rate is applied after the subscriber's filter, so "every
+   * tenth message" means every tenth message that passed the filter.
+   */
+  class DeliveryRate {
+  public:
+    /**
+     * @brief every message
+     */
+    static DeliveryRate all() {
+      return DeliveryRate();
+    }
+
+    /**
+     * @brief the first message, then every nth one after it
+     * @param n one in n messages is delivered. Zero or one means all of them.
+     */
+    static DeliveryRate everyNth(unsigned int n) {
+      DeliveryRate ret;
+      ret.every_n = (n == 0) ? 1 : n;
+      return ret;
+    }
+
+    /**
+     * @brief no more than a given number of messages per second
+     *
+     * This is a token bucket: the subscriber earns per_second
+     * tokens a second, can save up to burst of them, and each
+     * message it is sent costs one. Messages that arrive when it has
+     * no tokens are skipped.
+     *
+     * @param per_second the long term rate. Zero or less means no limit.
+     * @param burst the most messages that can be sent back to back
+     */
+    static DeliveryRate perSecond(double per_second, unsigned int burst = 1) {
+      DeliveryRate ret;
+      ret.per_second = per_second;
+      ret.burst = (burst == 0) ? 1 : burst;
+      ret.tokens = ret.burst;
+      return ret;
+    }
+
+    /**
+     * @brief does this rate pass everything?
+     */
+    bool isAll() const {
+      return (every_n <= 1) && (per_second <= 0.0);
+    }
+
+    /**
+     * @brief Would the next message be delivered? This doesn't
+     * change anything.
+     */
+    bool wouldAdmit(const std::chrono::steady_clock::time_point & now) const {
+      if((every_n > 1) && ((seen % every_n) != 0)) return false;
+      if(per_second > 0.0) return refilled(now) >= 1.0;
+      return true;
+    }
+
+    /**
+     * @brief Count the next message.
+     * @returns true if it should be delivered
+     */
+    bool admit(const std::chrono::steady_clock::time_point & now) {
+      bool ok = wouldAdmit(now);
+      seen++;
+      if(per_second > 0.0) {
+	tokens = refilled(now);
+	last_refill = now;
+	if(ok) tokens -= 1.0;
+      }
+      return ok;
+    }
+
+  protected:
+    DeliveryRate() : every_n(1), per_second(0.0), burst(1), seen(0), tokens(0.0) { }
+
+    double refilled(const std::chrono::steady_clock::time_point & now) const {
+      // a new bucket is full.
+      if(last_refill == std::chrono::steady_clock::time_point()) return burst;
+      double t = tokens + std::chrono::duration<double>(now - last_refill).count() * per_second;
+      return (t > burst) ? double(burst) : t;
+    }
+
+    unsigned int every_n;
+    double per_second;
+    unsigned int burst;
+    /// messages offered so far
+    unsigned long seen;
+    double tokens;
+    std::chrono::steady_clock::time_point last_refill;
+  };
+}
@@ -0,0 +1,177 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "Exception.hxx"
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file Executor.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::Executor Executor: a few threads for a lot of little jobs
+ *
+ * A program with hundreds of subscribers doesn't want hundreds of
+ * threads, most of them asleep in waitGet. A SoDa::Executor is a
+ * fixed set of worker threads that run whatever they are handed.
+ * '''submit(task)''' queues a std::function<void()>, and one of the
+ * workers will call it.
+ *
+ * Each worker has its own queue. A task submitted from a worker goes
+ * on that worker's queue, so work that makes more work stays on the
+ * same core. Tasks from anywhere else are dealt out to the workers in
+ * turn. A worker takes tasks from the front of its own queue. When
+ * its queue is empty, it steals from the back of someone else's
+ * before it goes to sleep.
+ *
+ * Tasks that are handed to an executor run in no particular order,
+ * and two of them may run at once. SoDa::MailBox::onMessage builds
+ * ordered, one-at-a-time delivery on top of that.
+ *
+ * A task must not throw. Tasks still queued when the executor is
+ * destroyed are dropped.
+ */
+
+namespace SoDa {
+
+  /**
+   * @class Executor
+   * @brief A work-stealing pool of worker threads.
+   */
+  class Executor : public NoCopy {
+  public:
+    /**
+     * @brief Catch this when you don't care why the Executor threw an exception
+     */
+    class Exception : public SoDa::Exception {
+    public:
+      Exception(const std::string & name, const std::string & problem) :
+	SoDa::Exception("SoDa::Executor[" + name + "] " + problem) {
+      }
+    };
+
+    typedef std::function<void()> Task;
+
+    /**
+     * @brief constructor. This starts the workers.
+     *
+     * @param name the name of the executor
+     * @param num_workers the number of worker threads. If zero, use
+     * one per hardware thread.
+     */
+    Executor(const std::string & name, unsigned int num_workers = 0);
+
+    /**
+     * @brief Stop the workers. Tasks that haven't started are dropped.
+     * Don't destroy an executor from one of its own tasks.
+     */
+    ~Executor();
+
+    /**
+     * @brief Hand a task to one of the workers.
+     *
+     * @param task the function to call
+     * @throws Exception if the executor is shutting down
+     */
+    void submit(const Task & task);
+
+    /**
+     * @brief how many worker threads are there?
+     */
+    unsigned int size() const { return workers.size(); }
+
+    /**
+     * @brief how many tasks are waiting to run?
+     */
+    unsigned long queued() const { return num_queued; }
+
+    /**
+     * @brief how many tasks has each worker run?
+     */
+    std::vector<unsigned long> executedCounts() const;
+
+    /**
+     * @brief how many tasks were run by a worker other than the one
+     * they were queued for?
+     */
+    unsigned long stolenCount() const { return num_stolen; }
+
+    const std::string & getName() const { return name; }
+
+  protected:
+    struct Worker {
+      std::mutex mtx;
+      std::deque<Task> tasks;
+      std::atomic<unsigned long> executed;
+      std::thread thread;
+    };
+
+    /// take a task from worker idx's own queue
+    bool popLocal(unsigned int idx, Task & task);
+    /// take a task from the back of some other worker's queue
+    bool steal(unsigned int idx, Task & task);
+    void workLoop(unsigned int idx);
+
+    std::string name;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    /// where the next task from outside the pool goes
+    std::atomic<unsigned int> next_worker;
+    std::atomic<unsigned long> num_queued;
+    std::atomic<unsigned long> num_stolen;
+
+    /// idle workers sleep here
+    std::mutex idle_mtx;
+    std::condition_variable idle_cv;
+    std::atomic<unsigned int> sleepers;
+    std::atomic<bool> stopping;
+  };
+
+  typedef std::shared_ptr<Executor> ExecutorPtr;
+
+  /**
+   * @brief Make an executor and return a shared pointer to it.
+   *
+   * @param name the name of the executor
+   * @param num_workers the number of worker threads, or zero for one per hardware thread
+   * @returns shared pointer to an Executor
+   */
+  ExecutorPtr makeExecutor(const std::string & name, unsigned int num_workers = 0);
+}
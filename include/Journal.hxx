@@ -0,0 +1,520 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "MailBox.hxx"
+#include "Exception.hxx"
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file Journal.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::Journal Journal: recording and replaying mailbox traffic
+ *
+ * Sometimes we need every message that went through a mailbox: for
+ * an audit trail, or to play a bad afternoon back in the lab. A
+ * subscriber that writes each message to an ostream can't keep up.
+ *
+ * A SoDa::JournalSink subscribes to a mailbox and copies each
+ * message, with the time it was put, into a journal: a series of
+ * segment files, each mapped into memory and filled front to back.
+ * The sink takes everything that is waiting in one getBatch, copies
+ * it all in, and then commits the whole batch at once (a group
+ * commit). When a segment is full, the sink trims it, closes it, and
+ * starts the next one.
+ *
+ * \code
+ *   SoDa::JournalSink<Tuning> sink(tune_mb, "/var/log/radio/tune");
+ *   ...
+ *   sink.stop();
+ * \endcode
+ *
+ * The segments are named prefix.000000.jnl, prefix.000001.jnl, and so
+ * on. A new sink starts a new journal, so any segments already there
+ * with the same prefix are removed. Each segment's blocks are
+ * allocated when it is started, so a full disk shows up as an error
+ * then, not as a crash when a record lands in a page that was never
+ * allocated.
+ *
+ * A record's time stamp is when the message was put, in nanoseconds
+ * of the system clock. The mailbox stamps messages with the steady
+ * clock, and the sink shifts those by the difference between the two
+ * clocks when it started, so the spacing between records is exact
+ * even if the system clock is adjusted while the sink runs.
+ *
+ * If the journal can't be written (the disk filled up, say) the sink
+ * stops: it lets go of its subscription, so the mailbox doesn't fill
+ * up behind it, and '''failed()''' and '''error()''' say what went
+ * wrong.
+ *
+ * A SoDa::JournalReplay reads a journal back and puts the messages
+ * in a mailbox, either as fast as it can, or spaced out the way they
+ * were put (or some multiple of that, to speed things up).
+ *
+ * \code
+ *   auto lab_mb = SoDa::makeMailBox<Tuning>("tune");
+ *   SoDa::JournalReplay<Tuning> replay("/var/log/radio/tune", lab_mb);
+ *   replay.run(10.0); // ten times faster than it happened
+ * \endcode
+ *
+ * Messages are written by a SoDa::JournalCodec. The standard one
+ * copies the bytes of a trivially copyable type. For anything else,
+ * specialize JournalCodec, or pass a codec class as the second
+ * template parameter.
+ *
+ * How hard the sink works to get each batch onto the disk is up to
+ * the commit mode. NONE leaves it to the kernel. ASYNC (the default)
+ * starts the write-back after each batch. SYNC waits for it. Each
+ * record carries a checksum, so if the machine goes down in the
+ * middle of a write, the reader stops at the last good record.
+ *
+ * SoDa::JournalWriter and SoDa::JournalReader do the work underneath,
+ * and can be used on their own to journal raw bytes.
+ */
+
+namespace SoDa {
+
+  /**
+   * @class JournalWriter
+   * @brief Append records to a journal of memory-mapped segment files.
+   */
+  class JournalWriter : public NoCopy {
+  public:
+    /**
+     * @brief Catch this when you don't care why the journal threw an exception
+     */
+    class Exception : public SoDa::Exception {
+    public:
+      Exception(const std::string & name, const std::string & problem) :
+	SoDa::Exception("SoDa::Journal[" + name + "] " + problem) {
+      }
+    };
+
+    /**
+     * @brief What does commit do?
+     */
+    enum Commit {
+      NONE, ///< nothing: the kernel writes the pages back when it gets around to it
+      ASYNC, ///< start writing the new records back
+      SYNC ///< write the new records back, and wait for it
+    };
+
+    /**
+     * @brief Start a new journal.
+     *
+     * @param prefix the segment files are named prefix.NNNNNN.jnl.
+     * Segments left from an earlier journal with the same prefix are removed.
+     * @param segment_size the size of each segment file, in bytes
+     * @param commit what commit does
+     * @throws Exception if a segment can't be created
+     */
+    JournalWriter(const std::string & prefix,
+		  size_t segment_size = 64 * 1024 * 1024,
+		  Commit commit = ASYNC);
+
+    /**
+     * @brief Commit and close the current segment.
+     */
+    ~JournalWriter();
+
+    /**
+     * @brief Add a record. It is visible to a reader right away, but
+     * it isn't committed until commit is called.
+     *
+     * @param data the record's bytes
+     * @param len how many bytes
+     * @param stamp_ns a time stamp for the record, in nanoseconds
+     * @throws Exception if the record is too big for a segment
+     */
+    void append(const void * data, uint32_t len, int64_t stamp_ns);
+
+    /**
+     * @brief Commit everything appended so far, as the commit mode says.
+     */
+    void commit();
+
+    /**
+     * @brief how many segments has the journal used?
+     */
+    unsigned int segmentCount() const { return segment_idx + 1; }
+
+    /**
+     * @brief how many records have been appended?
+     */
+    unsigned long recordCount() const { return records; }
+
+    const std::string & getPrefix() const { return prefix; }
+
+    /**
+     * @brief the name of a segment file
+     */
+    static std::string segmentName(const std::string & prefix, unsigned int idx);
+
+    /**
+     * @brief Remove a journal's segment files.
+     *
+     * @param prefix the journal's prefix
+     * @returns the number of segments removed
+     */
+    static unsigned int remove(const std::string & prefix);
+
+  protected:
+    void openSegment();
+    void closeSegment();
+
+    std::string prefix;
+    size_t segment_size;
+    Commit commit_mode;
+
+    int fd;
+    char * base;
+    /// bytes of the current segment in use
+    size_t used;
+    /// bytes of the current segment already committed
+    size_t committed;
+    unsigned int segment_idx;
+    unsigned long records;
+  };
+
+  /**
+   * @class JournalReader
+   * @brief Read the records in a journal, oldest first.
+   */
+  class JournalReader : public NoCopy {
+  public:
+    /**
+     * @brief Open a journal.
+     *
+     * @param prefix the prefix the journal was written with
+     * @throws JournalWriter::Exception if there is no such journal
+     */
+    JournalReader(const std::string & prefix);
+
+    ~JournalReader();
+
+    /**
+     * @brief Get the next record.
+     *
+     * @param data set to point at the record's bytes, in the mapped
+     * segment. They stay put until the next call to next.
+     * @param len set to the number of bytes
+     * @param stamp_ns set to the record's time stamp
+     * @returns false if there are no more records.
+     */
+    bool next(const char * & data, uint32_t & len, int64_t & stamp_ns);
+
+    /**
+     * @brief How many segments ended in a damaged record? A journal
+     * whose writer died in the middle of a record has one.
+     */
+    unsigned int tornCount() const { return torn; }
+
+  protected:
+    /// map segment idx. Returns false if there isn't one.
+    bool openSegment(unsigned int idx);
+    void closeSegment();
+
+    std::string prefix;
+    char * base;
+    size_t map_size;
+    size_t pos;
+    unsigned int segment_idx;
+    unsigned int torn;
+  };
+
+  /**
+   * @brief How a JournalSink writes a message, and a JournalReplay
+   * reads it back. This one copies the bytes, so it only works for
+   * trivially copyable types. Specialize it for the others.
+   */
+  template<typename T>
+  struct JournalCodec {
+    static_assert(std::is_trivially_copyable<T>::value,
+		  "specialize SoDa::JournalCodec for types that aren't trivially copyable");
+
+    static void encode(const T & msg, std::vector<char> & buf) {
+      buf.resize(sizeof(T));
+      std::memcpy(buf.data(), &msg, sizeof(T));
+    }
+
+    /// @returns the message, or nullptr if the record isn't one
+    static std::shared_ptr<T> decode(const char * data, uint32_t len) {
+      if(len != sizeof(T)) return nullptr;
+      // the record may not be aligned for a T
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type tmp;
+      std::memcpy(&tmp, data, sizeof(T));
+      return std::make_shared<T>(*reinterpret_cast<T *>(&tmp));
+    }
+  };
+
+  /**
+   * @class JournalSink
+   * @brief A subscriber that writes everything put in a mailbox to a journal.
+   *
+   * @tparam T the mailbox's message type
+   * @tparam Codec writes a T as bytes. See JournalCodec.
+   */
+  template<typename T, typename Codec = JournalCodec<T>>
+  class JournalSink : public NoCopy {
+  public:
+    /**
+     * @brief Subscribe to a mailbox and start journaling. Everything
+     * put after the constructor returns goes in the journal.
+     *
+     * @param mailbox_p the mailbox to record. This turns on its message stamps.
+     * @param prefix where the journal goes. See JournalWriter.
+     * @param segment_size the size of each segment file, in bytes
+     * @param commit what to do after each batch
+     * @param batch most messages to take (and commit) at one time
+     */
+    JournalSink(MailBoxPtr<T> mailbox_p, const std::string & prefix,
+		size_t segment_size = 64 * 1024 * 1024,
+		JournalWriter::Commit commit = JournalWriter::ASYNC,
+		unsigned int batch = 256) :
+      mailbox_p(mailbox_p), writer(prefix, segment_size, commit),
+      batch((batch == 0) ? 1 : batch) {
+      mailbox_p->stampMessages(true);
+      subs = mailbox_p->subscribe();
+      stopping = false;
+      has_failed = false;
+      recorded = 0;
+      // the clocks are compared once, so a step in the system clock
+      // doesn't change the spacing between records.
+      stamp_offset_ns = std::chrono::duration_cast<std::chrono::nanoseconds>
+	(std::chrono::system_clock::now().time_since_epoch()).count() -
+	std::chrono::duration_cast<std::chrono::nanoseconds>
+	(std::chrono::steady_clock::now().time_since_epoch()).count();
+      thread = std::thread(&JournalSink::work, this);
+    }
+
+    ~JournalSink() {
+      stop();
+    }
+
+    /**
+     * @brief Write what is waiting, commit it, and stop. It is OK
+     * to call this more than once.
+     */
+    void stop() {
+      if(!thread.joinable()) return;
+      stopping = true;
+      thread.join();
+      subs = nullptr;
+    }
+
+    /**
+     * @brief how many messages have been written?
+     */
+    unsigned long recordedCount() const { return recorded; }
+
+    /**
+     * @brief did the sink stop because the journal couldn't be written?
+     */
+    bool failed() const { return has_failed; }
+
+    /**
+     * @brief why the sink stopped
+     *
+     * @returns the exception the journal threw, or nullptr if it hasn't failed.
+     */
+    std::exception_ptr error() const {
+      std::lock_guard<std::mutex> lock(err_mtx);
+      return err;
+    }
+
+    /**
+     * @brief how many segments has the journal used? Call this after stop.
+     */
+    unsigned int segmentCount() const { return writer.segmentCount(); }
+
+  protected:
+    void work() {
+      try {
+	while(!stopping) {
+	  // wake up now and then to see if we've been told to stop.
+	  if(mailbox_p->waitReady(subs, 1, std::chrono::milliseconds(10)) == 0) continue;
+	  writeBatch();
+	}
+	// anything put before stop was called still goes in.
+	while(writeBatch() != 0) { }
+      }
+      catch (...) {
+	{
+	  std::lock_guard<std::mutex> lock(err_mtx);
+	  err = std::current_exception();
+	}
+	has_failed = true;
+	// nobody is reading the queue any more.
+	subs = nullptr;
+      }
+    }
+
+    unsigned int writeBatch() {
+      msgs.clear();
+      stamps.clear();
+      unsigned int n = mailbox_p->getBatch(subs, msgs, stamps, batch);
+      unsigned long written = 0;
+      for(unsigned int i = 0; i < n; i++) {
+	if(msgs[i] == nullptr) continue;
+	Codec::encode(*msgs[i], buf);
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stamps[i].time_since_epoch()).count();
+	writer.append(buf.data(), buf.size(), ns + stamp_offset_ns);
+	written++;
+      }
+      if(n != 0) writer.commit();
+      recorded += written;
+      return n;
+    }
+
+    MailBoxPtr<T> mailbox_p;
+    typename MailBox<T>::Subscription subs;
+    JournalWriter writer;
+    unsigned int batch;
+    std::vector<std::shared_ptr<T>> msgs;
+    std::vector<std::chrono::steady_clock::time_point> stamps;
+    std::vector<char> buf;
+    std::atomic<bool> stopping;
+    std::atomic<bool> has_failed;
+    std::atomic<unsigned long> recorded;
+    /// system clock minus steady clock, in nanoseconds
+    int64_t stamp_offset_ns;
+    mutable std::mutex err_mtx;
+    std::exception_ptr err;
+    std::thread thread;
+  };
+
+  /**
+   * @class JournalReplay
+   * @brief Put the messages in a journal back into a mailbox.
+   *
+   * @tparam T the mailbox's message type
+   * @tparam Codec reads a T from bytes. See JournalCodec.
+   */
+  template<typename T, typename Codec = JournalCodec<T>>
+  class JournalReplay : public NoCopy {
+  public:
+    /**
+     * @brief constructor
+     *
+     * @param prefix the prefix the journal was written with
+     * @param mailbox_p put the messages here
+     * @throws JournalWriter::Exception if there is no such journal
+     */
+    JournalReplay(const std::string & prefix, MailBoxPtr<T> mailbox_p) :
+      reader(prefix), mailbox_p(mailbox_p) {
+      stopping = false;
+      skipped = 0;
+    }
+
+    /**
+     * @brief Put every message in the journal. This returns when the
+     * journal is done, or stop is called.
+     *
+     * @param speed 1.0 puts the messages with the same spacing they
+     * were put with in the first place; 10.0 puts them ten times as
+     * fast. Zero or less puts them as fast as possible.
+     * @returns the number of messages put
+     */
+    unsigned long run(double speed = 1.0) {
+      const char * data;
+      uint32_t len;
+      int64_t stamp_ns;
+      int64_t first_ns = 0;
+      bool first = true;
+      auto start = std::chrono::steady_clock::now();
+      unsigned long ret = 0;
+      while(!stopping && reader.next(data, len, stamp_ns)) {
+	auto msg = Codec::decode(data, len);
+	if(msg == nullptr) {
+	  skipped++;
+	  continue;
+	}
+	if(first) {
+	  first_ns = stamp_ns;
+	  first = false;
+	}
+	if(speed > 0.0) {
+	  auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>
+	    (std::chrono::duration<double, std::nano>((stamp_ns - first_ns) / speed));
+	  sleepUntil(due);
+	  if(stopping) break;
+	}
+	mailbox_p->put(msg);
+	ret++;
+      }
+      return ret;
+    }
+
+    /**
+     * @brief Tell run to stop early. It can be called from any thread.
+     */
+    void stop() { stopping = true; }
+
+    /**
+     * @brief how many records couldn't be decoded?
+     */
+    unsigned long skippedCount() const { return skipped; }
+
+    /**
+     * @brief how many segments ended in a damaged record?
+     */
+    unsigned int tornCount() const { return reader.tornCount(); }
+
+  protected:
+    void sleepUntil(const std::chrono::steady_clock::time_point & due) {
+      // in short naps, so that stop doesn't have to wait out a long gap.
+      while(!stopping) {
+	auto now = std::chrono::steady_clock::now();
+	if(now >= due) return;
+	auto nap = due - now;
+	if(nap > std::chrono::milliseconds(100)) nap = std::chrono::milliseconds(100);
+	std::this_thread::sleep_for(nap);
+      }
+    }
+
+    JournalReader reader;
+    MailBoxPtr<T> mailbox_p;
+    std::atomic<bool> stopping;
+    unsigned long skipped;
+  };
+}
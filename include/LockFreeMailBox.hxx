@@ -0,0 +1,598 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+
+#include "MailBox.hxx"
+#include "MPSCRing.hxx"
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file LockFreeMailBox.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::LockFreeMailBox LockFreeMailBox: a MailBox that doesn't serialize on one lock
+ *
+ * SoDa::MailBox protects all of its subscriber queues with a single
+ * mutex. That is simple and correct, but when there are lots of
+ * threads all putting and getting at once, every one of them lines
+ * up for the same lock.
+ *
+ * SoDa::LockFreeMailBox has the same subscribe/put/get/waitGet
+ * interface, but each subscriber owns a bounded SoDa::MPSCRing.  A
+ * put pushes the message into each subscriber's ring without taking
+ * a lock, and a get pops from the caller's own ring without taking a
+ * lock. Producers and consumers on different cores leave each other
+ * alone.
+ *
+ * There is a price, of course:
+ *
+ * - The rings are bounded. The ring size is set when the mailbox is
+ *   created. If a subscriber's ring is full, put will wait (yielding
+ *   the processor) until the subscriber makes room. A subscriber that
+ *   stops reading its mail will eventually stall the producers. Be
+ *   careful with threads that both put and get: a thread that is
+ *   stuck in put can't drain its own ring.
+ * - The number of subscribers is limited. The limit is set when the
+ *   mailbox is created.
+ * - subscribe and unsubscribe still take a lock. They are expected to
+ *   be rare.
+ * - A put is not atomic across subscribers. Messages from one producer
+ *   arrive in order, but if thread A sends a message in response to
+ *   one it got from thread B, a third subscriber may see A's message
+ *   before B's. SoDa::MailBox doesn't have this problem, since a put
+ *   reaches every queue before the lock is released.
+ *
+ * A subscriber that calls waitGet sleeps on its own condition
+ * variable. The producer only touches the subscriber's mutex when it
+ * sees that the subscriber is asleep, so the hot path stays lock-free.
+ *
+ * MailBoxTest.cxx runs the same test against either flavor of mailbox.
+ */
+
+namespace SoDa {
+
+  /**
+   * @class LockFreeMailBox<T>
+   * @brief Accept messages and distribute them to multiple subscribers
+   * through per-subscriber lock-free rings.
+   *
+   * @tparam T Type of message that will be found in this mailbox
+   */
+  template<typename T>
+  class LockFreeMailBox : public MailBoxBase, NoCopy {
+  public:
+    /**
+     * @brief Create a mailbox.
+     *
+     * @param name the name of the mailbox
+     * @param ring_size each subscriber's ring will hold at least this many
+     * messages.
+     * @param max_subscribers the mailbox can have at most this many subscribers
+     * at one time.
+     */
+    LockFreeMailBox(std::string name,
+		    unsigned int ring_size = 1024,
+		    unsigned int max_subscribers = 64) :
+      MailBoxBase(name), ring_size(ring_size), max_subscribers(max_subscribers) {
+      subscribers = std::unique_ptr<SubscriberSlot[]>(new SubscriberSlot[max_subscribers]);
+      for(unsigned int i = 0; i < max_subscribers; i++) {
+	subscribers[i].ring.store(nullptr);
+	subscribers[i].users.store(0);
+      }
+      slot_limit.store(0);
+      subscriber_count = 0;
+    }
+
+    ~LockFreeMailBox() {
+      for(unsigned int i = 0; i < max_subscribers; i++) {
+	delete subscribers[i].ring.load();
+      }
+    }
+
+    /**
+     * @brief The mailbox already has max_subscribers subscribers.
+     */
+    class TooManySubscribers : public Exception {
+    public:
+      TooManySubscribers(const std::string & name, unsigned int max_subs) :
+	Exception(name, SoDa::Format("::subscribe() limit of %0 subscribers exceeded.")
+		  .addU(max_subs).str()) {
+      }
+    };
+
+  protected:
+    class SubscriptionCl {
+    public:
+      SubscriptionCl(LockFreeMailBox<T> * mbox, int idx) {
+	this_mbox = mbox;
+	subscriber_index = idx;
+      }
+
+      ~SubscriptionCl() {
+	this_mbox->unsubscribe(subscriber_index);
+      }
+
+      int getIndex(LockFreeMailBox<T> * mbox) const {
+	if(mbox != this_mbox) {
+	  throw SubscriptionMismatch(mbox->getName(), this_mbox->getName());
+	}
+	else {
+	  return subscriber_index;
+	}
+      }
+      /// selects the subscriber slot
+      int subscriber_index;
+      /// double check that we're referencing the right mailbox
+      LockFreeMailBox<T> * this_mbox;
+      /// how waitGet waits -- only the subscriber's thread uses it
+      WaitStrategy wait_strategy;
+    };
+
+  public:
+    typedef std::unique_ptr<SubscriptionCl> Subscription;
+
+    /**
+     * @brief Subscribe the caller to a mailbox.
+     *
+     * @returns a smart pointer to a subscriber object.
+     * @throws TooManySubscribers if all the subscriber slots are taken.
+     */
+    Subscription subscribe() {
+      std::lock_guard<std::mutex> lock(sub_mtx);
+      for(unsigned int i = 0; i < max_subscribers; i++) {
+	auto & slot = subscribers[i];
+	if(slot.ring.load() == nullptr) {
+	  slot.ring.store(new SubscriberRing(ring_size));
+	  if(i >= slot_limit.load()) slot_limit.store(i + 1);
+	  subscriber_count++;
+	  return Subscription(new SubscriptionCl(this, i));
+	}
+      }
+      throw TooManySubscribers(getName(), max_subscribers);
+    }
+
+    /**
+     * Get an object out of the mailbox for this subscriber. This does
+     * not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @returns The oldest object in the subscriber's mailbox, or nullptr if
+     * the mailbox is empty.
+     */
+    std::shared_ptr<T> get(Subscription & subs) {
+      std::shared_ptr<T> ret;
+      getRing(subs).ring.pop(ret);
+      return ret;
+    }
+
+    /**
+     * @brief Get an object out of the mailbox for this subscriber,
+     * waiting for one to arrive if the mailbox is empty.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns The oldest object in the subscriber's mailbox, or nullptr
+     * if the timeout expired before a message arrived.
+     */
+    std::shared_ptr<T> waitGet(Subscription & subs,
+			       const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      auto & sr = getRing(subs);
+      std::shared_ptr<T> ret;
+      if(sr.ring.pop(ret)) return ret;
+
+      // spin first, if the subscriber asked us to.
+      auto & strategy = subs->wait_strategy;
+      auto wait_time = timeout;
+      if(strategy.getKind() != WaitStrategy::BLOCK) {
+	auto deadline = WaitStrategy::deadline(timeout);
+	if(strategy.spin([&sr]() { return !sr.ring.empty(); }, deadline)) {
+	  sr.ring.pop(ret);
+	  return ret;
+	}
+	if(timeout.count() != 0) {
+	  wait_time = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+	  // zero would mean forever
+	  if(wait_time.count() <= 0) wait_time = std::chrono::microseconds(1);
+	}
+	bool got_one = waitForMessages(sr, 1, wait_time);
+	strategy.parked(got_one);
+	if(got_one) sr.ring.pop(ret);
+	return ret;
+      }
+
+      if(waitForMessages(sr, 1, timeout)) {
+	sr.ring.pop(ret);
+      }
+      return ret;
+    }
+
+    /**
+     * @brief Wait until there are at least num_msgs messages in
+     * the subscriber's ring.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param num_msgs wake up when this many messages are waiting.
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns count of outstanding messages for this subscriber.
+     */
+    unsigned int waitReady(Subscription & subs, unsigned int num_msgs,
+			   const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      auto & sr = getRing(subs);
+      waitForMessages(sr, num_msgs, timeout);
+      return sr.ring.size();
+    }
+
+    /**
+     * @brief Place a message in every subscriber's mailbox
+     *
+     * If a subscriber's ring is full, put will wait until there is
+     * room.
+     *
+     * @param msg The message to be sent to every subscriber.
+     * @param subs If supplied, messages will *not* be enqueued to the sender's
+     * message queue.
+     */
+    void put(std::shared_ptr<T> msg, const Subscription & subs = nullptr) {
+      int omit_key = -1;
+      if(subs != nullptr) {
+	omit_key = subs->getIndex(this);
+      }
+
+      unsigned int lim = slot_limit.load(std::memory_order_acquire);
+      for(unsigned int i = 0; i < lim; i++) {
+	if(int(i) == omit_key) continue;
+	auto & slot = subscribers[i];
+	// don't bother with the reference count if nobody is home
+	if(slot.ring.load(std::memory_order_relaxed) == nullptr) continue;
+
+	// hold the slot so that unsubscribe won't delete the ring
+	// out from under us.
+	slot.users.fetch_add(1);
+	SubscriberRing * sr = slot.ring.load();
+	if(sr != nullptr) {
+	  std::shared_ptr<T> m = msg;
+	  pushOrWait(slot, *sr, m);
+	  wake(*sr);
+	}
+	slot.users.fetch_sub(1);
+      }
+    }
+
+    /**
+     * @brief Place a run of messages in every subscriber's mailbox
+     *
+     * Each subscriber's ring gets the whole run before we move on to
+     * the next subscriber, and a sleeping subscriber is woken at
+     * most once.
+     *
+     * @tparam Iterator anything that dereferences to a std::shared_ptr<T>
+     * @param begin the first message in the run
+     * @param end one past the last message in the run
+     * @param subs If supplied, messages will *not* be enqueued to the sender's
+     * message queue.
+     */
+    template<typename Iterator>
+    void putBatch(Iterator begin, Iterator end, const Subscription & subs = nullptr) {
+      int omit_key = -1;
+      if(subs != nullptr) {
+	omit_key = subs->getIndex(this);
+      }
+
+      unsigned int lim = slot_limit.load(std::memory_order_acquire);
+      for(unsigned int i = 0; i < lim; i++) {
+	if(int(i) == omit_key) continue;
+	auto & slot = subscribers[i];
+	if(slot.ring.load(std::memory_order_relaxed) == nullptr) continue;
+
+	slot.users.fetch_add(1);
+	SubscriberRing * sr = slot.ring.load();
+	if(sr != nullptr) {
+	  for(Iterator it = begin; it != end; ++it) {
+	    std::shared_ptr<T> m = *it;
+	    if(!pushOrWait(slot, *sr, m)) break;
+	  }
+	  wake(*sr);
+	}
+	slot.users.fetch_sub(1);
+      }
+    }
+
+    /**
+     * @brief Get a run of messages out of the mailbox for this subscriber.
+     * This does not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param out messages are appended to this vector, oldest first.
+     * @param max_msgs take no more than this many messages.
+     * @returns the number of messages appended to out.
+     */
+    unsigned int getBatch(Subscription & subs,
+			  std::vector<std::shared_ptr<T>> & out,
+			  unsigned int max_msgs = ~0) {
+      auto & sr = getRing(subs);
+      unsigned int ret = 0;
+      std::shared_ptr<T> m;
+      while((ret < max_msgs) && sr.ring.pop(m)) {
+	out.push_back(std::move(m));
+	ret++;
+      }
+      return ret;
+    }
+
+    /**
+     * @brief Take every waiting message for this subscriber and hand
+     * each one, oldest first, to a callback. This does not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param callback called once for each message
+     * @returns the number of messages passed to the callback.
+     */
+    unsigned int drain(Subscription & subs,
+		       const std::function<void(std::shared_ptr<T>)> & callback) {
+      auto & sr = getRing(subs);
+      unsigned int ret = 0;
+      std::shared_ptr<T> m;
+      while(sr.ring.pop(m)) {
+	callback(std::move(m));
+	ret++;
+      }
+      return ret;
+    }
+
+    /**
+     * Return the number of messages in the ring for this subscriber.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     *
+     * @returns count of outstanding messages for this subscriber
+     */
+    unsigned int readyCount(Subscription & subs) {
+      return getRing(subs).ring.size();
+    }
+
+    /**
+     * Return the smallest number of waiting messages in
+     * the queue for all subscribers
+     *
+     * @returns count of outstanding messages in the shortest
+     * subscriber queue.
+     */
+    unsigned int minReadyCount() {
+      unsigned int ret = ~0;
+      unsigned int lim = slot_limit.load(std::memory_order_acquire);
+      for(unsigned int i = 0; i < lim; i++) {
+	auto & slot = subscribers[i];
+	slot.users.fetch_add(1);
+	SubscriberRing * sr = slot.ring.load();
+	if(sr != nullptr) {
+	  unsigned int qs = sr->ring.size();
+	  ret = (ret < qs) ? ret : qs;
+	}
+	slot.users.fetch_sub(1);
+      }
+      return ret;
+    }
+
+    /**
+     * @brief Empty the subscriber's mailbox
+     *
+     * @param subs -- identifies the subscription we're clearing
+     */
+    void clear(Subscription & subs) {
+      auto & sr = getRing(subs);
+      std::shared_ptr<T> m;
+      while(sr.ring.pop(m)) { }
+    }
+
+    void unsubscribe(int subid) {
+      std::lock_guard<std::mutex> lock(sub_mtx);
+      if((subid < 0) || (subid >= int(max_subscribers))) {
+	throw MissingSubscriber(getName(), "unsubscribe()", subid);
+      }
+      auto & slot = subscribers[subid];
+      SubscriberRing * sr = slot.ring.load();
+      if(sr == nullptr) {
+	throw MissingSubscriber(getName(), "unsubscribe()", subid);
+      }
+      slot.ring.store(nullptr);
+      // wait for any producer that is still working on this ring.
+      while(slot.users.load() != 0) {
+	std::this_thread::yield();
+      }
+      delete sr;
+      subscriber_count--;
+    }
+
+    unsigned int subscriberCount() {
+      std::lock_guard<std::mutex> lock(sub_mtx);
+      return subscriber_count;
+    }
+
+    /**
+     * @brief Choose how waitGet waits for this subscriber's mail. See
+     * SoDa::WaitStrategy. Call this from the subscriber's own thread.
+     *
+     * @param subs the subscriber
+     * @param kind spin, yield, park, or some combination
+     * @param spin_count spin this many times before yielding or sleeping
+     * @param spin_time how long a TIMED_SPIN spins before sleeping
+     */
+    void setWaitStrategy(Subscription & subs, WaitStrategy::Kind kind,
+			 unsigned int spin_count = 1000,
+			 const std::chrono::duration<long, std::micro> & spin_time = std::chrono::microseconds(50)) {
+      subs->getIndex(this);
+      subs->wait_strategy.configure(kind, spin_count, spin_time);
+    }
+
+    /**
+     * @brief How have this subscriber's waits turned out?
+     *
+     * @param subs the subscriber
+     * @returns counts of waits that ended in each phase of the strategy
+     */
+    WaitStrategy::Stats waitStats(const Subscription & subs) const {
+      return subs->wait_strategy.stats();
+    }
+
+  protected:
+    /**
+     * @brief Each subscriber gets a ring, along with the things it
+     * needs to sleep while it waits for mail.
+     */
+    struct SubscriberRing {
+      SubscriberRing(unsigned int ring_size) : ring(ring_size) {
+	sleeping.store(false);
+	wait_count = 0;
+      }
+      MPSCRing<std::shared_ptr<T>> ring;
+      /// true when the subscriber is (about to be) waiting on cv
+      std::atomic<bool> sleeping;
+      /// the subscriber wants this many messages before it wakes up
+      unsigned int wait_count;
+      std::mutex mtx;
+      std::condition_variable cv;
+    };
+
+    /**
+     * @brief A slot in the subscriber table. The users count keeps
+     * unsubscribe from deleting a ring that a producer is filling.
+     */
+    struct SubscriberSlot {
+      std::atomic<SubscriberRing *> ring;
+      std::atomic<unsigned int> users;
+      // producers bang on users -- keep neighboring slots off this cache line
+      char pad[64 - sizeof(std::atomic<SubscriberRing *>) - sizeof(std::atomic<unsigned int>)];
+    };
+
+    SubscriberRing & getRing(Subscription & subs) {
+      int idx = subs->getIndex(this);
+      SubscriberRing * sr = subscribers[idx].ring.load(std::memory_order_acquire);
+      if(sr == nullptr) {
+	throw MissingSubscriber(getName(), "get()", idx);
+      }
+      return *sr;
+    }
+
+    /**
+     * @brief push a message into a subscriber's ring. If the ring is
+     * full, wait for the subscriber to catch up, unless it has gone
+     * away.
+     *
+     * @returns false if the subscriber went away.
+     */
+    bool pushOrWait(SubscriberSlot & slot, SubscriberRing & sr, std::shared_ptr<T> & m) {
+      while(!sr.ring.push(m)) {
+	if(slot.ring.load(std::memory_order_relaxed) != &sr) return false;
+	// The subscriber may be asleep waiting for more than is in the ring.
+	wake(sr);
+	std::this_thread::yield();
+      }
+      return true;
+    }
+
+    /**
+     * @brief tell a subscriber that there is mail, if it is asleep.
+     */
+    void wake(SubscriberRing & sr) {
+      // The fence pairs with the one in waitForMessages. Either the
+      // subscriber sees the message we just pushed, or we see
+      // that it is sleeping.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(sr.sleeping.load(std::memory_order_relaxed)) {
+	std::lock_guard<std::mutex> lock(sr.mtx);
+	if(sr.ring.size() >= sr.wait_count) sr.cv.notify_one();
+      }
+    }
+
+    bool waitForMessages(SubscriberRing & sr, unsigned int num_msgs,
+			 const std::chrono::duration<long, std::micro> & timeout) {
+      std::unique_lock<std::mutex> lock(sr.mtx);
+      sr.wait_count = num_msgs;
+      sr.sleeping.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      // size() counts slots that producers have claimed but not yet
+      // filled, so ask the ring directly when we want just one message.
+      auto ready = [&sr, num_msgs]() {
+	return (num_msgs <= 1) ? !sr.ring.empty() : (sr.ring.size() >= num_msgs);
+      };
+      bool ret = true;
+      if(timeout.count() == 0) {
+	sr.cv.wait(lock, ready);
+      }
+      else {
+	ret = sr.cv.wait_for(lock, timeout, ready);
+      }
+      sr.sleeping.store(false, std::memory_order_relaxed);
+      return ret;
+    }
+
+    unsigned int ring_size;
+    unsigned int max_subscribers;
+    std::unique_ptr<SubscriberSlot[]> subscribers;
+    /// one past the highest subscriber slot that has ever been used
+    std::atomic<unsigned int> slot_limit;
+    unsigned int subscriber_count;
+
+    /// subscribe and unsubscribe are serialized
+    std::mutex sub_mtx;
+  };
+
+  /**
+   * @brief Make a lock-free mailbox and return a shared pointer to it.
+   *
+   * @param mname Name of the mailbox.
+   * @param ring_size each subscriber's ring will hold at least this many
+   * messages.
+   * @param max_subscribers the mailbox can have at most this many subscribers
+   * at one time.
+   * @returns shared pointer to a LockFreeMailBox object
+   */
+  template<typename T>
+  std::shared_ptr<LockFreeMailBox<T>> makeLockFreeMailBox(const std::string & mname,
+							   unsigned int ring_size = 1024,
+							   unsigned int max_subscribers = 64) {
+    return std::make_shared<LockFreeMailBox<T>>(mname, ring_size, max_subscribers);
+  }
+
+  template<typename T>
+  using LockFreeMailBoxPtr = std::shared_ptr<LockFreeMailBox<T>>;
+}
@@ -0,0 +1,181 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file MPSCRing.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::MPSCRing MPSCRing: a bounded multi-producer single-consumer ring
+ *
+ * This is the queue underneath SoDa::LockFreeMailBox. Any number of
+ * threads may push into the ring, but only one thread (the
+ * subscriber) may pop from it.
+ *
+ * Each slot carries a sequence number that tells producers and the
+ * consumer whose turn it is to touch the slot. (The scheme is Dmitry
+ * Vyukov's bounded queue. It is well worth reading about.) Producers
+ * claim a slot with a compare-and-swap on the head index. The
+ * consumer owns the tail index outright. The head and tail live on
+ * separate cache lines so that producers and the consumer don't
+ * spend their time bouncing a line back and forth between cores.
+ *
+ * The storage is allocated once, when the ring is created. Nothing is
+ * allocated on a push or a pop.
+ */
+
+namespace SoDa {
+
+  /**
+   * @class MPSCRing
+   * @brief A bounded lock-free queue with many producers and one consumer.
+   *
+   * @tparam T Type of object held in the ring. It must be default
+   * constructible and move assignable.
+   */
+  template<typename T>
+  class MPSCRing : public NoCopy {
+  public:
+    /**
+     * @brief constructor
+     * @param min_size the ring will hold at least this many entries. The
+     * actual size is rounded up to the next power of two.
+     */
+    MPSCRing(size_t min_size) {
+      size_t sz = 2;
+      while(sz < min_size) sz = sz << 1;
+      mask = sz - 1;
+      slots = std::unique_ptr<Slot[]>(new Slot[sz]);
+      for(size_t i = 0; i < sz; i++) {
+	slots[i].seq.store(i, std::memory_order_relaxed);
+      }
+      head.store(0, std::memory_order_relaxed);
+      tail.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief add an entry to the ring. May be called from any thread.
+     * @param v the value to push -- it will be moved into the ring.
+     * @returns false if the ring was full. v is untouched in that case.
+     */
+    bool push(T & v) {
+      size_t pos = head.load(std::memory_order_relaxed);
+      while(true) {
+	Slot & s = slots[pos & mask];
+	size_t seq = s.seq.load(std::memory_order_acquire);
+	long dif = (long) seq - (long) pos;
+	if(dif == 0) {
+	  // the slot is free, try to claim it.
+	  if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+	    s.value = std::move(v);
+	    s.seq.store(pos + 1, std::memory_order_release);
+	    return true;
+	  }
+	  // pos was reloaded by the failed CAS
+	}
+	else if(dif < 0) {
+	  // the consumer hasn't gotten to this slot yet -- we're full
+	  return false;
+	}
+	else {
+	  // another producer beat us to it
+	  pos = head.load(std::memory_order_relaxed);
+	}
+      }
+    }
+
+    /**
+     * @brief take the oldest entry out of the ring. Only the
+     * consumer may call this.
+     * @param v the oldest entry is moved here
+     * @returns false if the ring was empty
+     */
+    bool pop(T & v) {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      Slot & s = slots[pos & mask];
+      size_t seq = s.seq.load(std::memory_order_acquire);
+      if(seq != (pos + 1)) return false;
+      v = std::move(s.value);
+      // leave a default constructed value behind so that the slot
+      // doesn't hold a reference to the old entry.
+      s.value = T();
+      s.seq.store(pos + mask + 1, std::memory_order_release);
+      tail.store(pos + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    /**
+     * @brief is the ring empty? Only exact when called by the consumer.
+     */
+    bool empty() const {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      return slots[pos & mask].seq.load(std::memory_order_acquire) != (pos + 1);
+    }
+
+    /**
+     * @brief number of entries in the ring. This is a snapshot, and may
+     * be stale by the time the caller looks at it.
+     */
+    size_t size() const {
+      size_t t = tail.load(std::memory_order_acquire);
+      size_t h = head.load(std::memory_order_acquire);
+      return (h > t) ? (h - t) : 0;
+    }
+
+    /**
+     * @brief how many entries will the ring hold?
+     */
+    size_t capacity() const { return mask + 1; }
+
+  protected:
+    static const size_t cache_line = 64;
+
+    struct Slot {
+      std::atomic<size_t> seq;
+      T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+
+    // keep the producer and consumer indices on their own cache lines.
+    char pad0[cache_line];
+    std::atomic<size_t> head; ///< next slot a producer will claim
+    char pad1[cache_line - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail; ///< next slot the consumer will read
+    char pad2[cache_line - sizeof(std::atomic<size_t>)];
+  };
+}
@@ -2,14 +2,35 @@
 #include <string>
 #include <map>
 #include <queue>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <functional>
 #include <memory>
+#include <exception>
 #include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <chrono>
 #include <typeinfo>
 #include <cxxabi.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
 
 #include "Format.hxx"
 #include "Exception.hxx"
 #include "NoCopy.hxx"
+#include "MailBoxStats.hxx"
+#include "DeliveryRate.hxx"
+#include "WaitStrategy.hxx"
+#include "TimerWheel.hxx"
+#include "Executor.hxx"
 /*
   BSD 2-Clause License
 
@@ -117,12 +138,23 @@
  * 
  * \snippet MailBoxTest.cxx get message
  * 
- * The call to '''get''' is non-blocking. If there are no messages in
- * the mailbox, '''get''' will return a nullptr.  Also, see that the
- * '''get''' method takes a "subscriber id." This is the id that was
- * returned by the '''subscribe''' method. Calling get with a
+ * The call to '''waitGet''' will block until a message arrives in
+ * the subscriber's queue, or until the timeout expires. (A zero
+ * timeout means "wait forever," just like SoDa::Barrier.) On a
+ * timeout, '''waitGet''' returns a nullptr. A waiting subscriber
+ * sleeps on its own condition variable and is woken by '''put''', so
+ * an idle subscriber doesn't burn any CPU. Also, see that the
+ * '''waitGet''' method takes a "subscriber id." This is the id that was
+ * returned by the '''subscribe''' method. Calling waitGet with a
  * different subscriber id will screw things up, in all likelihood.
  * 
+ * There is also a non-blocking '''get'''. If there are no messages in
+ * the mailbox, '''get''' will return a nullptr right away. Calling
+ * '''get''' in a tight loop will work, but it will keep a core busy
+ * doing nothing useful. A thread that wants to wait for a batch of
+ * messages can call '''waitReady''' to sleep until at least N
+ * messages are queued up.
+ * 
  * The '''get''' method returns a shared pointer to a message. The
  * shared pointer is important, as when its value changes or it goes
  * out of scope, the reference count for the message is
@@ -138,6 +170,195 @@
  * up storage and can't be freed until the laggard subscriber catches
  * up.
  * 
+ * That is the default. But a mailbox can be given a capacity, either
+ * for all of its subscribers with '''setCapacity(capacity, policy)'''
+ * or for just one subscriber with '''setCapacity(subs, capacity,
+ * policy)'''. When a put finds a subscriber's queue full, the policy
+ * decides what happens:
+ *
+ * - MailBoxBase::BLOCK the producer waits until the subscriber
+ *   makes room. The put still lands in every queue at once. (Don't
+ *   put to a full queue that you are supposed to be reading. That
+ *   won't end well.)
+ * - MailBoxBase::DROP_OLDEST the oldest message in the subscriber's
+ *   queue is thrown away to make room.
+ * - MailBoxBase::DROP_NEWEST the new message isn't delivered to
+ *   this subscriber.
+ * - MailBoxBase::EVICT the subscriber's queue is emptied, and the
+ *   subscriber gets a MailBoxBase::SubscriberEvicted exception the
+ *   next time it tries to get a message. It should let go of the
+ *   subscription and subscribe again.
+ *
+ * Each subscriber keeps count of the messages that were dropped on
+ * its account. See '''droppedCount'''.
+ *
+ * @section mailboxfilter Filtered subscriptions
+ *
+ * A subscriber that only cares about some of the traffic can hand
+ * '''subscribe''' a filter: a function that takes a message and
+ * returns true if the subscriber wants it. put checks the filter
+ * before the message goes into the subscriber's queue, so the
+ * subscriber never sees (or wakes up for) the messages it would have
+ * thrown away. 
+ *
+ * A subscriber that only needs a sample of the traffic -- a display,
+ * a logger -- can hand '''subscribe''' a SoDa::DeliveryRate instead:
+ * every Nth message, or no more than K a second. The messages it
+ * doesn't want are skipped by put, so they take no room in its queue.
+ * '''stats(subs).decimated''' counts them.
+ *
+ * @section mailboxgroups Sharing the work
+ *
+ * A MailBox normally broadcasts: every subscriber gets every
+ * message. Subscribers that join a consumer group with
+ * '''subscribeGroup(group_name)''' split the messages between them
+ * instead. Each message goes to exactly one member of each group, the
+ * one with the shortest queue. Turn on '''setWorkStealing''' and a
+ * member that runs out of work will take the oldest message from the
+ * busiest member. Ordinary subscribers still see every message, so a
+ * logger can listen in on the work going to a pool of workers.
+ *
+ * @section mailboxconflate Only the latest news
+ *
+ * Some traffic is only interesting when it is fresh: the tuner's
+ * frequency, an S-meter reading. A subscriber that has fallen behind
+ * doesn't want to wade through a thousand stale readings to get to
+ * the current one. '''setConflation''' (for the whole mailbox or
+ * for one subscriber) tells put to replace a waiting message rather
+ * than queue another one. With a key function, the queue keeps the
+ * newest message for each key. 
+ *
+ * @section mailboxreplay Catching up late subscribers
+ *
+ * A subscriber that joins partway through a run starts with an empty
+ * queue, and has to wait for the next message to learn anything. A
+ * worker that was restarted would rather pick up where things are.
+ * '''retainLast(n)''' tells the mailbox to keep the last n messages
+ * put, and '''retainLatest(key)''' the newest message for each key.
+ * When someone subscribes, the messages that are kept are placed in
+ * the new queue, oldest first, before subscribe returns. Nothing
+ * can be put in between, so the subscriber sees the history and then
+ * the live traffic with no gap and no repeats.
+ *
+ * A filter and a delivery rate apply to the history too. Members of
+ * a consumer group don't get the history, as that would hand the
+ * same work out twice. The kept messages are shared with the
+ * subscribers, not copied, but they do stay alive until they are
+ * pushed out.
+ *
+ * @section mailboxspin Spinning instead of sleeping
+ *
+ * By default, a subscriber waiting in '''waitGet''' sleeps until put
+ * wakes it up. A latency-critical subscriber can call
+ * '''setWaitStrategy(subs, kind)''' to spin, yield, or spin and
+ * then sleep instead. See SoDa::WaitStrategy.
+ *
+ * @section mailboxstats Keeping an eye on the mail
+ *
+ * Every subscriber has a set of traffic counters: messages enqueued,
+ * messages dequeued, messages dropped, the current queue depth, and
+ * the deepest the queue has ever been. '''stats(subs)''' returns a
+ * SoDa::MailBoxStats snapshot for one subscriber without taking the
+ * mailbox lock, so a monitor thread can poll it as often as it likes.
+ * '''stats()''' returns snapshots for every subscriber. A subscriber
+ * whose depth keeps climbing toward its high water mark is a slow
+ * consumer.
+ *
+ * A message that a consumer group member steals from a sibling is
+ * counted in the sibling's stolen_out and the thief's stolen_in, not
+ * as a dequeue and a second enqueue, so the enqueued counts of a
+ * group's members add up to the messages put to the group.
+ *
+ * If '''measureLatency(true)''' has been called, the counters also
+ * include a histogram of the time each message spent in the queue,
+ * from put to get, in power-of-two microsecond buckets.
+ *
+ * @section mailboxstamp Timestamps
+ *
+ * '''stampMessages(true)''' tells put to note the time (from
+ * std::chrono::steady_clock) when each message is enqueued, and
+ * '''get(subs, stamp)''' returns that time along with the message.
+ * The stamp is taken under the mailbox lock, so the stamps on one
+ * mailbox never go backward, and every mailbox uses the same clock.
+ * SoDa::MergedReader uses them to read several mailboxes in time
+ * order.
+ *
+ * @section mailboxlater Mail for later
+ *
+ * '''putAt(msg, time)''' and '''putAfter(msg, delay)''' put a message
+ * at some time in the future: a retry, a periodic poll, a scheduled
+ * retune. They don't start a thread. The put waits in the shared
+ * SoDa::TimerWheel, and happens on its service thread. The returned
+ * id can be passed to '''cancelPut''' to take it back. If the mailbox
+ * is destroyed first, the put never happens.
+ *
+ * The put runs on a thread that everyone shares, so it shouldn't
+ * block. Don't use delayed puts on a mailbox with a bounded BLOCK
+ * subscriber that might be full.
+ *
+ * @section mailboxcoalesce Coalescing small messages
+ *
+ * A producer that puts lots of tiny messages spends most of its time
+ * taking the mailbox lock and walking the subscriber list, not
+ * moving data. '''setCoalescing(max_msgs, budget)''' makes put
+ * collect messages in a frame instead. The frame is delivered, under
+ * one lock, when it holds max_msgs messages, or when its first
+ * message has waited for budget. Subscribers still get the messages
+ * one at a time, in order.
+ *
+ * A put notices an old frame, and a timer on a SoDa::TimerWheel
+ * catches a frame whose producer has gone quiet. Unless you pass a
+ * wheel, it is the shared one, which ticks every millisecond, so the
+ * default budget is 2 ms. For a budget of a few tens of
+ * microseconds, pass '''setCoalescing(max_msgs, budget, wheel)''' a
+ * wheel with a finer tick. It must outlive the mailbox.
+ * '''flush()''' delivers the frame now.
+ *
+ * The frame is delivered from whatever thread fills it, or from the
+ * wheel's thread, so the same caution as for putAt applies to
+ * bounded BLOCK subscribers. Delayed puts skip the frame.
+ *
+ * @section mailboxreact Handlers instead of threads
+ *
+ * A thread per subscriber, looping on waitGet, is easy to write but
+ * gets expensive when there are hundreds of subscribers that are
+ * mostly idle. '''onMessage(handler, executor)''' subscribes and
+ * arranges for the handler to be called for each message, on one of
+ * the worker threads of a SoDa::Executor.
+ *
+ * \code
+ *   SoDa::Executor pool("rx", 4);
+ *   auto r = mailbox_p->onMessage([](std::shared_ptr<Msg> m) { handle(m); }, pool);
+ *   ...
+ *   r = nullptr; // stop handling
+ * \endcode
+ *
+ * When the subscriber's queue goes from empty to non-empty, a task is
+ * handed to the executor. The task takes up to a batch of messages
+ * and calls the handler for each, in order. If there are more, it
+ * queues itself again behind whatever else the executor has to do.
+ * There is never more than one task for a subscription, so a handler
+ * never runs on two workers at once, and it sees its messages in the
+ * order they were put.
+ *
+ * Dropping the returned Reaction unsubscribes. If the handler is
+ * running, that waits for it to finish, so don't drop a Reaction from
+ * inside its own handler. Drop it before the mailbox or the executor
+ * goes away.
+ *
+ * If the handler throws, the message is counted in the reaction's
+ * '''failedCount()''' and the reaction carries on with the next one.
+ * Pass '''setErrorHandler''' a function to find out what was thrown.
+ *
+ * @section mailboxepoll MailBoxes and epoll
+ *
+ * A thread that spends its life in an epoll loop can't block in
+ * waitGet. On Linux, '''eventFD(subs)''' returns an eventfd that
+ * becomes readable when the subscriber's queue goes from empty to
+ * non-empty. Put it in the epoll set with everything else. When it
+ * fires, call '''consumeEvent(subs)''' and then '''get''' until the
+ * queue is empty.
+ * 
  */
 
 /**
@@ -198,6 +419,17 @@ namespace SoDa {
     }
   }; 
 
+  /**
+   * @brief The subscriber's queue overflowed, and the mailbox's
+   * policy was to cut the subscriber off. 
+   */
+  class SubscriberEvicted : public Exception {
+  public:
+    SubscriberEvicted(const std::string & name, int sub_id) :
+      Exception(name, "Subscriber ID " + std::to_string(sub_id) + " was evicted for falling behind.") {
+    }
+  };
+
   class BadConversion : public Exception {
   public:
     BadConversion(const std::string & name, 
@@ -224,6 +456,16 @@ namespace SoDa {
       return ret; 
     }
 
+    /**
+     * @brief What should put do when a subscriber's queue is full? 
+     */
+    enum OverflowPolicy {
+      BLOCK, ///< wait for the subscriber to make room
+      DROP_OLDEST, ///< throw away the oldest message in the queue
+      DROP_NEWEST, ///< don't deliver the new message to this subscriber
+      EVICT ///< empty the queue and cut the subscriber off
+    };
+    
     /**
      * @brief What is the name of this mailbox? 
      * @return the name.
@@ -258,11 +500,31 @@ namespace SoDa {
      */
     MailBox(std::string name) : MailBoxBase(name) {
       subscription_counter = 0; 
+      default_capacity = 0;
+      default_policy = BLOCK; 
+      blocked_producers = 0; 
+      total_dropped = 0; 
+      measure_latency = false; 
+      stamp_messages = false; 
+      default_conflate = false; 
+      later = std::make_shared<LaterGuard>();
+      later->mbox = this; 
+      retaining = false; 
+      retain_depth = 0; 
+      coalescing = false; 
+      frame_max = 0; 
+      frame_wheel = nullptr; 
+      frame_gen = 0; 
     }
 
     ~MailBox() {
+      {
+	// waits for a delayed put that is running right now.
+	std::lock_guard<std::mutex> lock(later->mtx);
+	later->mbox = nullptr; 
+      }
       for(auto & s : message_queues) {
-	while(!s.second.empty()) s.second.pop();
+	clearQueue(s.second);
       }
       message_queues.clear();
     }
@@ -270,9 +532,11 @@ namespace SoDa {
   protected:  
     class SubscriptionCl {
     public:
-      SubscriptionCl(MailBox<T> * mbox, int idx) {
+      SubscriptionCl(MailBox<T> * mbox, int idx, 
+		     std::shared_ptr<MailBoxCounters> counters) : counters(counters) {
 	this_mbox = mbox; 
 	subscriber_index = idx; 
+	attention.store(false); 
       }
 
       ~SubscriptionCl() {
@@ -291,6 +555,17 @@ namespace SoDa {
       int subscriber_index;
       /// double check that we're referencing the right mailbox
       MailBox<T> * this_mbox; 
+      /// shared with the subscriber queue, so stats(subs) needn't take the lock
+      std::shared_ptr<MailBoxCounters> counters; 
+      /// how waitGet waits -- only the subscriber's thread uses it
+      WaitStrategy wait_strategy; 
+      /**
+       * set by the mailbox when something other than a new message
+       * (an interrupt, an eviction, a sibling to steal from) should
+       * end a spinning waitGet. The spin doesn't take the lock, so it
+       * can't look at the subscriber queue itself.
+       */
+      std::atomic<bool> attention; 
     };
 
   public:
@@ -304,16 +579,123 @@ namespace SoDa {
      * @returns a smart pointer to a subscriber object. 
      */
     Subscription subscribe() {
+      return subscribe(nullptr);
+    }
+
+    /**
+     * @brief Subscribe the caller to a mailbox, but only to the
+     * messages it is interested in.
+     *
+     * The filter is called by put for each message, before the
+     * message is placed in this subscriber's queue. If the filter
+     * returns false, the message never lands in the queue, and the
+     * subscriber isn't woken up. The filter runs while put holds the
+     * mailbox lock, so it should be quick, it shouldn't have side
+     * effects, and it must not call back into the mailbox.
+     *
+     * @param filter returns true for messages the subscriber wants.
+     * A null filter accepts everything.
+     * @returns a smart pointer to a subscriber object. 
+     */
+    Subscription subscribe(const std::function<bool(const T &)> & filter) {
       std::lock_guard<std::mutex> lock(mtx);	      
-      // what will the subscriber number be? 
-      Subscription ret(new SubscriptionCl(this,
-					  subscription_counter));
+      auto ret = addSubscriber(filter);
+      replay(getSubscriber(ret->getIndex(this)));
+      return ret; 
+    }
 
-      // make a subscriber queue
-      message_queues[subscription_counter] = std::queue<std::shared_ptr<T>>();
-      
-      subscription_counter++;
-      return ret;
+    /**
+     * @brief Subscribe the caller to a mailbox, but only to a sample
+     * of the traffic.
+     *
+     * put applies the rate before the message is placed in this
+     * subscriber's queue, so the messages it skips cost the
+     * subscriber nothing.
+     *
+     * @param rate how much of the traffic to deliver. See SoDa::DeliveryRate.
+     * @param filter if not null, only messages that pass the filter
+     * count toward the rate. (See the other '''subscribe'''.)
+     * @returns a smart pointer to a subscriber object. 
+     */
+    Subscription subscribe(const DeliveryRate & rate, 
+			   const std::function<bool(const T &)> & filter = nullptr) {
+      std::lock_guard<std::mutex> lock(mtx);	      
+      auto ret = addSubscriber(filter);
+      auto & sq = getSubscriber(ret->getIndex(this));
+      sq.rate = rate; 
+      replay(sq);
+      return ret; 
+    }
+
+    /**
+     * @brief Change how much of the traffic a subscriber gets. 
+     *
+     * @param subs the subscriber
+     * @param rate how much of the traffic to deliver from now on
+     */
+    void setDeliveryRate(Subscription & subs, const DeliveryRate & rate) {
+      std::lock_guard<std::mutex> lock(mtx);
+      getSubscriber(subs).rate = rate; 
+    }
+
+    /**
+     * @brief Join a consumer group. 
+     *
+     * Every message put to the mailbox goes to exactly one member of
+     * each consumer group (while subscribers outside any group still
+     * get a copy of everything). put hands the message to the member
+     * with the shortest queue, taking turns when there's a tie. The
+     * members share the work, so this is the way to spread a stream
+     * of jobs across a pool of worker threads.
+     *
+     * @param group the name of the group. The group is created when
+     * its first member joins, and goes away when its last member
+     * leaves.
+     * @param filter if not null, this member only takes messages
+     * that pass the filter. (See the other '''subscribe'''.)
+     * @returns a smart pointer to a subscriber object.
+     */
+    Subscription subscribeGroup(const std::string & group, 
+				const std::function<bool(const T &)> & filter = nullptr) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto ret = addSubscriber(filter);
+      auto & g = groups[group];
+      int idx = ret->getIndex(this);
+      g.name = group; 
+      g.members.push_back(idx);
+      getSubscriber(idx).group = &g; 
+      return ret; 
+    }
+
+    /**
+     * @brief Let idle members of a consumer group take work from
+     * their busier siblings.
+     *
+     * When a member with an empty queue calls get, waitGet, or
+     * getBatch, it takes the oldest message from the member with the
+     * longest queue. A member already asleep in waitGet or waitReady
+     * is woken to do the same when a sibling's queue reaches
+     * threshold messages. Without stealing, a message stays with the
+     * member it was given to, even if that member is stuck on a slow
+     * job.
+     *
+     * Either way, messages within a group are not delivered in any
+     * particular order.
+     *
+     * @param group the name of the group
+     * @param on true to enable stealing
+     * @param threshold wake an idle member when a sibling has this
+     * many messages waiting.
+     */
+    void setWorkStealing(const std::string & group, bool on, 
+			 unsigned int threshold = 2) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = groups.find(group);
+      if(it == groups.end()) {
+	throw Exception(getName(), "setWorkStealing() no consumer group named " + group);
+      }
+      it->second.steal = on; 
+      it->second.steal_threshold = (threshold == 0) ? 1 : threshold; 
     }
 
 
@@ -326,18 +708,133 @@ namespace SoDa {
      */
     std::shared_ptr<T> get(Subscription & subs) {
       std::lock_guard<std::mutex> lock(mtx);	      
-      auto & mqueue = getQueue(subs); 
-      if(mqueue.empty()) {
+      auto & sq = getSubscriber(subs); 
+      steal(sq); 
+      if(sq.mqueue.empty()) {
 	return nullptr;
       }
       else {
-
-	auto ret = mqueue.front();
-	mqueue.pop();
+	auto ret = pop(sq);
+	madeRoom();
 	return ret;
       }
     }
 
+    /**
+     * Get an object out of the mailbox for this subscriber, along with
+     * the time it was put.
+     * 
+     * @param subs each user of a mailbox must have subscribed to the mailbox. 
+     * @param stamp set to the time the message was enqueued. This is
+     * zero (the clock's epoch) if neither stampMessages nor
+     * measureLatency was on when it was put. Left alone if there is
+     * no message.
+     * @returns The oldest object in the subscriber's mailbox. 
+     */
+    std::shared_ptr<T> get(Subscription & subs, 
+			   std::chrono::steady_clock::time_point & stamp) {
+      std::lock_guard<std::mutex> lock(mtx);	      
+      auto & sq = getSubscriber(subs); 
+      steal(sq); 
+      if(sq.mqueue.empty()) {
+	return nullptr;
+      }
+      stamp = sq.mqueue.front().stamp; 
+      auto ret = pop(sq);
+      madeRoom();
+      return ret;
+    }
+
+    /**
+     * @brief Get an object out of the mailbox for this subscriber,
+     * waiting for one to arrive if the mailbox is empty.
+     * 
+     * The caller sleeps on a condition variable that belongs to this
+     * subscriber. It is woken by a put that lands a message in
+     * the subscriber's queue.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox. 
+     * @param timeout give up after this long. If timeout is zero, 
+     * wait forever. 
+     * @returns The oldest object in the subscriber's mailbox, or nullptr 
+     * if the timeout expired before a message arrived. 
+     */
+    std::shared_ptr<T> waitGet(Subscription & subs, 
+			       const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      // spin first, if the subscriber asked us to. 
+      auto & strategy = subs->wait_strategy; 
+      bool parking = false; 
+      auto wait_time = timeout; 
+      if(strategy.getKind() != WaitStrategy::BLOCK) {
+	auto deadline = WaitStrategy::deadline(timeout);
+	auto counters = subs->counters.get();
+	auto attention = &(subs->attention); 
+	parking = !strategy.spin([counters, attention]() { 
+	    return (counters->currentDepth() != 0) || attention->load(std::memory_order_acquire); 
+	  }, deadline);
+	// whatever ended the spin will be found under the lock.
+	attention->store(false, std::memory_order_relaxed); 
+	if(timeout.count() != 0) {
+	  wait_time = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+	  // zero would mean forever
+	  if(wait_time.count() <= 0) wait_time = std::chrono::microseconds(1);
+	}
+      }
+      
+      std::unique_lock<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs); 
+      steal(sq); 
+      bool got_one = waitForMessages(lock, sq, 1, wait_time);
+      if(parking) strategy.parked(got_one);
+      checkEvicted(sq, subs);
+      if(!got_one) {
+	return nullptr; 
+      }
+      auto ret = pop(sq);
+      madeRoom();
+      return ret; 
+    }
+
+    /**
+     * @brief Wait until there are at least num_msgs messages in 
+     * the subscriber's queue.
+     * 
+     * @param subs each user of a mailbox must have subscribed to the mailbox. 
+     * @param num_msgs wake up when this many messages are waiting. 
+     * @param timeout give up after this long. If timeout is zero, 
+     * wait forever. 
+     * @returns count of outstanding messages for this subscriber. This 
+     * will be less than num_msgs if the timeout expired.
+     */
+    unsigned int waitReady(Subscription & subs, unsigned int num_msgs, 
+			   const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      std::unique_lock<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs);
+      waitForMessages(lock, sq, num_msgs, timeout);
+      checkEvicted(sq, subs);
+      return sq.mqueue.size();
+    }
+
+    /**
+     * @brief Make a waitGet or waitReady on this subscription give up
+     * now, as if its timeout had expired. If the subscriber isn't
+     * waiting, its next wait that would sleep gives up instead.
+     *
+     * This is how another thread tells a worker that is waiting
+     * forever to go look at its stop flag. It works on a waitGet
+     * that is spinning (see setWaitStrategy) as well as one that is
+     * asleep.
+     *
+     * @param subs the subscriber to wake
+     */
+    void interrupt(Subscription & subs) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs->getIndex(this));
+      sq.interrupted = true; 
+      sq.cv.notify_one();
+      subs->attention.store(true, std::memory_order_release);
+    }
+    
     /**
      * @brief Place a message in every subscriber's mailbox
      *
@@ -348,18 +845,203 @@ namespace SoDa {
      * message queue. 
      */
     void put(std::shared_ptr<T> msg, const Subscription & subs = nullptr) {
-      std::lock_guard<std::mutex> lock(mtx);            
+      if(coalescing) {
+	coalesce(msg, subs);
+	return; 
+      }
+      std::unique_lock<std::mutex> lock(mtx);            
       int omit_key = subscription_counter; // points past last allocted subscription id
       if(subs != nullptr) {
 	omit_key = subs->getIndex(this);
       }
-      for(auto & q : message_queues) {
-	if(q.first != omit_key) {
-	  q.second.push(msg);
-	}
+      deliver(lock, msg, omit_key);
+    }
+
+    /**
+     * @brief Place a run of messages in every subscriber's mailbox
+     * 
+     * This is just like calling put for each message, except that
+     * the mailbox is locked once for the whole run, and each waiting
+     * subscriber is woken at most once.
+     *
+     * @tparam Iterator anything that dereferences to a std::shared_ptr<T>
+     * @param begin the first message in the run
+     * @param end one past the last message in the run
+     * @param subs If supplied, messages will *not* be enqueued to the sender's 
+     * message queue. 
+     */
+    template<typename Iterator>
+    void putBatch(Iterator begin, Iterator end, const Subscription & subs = nullptr) {
+      // a batch is already a frame, but it has to go after the one
+      // we're building.
+      std::unique_lock<std::mutex> flock(frame_mtx, std::defer_lock);
+      if(coalescing) {
+	flock.lock();
+	flushFrame();
+      }
+      std::unique_lock<std::mutex> lock(mtx);            
+      int omit_key = subscription_counter; 
+      if(subs != nullptr) {
+	omit_key = subs->getIndex(this);
+      }
+      for(Iterator it = begin; it != end; ++it) {
+	deliver(lock, *it, omit_key);
+      }
+    }
+
+    /**
+     * @brief Put a message in every subscriber's mailbox at a later time.
+     *
+     * @param msg The message to be sent to every subscriber.
+     * @param when put it at (or just after) this time. 
+     * @param subs If supplied, the message will *not* be enqueued to the sender's 
+     * message queue. 
+     * @returns an id that can be passed to cancelPut
+     */
+    TimerWheel::TimerID putAt(std::shared_ptr<T> msg, 
+			      const std::chrono::steady_clock::time_point & when, 
+			      const Subscription & subs = nullptr) {
+      int omit_key = (subs == nullptr) ? -1 : subs->getIndex(this);
+      // hold the guard, not the mailbox, so a mailbox that goes away
+      // first doesn't get a put from beyond the grave.
+      auto guard = later; 
+      return TimerWheel::shared().schedule(when, [guard, msg, omit_key]() {
+	  std::lock_guard<std::mutex> glock(guard->mtx);
+	  if(guard->mbox == nullptr) return; 
+	  guard->mbox->putLater(msg, omit_key);
+	});
+    }
+
+    /**
+     * @brief Put a message in every subscriber's mailbox after a delay.
+     *
+     * @param msg The message to be sent to every subscriber.
+     * @param delay put it after this long.
+     * @param subs If supplied, the message will *not* be enqueued to the sender's 
+     * message queue. 
+     * @returns an id that can be passed to cancelPut
+     */
+    TimerWheel::TimerID putAfter(std::shared_ptr<T> msg, 
+				 const std::chrono::duration<long, std::micro> & delay, 
+				 const Subscription & subs = nullptr) {
+      return putAt(msg, std::chrono::steady_clock::now() + delay, subs);
+    }
+
+    /**
+     * @brief Take back a putAt or putAfter that hasn't happened yet.
+     *
+     * @param id from putAt or putAfter
+     * @returns true if the put was cancelled, false if it already happened.
+     */
+    bool cancelPut(TimerWheel::TimerID id) {
+      return TimerWheel::shared().cancel(id);
+    }
+
+    /**
+     * @brief Get a run of messages out of the mailbox for this subscriber.
+     * This does not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox. 
+     * @param out messages are appended to this vector, oldest first.
+     * @param max_msgs take no more than this many messages.
+     * @returns the number of messages appended to out.
+     */
+    unsigned int getBatch(Subscription & subs, 
+			  std::vector<std::shared_ptr<T>> & out, 
+			  unsigned int max_msgs = ~0) {
+      std::lock_guard<std::mutex> lock(mtx);	      
+      auto & sq = getSubscriber(subs); 
+      steal(sq); 
+      auto now = measure_latency ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point(); 
+      unsigned int ret = 0; 
+      while(!sq.mqueue.empty() && (ret < max_msgs)) {
+	auto & e = sq.mqueue.front();
+	recordLatency(sq, e, now);
+	out.push_back(e.msg);
+	popFront(sq);
+	ret++; 
+      }
+      sq.counters->recordDequeue(ret, sq.mqueue.size());
+      madeRoom();
+      return ret; 
+    }
+
+    /**
+     * @brief Get a run of messages, along with the times they were put.
+     * This does not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox. 
+     * @param out messages are appended to this vector, oldest first.
+     * @param stamps the time each message was put is appended here.
+     * (See the get that returns a stamp.)
+     * @param max_msgs take no more than this many messages.
+     * @returns the number of messages appended to out.
+     */
+    unsigned int getBatch(Subscription & subs, 
+			  std::vector<std::shared_ptr<T>> & out, 
+			  std::vector<std::chrono::steady_clock::time_point> & stamps, 
+			  unsigned int max_msgs = ~0) {
+      std::lock_guard<std::mutex> lock(mtx);	      
+      auto & sq = getSubscriber(subs); 
+      steal(sq); 
+      auto now = measure_latency ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point(); 
+      unsigned int ret = 0; 
+      while(!sq.mqueue.empty() && (ret < max_msgs)) {
+	auto & e = sq.mqueue.front();
+	recordLatency(sq, e, now);
+	out.push_back(e.msg);
+	stamps.push_back(e.stamp); 
+	popFront(sq);
+	ret++; 
       }
+      sq.counters->recordDequeue(ret, sq.mqueue.size());
+      madeRoom();
+      return ret; 
     }
 
+    /**
+     * @brief Take every waiting message for this subscriber and hand 
+     * each one, oldest first, to a callback.
+     *
+     * The subscriber's whole queue is swapped out while the mailbox
+     * is locked, and the callback runs after the lock is released. So
+     * it is OK for the callback to put messages back into this
+     * mailbox. This does not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox. 
+     * @param callback called once for each message
+     * @returns the number of messages passed to the callback.
+     */
+    unsigned int drain(Subscription & subs, 
+		       const std::function<void(std::shared_ptr<T>)> & callback) {
+      std::deque<Entry> run; 
+      std::shared_ptr<MailBoxCounters> counters; 
+      // every message in the batch leaves the queue now.
+      std::chrono::steady_clock::time_point now; 
+      {
+	std::lock_guard<std::mutex> lock(mtx);	      
+	auto & sq = getSubscriber(subs); 
+	std::swap(run, sq.mqueue);
+	sq.latest.clear();
+	sq.counters->recordDequeue(run.size(), 0);
+	counters = sq.counters; 
+	if(measure_latency) now = std::chrono::steady_clock::now();
+	madeRoom();
+      }
+      unsigned int ret = run.size();
+      while(!run.empty()) {
+	auto & e = run.front(); 
+	// the counters are atomic, so we don't need the lock for this.
+	if(e.stamp != std::chrono::steady_clock::time_point() &&
+	   now != std::chrono::steady_clock::time_point()) {
+	  counters->recordLatency(e.stamp, now);
+	}
+	callback(e.msg);
+	run.pop_front();
+      }
+      return ret; 
+    }
+    
     /**
      * Return the number of messages in the queue for this subscriber.
      * 
@@ -369,13 +1051,7 @@ namespace SoDa {
      */
     unsigned int readyCount(Subscription & subs) {
       std::lock_guard<std::mutex> lock(mtx);	      
-      auto & mqueue = getQueue(subs); 
-      if(mqueue.empty()) {
-	return 0;
-      }
-      else {
-	return mqueue.size();
-      }
+      return getSubscriber(subs).mqueue.size();
     }
 
     /**
@@ -388,8 +1064,10 @@ namespace SoDa {
     unsigned int minReadyCount() {
       std::lock_guard<std::mutex> lock(mtx);	      
       unsigned int ret = ~0;
-      for(auto q : message_queues) {
-	auto qs = q.second.size();
+      // by reference: a SubscriberQueue holds a condition variable
+      // and can't be copied.
+      for(auto & q : message_queues) {
+	auto qs = q.second.mqueue.size();
 	ret = (ret < qs) ? ret : qs; 
       }
       return ret; 
@@ -403,37 +1081,1240 @@ namespace SoDa {
      */
     void clear(Subscription & subs) {
       std::lock_guard<std::mutex> lock(mtx);      
-      auto & mqueue = getQueue(subs);
-      while(!mqueue.empty()) mqueue.pop();
+      auto & sq = getSubscriber(subs);
+      unsigned long count = sq.mqueue.size(); 
+      clearQueue(sq);
+      sq.counters->recordDequeue(count, 0);
+      madeRoom();
     }
 
     void unsubscribe(int subid) {
       std::lock_guard<std::mutex> lock(mtx);
-      int subs_count = message_queues.size();       
-      auto & mqueue = getQueue(subid);
-      while(!mqueue.empty()) mqueue.pop();
+      auto & sq = getSubscriber(subid);
+      clearQueue(sq);
+      if(sq.group != nullptr) {
+	auto & members = sq.group->members; 
+	for(auto it = members.begin(); it != members.end(); ++it) {
+	  if(*it == subid) {
+	    members.erase(it);
+	    break; 
+	  }
+	}
+	if(members.empty()) groups.erase(sq.group->name);
+      }
       // now remove our entry from the message queues.
       message_queues.erase(subid);
+      // a producer might have been waiting on us
+      madeRoom();
+    }
+
+    /**
+     * @brief Limit the length of every subscriber's queue. This
+     * applies to current subscribers (unless they have their own
+     * limit) and to subscribers that come along later.
+     *
+     * @param capacity the most messages a queue may hold. Zero means
+     * no limit.
+     * @param policy what to do when a put finds a full queue.
+     */
+    void setCapacity(unsigned int capacity, OverflowPolicy policy = BLOCK) {
+      std::lock_guard<std::mutex> lock(mtx);
+      default_capacity = capacity;
+      default_policy = policy; 
+      for(auto & q : message_queues) {
+	if(!q.second.own_limit) {
+	  q.second.capacity = capacity;
+	  q.second.policy = policy; 
+	}
+      }
+      madeRoom();
+    }
+
+    /**
+     * @brief Limit the length of one subscriber's queue. This
+     * overrides the mailbox-wide limit. 
+     *
+     * @param subs the subscription to limit
+     * @param capacity the most messages the queue may hold. Zero means
+     * no limit.
+     * @param policy what to do when a put finds the queue full.
+     */
+    void setCapacity(Subscription & subs, unsigned int capacity, OverflowPolicy policy = BLOCK) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs);
+      sq.capacity = capacity;
+      sq.policy = policy;
+      sq.own_limit = true; 
+      madeRoom();
+    }
+
+    /**
+     * @brief How many messages were dropped, or never delivered, 
+     * because this subscriber's queue was full? 
+     *
+     * @param subs the subscription
+     * @returns count of dropped messages
+     */
+    unsigned long droppedCount(Subscription & subs) {
+      std::lock_guard<std::mutex> lock(mtx);
+      // an evicted subscriber may still ask.
+      return getSubscriber(subs->getIndex(this)).counters->droppedCount(); 
+    }
+
+    /**
+     * @brief How many messages were dropped, over all subscribers, 
+     * past and present? 
+     *
+     * @returns count of dropped messages
+     */
+    unsigned long droppedCount() {
+      std::lock_guard<std::mutex> lock(mtx);
+      return total_dropped; 
     }
 
     unsigned int subscriberCount() {
       std::lock_guard<std::mutex> lock(mtx);      
       return message_queues.size();
     }
-  protected:
-    std::map<int, std::queue<std::shared_ptr<T>>> message_queues; 
-    int subscription_counter; 
 
-    std::queue<std::shared_ptr<T>> & getQueue(int idx) {
-      if(message_queues.count(idx) == 0) {
-	throw MissingSubscriber(getName(), "get()", idx);
+#ifdef __linux__
+    /**
+     * @brief Get an eventfd that becomes readable when this
+     * subscriber's queue goes from empty to non-empty.
+     *
+     * The fd is created the first time it is asked for, and is closed
+     * when the subscription goes away. Add it to an epoll set (or
+     * poll, or select) along with sockets and timers. When it is
+     * readable, call '''consumeEvent''' and then '''get''' until get
+     * returns nullptr. The fd is only signaled on the empty to
+     * non-empty edge, so a subscriber that leaves messages in its
+     * queue won't hear about them again.
+     *
+     * An evicted subscriber's fd is signaled too, so that it finds
+     * out about the eviction from its next get.
+     *
+     * @param subs the subscription to watch
+     * @returns a non-blocking eventfd
+     */
+    int eventFD(Subscription & subs) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs->getIndex(this));
+      if(sq.event_fd < 0) {
+	sq.event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(sq.event_fd < 0) {
+	  throw Exception(getName(), std::string("eventFD() couldn't create an eventfd: ") 
+			  + strerror(errno));
+	}
+	// there may already be mail waiting.
+	if(!sq.mqueue.empty() || sq.evicted) signalEvent(sq);
+      }
+      return sq.event_fd; 
+    }
+
+    /**
+     * @brief Reset the subscriber's event fd so that it isn't
+     * readable any more. Call this before draining the queue, not
+     * after, or a message that arrives in between will be missed.
+     *
+     * @param subs the subscription whose event fd fired
+     */
+    void consumeEvent(Subscription & subs) {
+      int fd; 
+      {
+	std::lock_guard<std::mutex> lock(mtx);
+	fd = getSubscriber(subs->getIndex(this)).event_fd;
+      }
+      if(fd >= 0) {
+	uint64_t count; 
+	ssize_t r = ::read(fd, &count, sizeof(count));
+	(void) r; 
       }
-      return message_queues[idx];       
     }
+#endif
     
-    std::queue<std::shared_ptr<T>> & getQueue(Subscription & subs) {
-      int idx = subs->getIndex(this);
-      return getQueue(idx);
+    /**
+     * @brief Keep only the newest message in each subscriber's queue,
+     * or the newest message for each key. 
+     *
+     * This is for status reports, meter readings, and the like, where
+     * a reader that has fallen behind only cares about the latest
+     * value. A new message replaces the waiting message with the same
+     * key, and takes its place in line. So the queue never holds more
+     * than one message per key, no matter how slow the reader is.
+     * Messages already waiting are conflated right away.
+     *
+     * This applies to every subscriber that hasn't had conflation
+     * set on its own, including those that subscribe later.
+     *
+     * @param on true to conflate
+     * @param key picks the key for each message. If null, all
+     * messages share one key, and the queue holds at most one
+     * message.
+     */
+    void setConflation(bool on, const std::function<long(const T &)> & key = nullptr) {
+      std::lock_guard<std::mutex> lock(mtx);
+      default_conflate = on; 
+      default_conflation_key = key; 
+      for(auto & q : message_queues) {
+	if(!q.second.own_conflation) applyConflation(q.second, on, key);
+      }
+    }
+
+    /**
+     * @brief Keep the last few messages for subscribers that join later.
+     *
+     * @param depth keep this many messages. Zero stops keeping them,
+     * and lets go of the ones that were kept.
+     */
+    void retainLast(unsigned int depth) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if(retain_key) clearRetained(); 
+      retain_key = nullptr; 
+      retain_depth = depth; 
+      retaining = (depth != 0); 
+      trimRetained(); 
+    }
+
+    /**
+     * @brief Keep the newest message for each key for subscribers
+     * that join later.
+     *
+     * @param key picks the key for each message
+     * @param max_keys keep at most this many keys, forgetting the
+     * one that was updated longest ago. Zero for no limit.
+     */
+    void retainLatest(const std::function<long(const T &)> & key, unsigned int max_keys = 0) {
+      std::lock_guard<std::mutex> lock(mtx);
+      clearRetained(); 
+      retain_key = key; 
+      retain_depth = max_keys; 
+      retaining = (key != nullptr); 
+    }
+
+    /**
+     * @brief How many messages are being kept for late subscribers? 
+     */
+    unsigned int retainedCount() {
+      std::lock_guard<std::mutex> lock(mtx);
+      return retained.size(); 
+    }
+
+    /**
+     * @brief Conflate (or stop conflating) just this subscriber's
+     * queue. See the other '''setConflation'''.
+     *
+     * @param subs the subscriber
+     * @param on true to conflate
+     * @param key picks the key for each message, or null for one key
+     */
+    void setConflation(Subscription & subs, bool on, 
+		       const std::function<long(const T &)> & key = nullptr) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs);
+      sq.own_conflation = true; 
+      applyConflation(sq, on, key);
+    }
+
+    /**
+     * @brief Ask to be called when this subscriber's queue goes from
+     * empty to non-empty. 
+     *
+     * This is the hook that SoDa::MailBoxSelector uses to watch many
+     * mailboxes at once. The callback runs in the thread that called
+     * put, while put holds the mailbox lock. It must be quick, and it
+     * must not call back into the mailbox. If messages are already
+     * waiting, the callback is called right away.
+     * 
+     * Like the event fd, the callback only fires on the empty to
+     * non-empty edge (and when the subscriber is evicted). 
+     *
+     * @param subs the subscriber to watch
+     * @param callback called on the edge. Pass nullptr to stop watching.
+     */
+    void setReadyCallback(Subscription & subs, const std::function<void()> & callback) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs->getIndex(this));
+      sq.on_ready = callback; 
+      if(sq.on_ready && (!sq.mqueue.empty() || sq.evicted)) sq.on_ready();
+    }
+
+    /**
+     * @brief Like setReadyCallback, but keep any callback that is
+     * already installed. Both are called on the edge, the older one
+     * first. This lets a SoDa::MergedReader and a SoDa::MailBoxSelector
+     * watch the same subscription.
+     *
+     * @param subs the subscriber to watch
+     * @param callback called on the edge
+     */
+    void addReadyCallback(Subscription & subs, const std::function<void()> & callback) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs->getIndex(this));
+      if(sq.on_ready) {
+	auto prev = sq.on_ready;
+	sq.on_ready = [prev, callback]() { prev(); callback(); };
+      }
+      else {
+	sq.on_ready = callback;
+      }
+      if(!sq.mqueue.empty() || sq.evicted) callback();
+    }
+
+  protected:
+    /**
+     * @brief The part of a reaction that the ready callback and the
+     * executor's tasks can see.
+     */
+    struct ReactionState {
+      MailBox<T> * mbox;
+      Subscription subs;
+      std::function<void(std::shared_ptr<T>)> handler;
+      Executor * executor;
+      unsigned int batch;
+      /// true while a task for this reaction is queued or running
+      std::atomic<bool> scheduled;
+      std::atomic<bool> cancelled;
+      /// held while the handler runs
+      std::mutex run_mtx;
+      /// messages for which the handler threw
+      std::atomic<unsigned long> failed;
+      /// told what the handler threw. Guarded by run_mtx.
+      std::function<void(std::exception_ptr)> on_error;
+    };
+
+    class ReactionCl {
+    public:
+      ReactionCl(const std::shared_ptr<ReactionState> & state) : state(state) { }
+
+      ~ReactionCl() {
+	state->mbox->setReadyCallback(state->subs, nullptr);
+	state->cancelled = true;
+	// wait for a handler that is running right now.
+	std::lock_guard<std::mutex> lock(state->run_mtx);
+	state->subs = nullptr;
+      }
+
+      /**
+       * @brief how many messages has the handler thrown on?
+       */
+      unsigned long failedCount() const { return state->failed.load(); }
+
+      /**
+       * @brief Be told when the handler throws. The error handler runs
+       * on the worker thread, right after the handler. Anything it
+       * throws is ignored.
+       *
+       * @param on_error called with the exception
+       */
+      void setErrorHandler(const std::function<void(std::exception_ptr)> & on_error) {
+	std::lock_guard<std::mutex> lock(state->run_mtx);
+	state->on_error = on_error;
+      }
+
+      std::shared_ptr<ReactionState> state;
+    };
+
+  public:
+    typedef std::unique_ptr<ReactionCl> Reaction;
+    typedef std::function<void(std::shared_ptr<T>)> Handler;
+
+    /**
+     * @brief Subscribe, and call a handler for each message on one of
+     * an executor's worker threads.
+     *
+     * @param handler called once for each message, in order. It is
+     * never called from two threads at once.
+     * @param executor runs the handler. It must outlive the reaction.
+     * @param batch handle at most this many messages before giving
+     * the worker to someone else.
+     * @returns the reaction. Dropping it unsubscribes.
+     */
+    Reaction onMessage(const Handler & handler, Executor & executor, unsigned int batch = 16) {
+      return onMessage(subscribe(), handler, executor, batch);
+    }
+
+    /**
+     * @brief Call a handler for each message for an existing
+     * subscription (a filtered or group subscription, for instance) on
+     * one of an executor's worker threads.
+     *
+     * @param subs the subscription. The reaction takes it over.
+     * @param handler called once for each message, in order.
+     * @param executor runs the handler. It must outlive the reaction.
+     * @param batch handle at most this many messages before giving
+     * the worker to someone else.
+     * @returns the reaction. Dropping it unsubscribes.
+     */
+    Reaction onMessage(Subscription subs, const Handler & handler, 
+		       Executor & executor, unsigned int batch = 16) {
+      subs->getIndex(this);
+      auto st = std::make_shared<ReactionState>();
+      st->mbox = this;
+      st->subs = std::move(subs);
+      st->handler = handler;
+      st->executor = &executor;
+      st->batch = (batch == 0) ? 1 : batch;
+      st->scheduled = false;
+      st->cancelled = false;
+      st->failed = 0;
+      setReadyCallback(st->subs, [st]() { scheduleReaction(st); });
+      return Reaction(new ReactionCl(st));
+    }
+
+    /**
+     * @brief Choose how waitGet waits for this subscriber's mail. See
+     * SoDa::WaitStrategy. Call this from the subscriber's own thread.
+     *
+     * @param subs the subscriber
+     * @param kind spin, yield, park, or some combination
+     * @param spin_count spin this many times before yielding or sleeping
+     * @param spin_time how long a TIMED_SPIN spins before sleeping
+     */
+    void setWaitStrategy(Subscription & subs, WaitStrategy::Kind kind, 
+			 unsigned int spin_count = 1000, 
+			 const std::chrono::duration<long, std::micro> & spin_time = std::chrono::microseconds(50)) {
+      subs->getIndex(this); 
+      subs->wait_strategy.configure(kind, spin_count, spin_time);
+    }
+
+    /**
+     * @brief How have this subscriber's waits turned out? 
+     *
+     * @param subs the subscriber
+     * @returns counts of waits that ended in each phase of the strategy
+     */
+    WaitStrategy::Stats waitStats(const Subscription & subs) const {
+      return subs->wait_strategy.stats(); 
+    }
+
+    /**
+     * @brief Turn the put-to-get latency histogram on or off. 
+     *
+     * It is off by default, as it costs a clock read on every put and
+     * get. Messages that were put while it was off aren't counted. 
+     *
+     * @param on true to measure latency
+     */
+    void measureLatency(bool on) {
+      std::lock_guard<std::mutex> lock(mtx);
+      measure_latency = on; 
+    }
+
+    /**
+     * @brief Stamp each message with the time it was put. 
+     *
+     * It is off by default, as it costs a clock read on every put.
+     * Messages that were put while it was off have a zero stamp.
+     *
+     * @param on true to stamp messages
+     */
+    void stampMessages(bool on) {
+      std::lock_guard<std::mutex> lock(mtx);
+      stamp_messages = on; 
+    }
+
+    /**
+     * @brief Collect put messages in frames, and deliver a frame at
+     * a time, with the shared timer wheel watching the budget.
+     *
+     * @param max_msgs deliver a frame when it holds this many
+     * messages. Zero or one turns coalescing off, and delivers
+     * whatever is waiting.
+     * @param budget deliver a frame when its oldest message has
+     * waited this long. The shared wheel ticks every millisecond, so
+     * a quiet frame may wait up to a millisecond past this.
+     */
+    void setCoalescing(unsigned int max_msgs, 
+		       const std::chrono::duration<long, std::micro> & budget = std::chrono::milliseconds(2)) {
+      // don't start the shared wheel's thread just to turn coalescing off.
+      setCoalescing(max_msgs, budget, (max_msgs > 1) ? &TimerWheel::shared() : nullptr);
+    }
+
+    /**
+     * @brief Collect put messages in frames, and deliver a frame at
+     * a time.
+     *
+     * @param max_msgs deliver a frame when it holds this many
+     * messages. Zero or one turns coalescing off, and delivers
+     * whatever is waiting.
+     * @param budget deliver a frame when its oldest message has
+     * waited this long.
+     * @param wheel the timer wheel that watches the budget. Its tick
+     * should be well under the budget, and it must outlive the
+     * mailbox.
+     */
+    void setCoalescing(unsigned int max_msgs, 
+		       const std::chrono::duration<long, std::micro> & budget, 
+		       TimerWheel & wheel) {
+      setCoalescing(max_msgs, budget, &wheel);
+    }
+
+    /**
+     * @brief Deliver the messages in a partly filled frame now. 
+     */
+    void flush() {
+      std::lock_guard<std::mutex> flock(frame_mtx);
+      flushFrame(); 
+    }
+
+    /**
+     * @brief Take a snapshot of one subscriber's traffic counters.
+     *
+     * This doesn't take the mailbox lock, so it is cheap enough to
+     * call from a health monitor while the mailbox is busy. 
+     *
+     * @param subs the subscription we're asking about
+     * @returns the subscriber's counters
+     */
+    MailBoxStats stats(const Subscription & subs) const {
+      return subs->counters->snapshot(measure_latency); 
+    }
+
+    /**
+     * @brief Take a snapshot of every subscriber's traffic counters. 
+     *
+     * This holds the lock just long enough to walk the subscriber list.
+     *
+     * @returns one MailBoxStats per subscriber
+     */
+    std::vector<MailBoxStats> stats() {
+      std::lock_guard<std::mutex> lock(mtx);
+      std::vector<MailBoxStats> ret; 
+      for(auto & q : message_queues) {
+	ret.push_back(q.second.counters->snapshot(measure_latency));
+      }
+      return ret; 
+    }
+    
+  protected:
+    /**
+     * @brief Subscribers that share the work instead of each getting
+     * a copy.
+     */
+    struct ConsumerGroup {
+      std::string name; 
+      /// subscriber ids of the members
+      std::vector<int> members; 
+      /// where to start looking for the next member, so ties take turns
+      unsigned int next = 0; 
+      bool steal = false; 
+      /// wake an idle member when a queue gets this deep
+      unsigned int steal_threshold = 2; 
+      /// the member that gets the message put is delivering, or -1
+      int chosen = -1; 
+    };
+    
+    /**
+     * @brief A message waiting in a subscriber's queue
+     */
+    struct Entry {
+      std::shared_ptr<T> msg;
+      /// when the message was put, or zero if we weren't stamping or measuring latency
+      std::chrono::steady_clock::time_point stamp; 
+    };
+    /**
+     * @brief Each subscriber gets a message queue and a condition 
+     * variable to sleep on while it waits for mail.
+     */
+    struct SubscriberQueue {
+      std::deque<Entry> mqueue;
+      /// signaled by put when the waiter's wait_count is satisfied
+      std::condition_variable cv;
+      /// non-zero when the subscriber is waiting for this many messages
+      unsigned int wait_count = 0; 
+      /// the most messages the queue may hold -- zero for no limit
+      unsigned int capacity = 0;
+      OverflowPolicy policy = BLOCK;
+      /// true if the capacity was set for just this subscriber
+      bool own_limit = false; 
+      /// the queue overflowed and the policy was EVICT
+      bool evicted = false;
+      /// interrupt was called, and no wait has given up for it yet
+      bool interrupted = false; 
+      /// the subscriber's handle. Its destructor removes this queue,
+      /// so the queue never outlives it.
+      SubscriptionCl * owner = nullptr; 
+      /// traffic counts, including messages that never made it to this subscriber
+      std::shared_ptr<MailBoxCounters> counters; 
+      /// keep only the newest message for each key
+      bool conflate = false; 
+      /// true if conflation was set for just this subscriber
+      bool own_conflation = false; 
+      /// picks the key for conflation -- if null, every message has the same key
+      std::function<long(const T &)> conflation_key; 
+      /// the waiting message for each key, when conflating
+      std::unordered_map<long, Entry *> latest; 
+      /// the consumer group this subscriber belongs to, if any
+      ConsumerGroup * group = nullptr; 
+      /// put only delivers messages that pass the filter, if there is one
+      std::function<bool(const T &)> filter; 
+      /// put only delivers a sample of the messages that pass the filter
+      DeliveryRate rate = DeliveryRate::all(); 
+      /// called when the queue goes from empty to non-empty
+      std::function<void()> on_ready; 
+      /// readable when the queue goes from empty to non-empty, -1 until someone asks for it
+      int event_fd = -1; 
+
+      ~SubscriberQueue() {
+#ifdef __linux__
+	if(event_fd >= 0) ::close(event_fd);
+#endif
+      }
+
+      bool full() const {
+	return (capacity != 0) && (mqueue.size() >= capacity);
+      }
+    }; 
+    
+    /**
+     * @brief Delayed puts find the mailbox through this, so that the
+     * mailbox can tell them it is gone.
+     */
+    struct LaterGuard {
+      std::mutex mtx; 
+      MailBox<T> * mbox = nullptr; 
+    };
+
+    /**
+     * @brief Queue a task to run a reaction's handler, unless one is
+     * already queued or running. This is called under the mailbox lock.
+     */
+    static void scheduleReaction(const std::shared_ptr<ReactionState> & st) {
+      if(st->cancelled || st->scheduled.exchange(true)) return;
+      try {
+	st->executor->submit([st]() { runReaction(st); });
+      }
+      catch (Executor::Exception & e) {
+	// the executor is going away, and the reaction with it.
+      }
+    }
+
+    /// an executor task: handle a batch of messages for a reaction
+    static void runReaction(const std::shared_ptr<ReactionState> & st) {
+      {
+	std::lock_guard<std::mutex> lock(st->run_mtx);
+	if(st->cancelled) return;
+	try {
+	  std::vector<std::shared_ptr<T>> msgs;
+	  st->mbox->getBatch(st->subs, msgs, st->batch);
+	  for(auto & m : msgs) {
+	    // Executor tasks mustn't throw, and a reaction that stopped
+	    // here would leave scheduled set and go quiet for good.
+	    try {
+	      st->handler(std::move(m));
+	    }
+	    catch (...) {
+	      st->failed++;
+	      if(st->on_error) {
+		try {
+		  st->on_error(std::current_exception());
+		}
+		catch (...) { }
+	      }
+	    }
+	  }
+	  // A put that came in while we were scheduled didn't queue a
+	  // task, so look again before we go.
+	  st->scheduled = false;
+	  if(st->cancelled || (st->mbox->readyCount(st->subs) == 0)) return;
+	}
+	catch (SubscriberEvicted & e) {
+	  // nothing more will come. Leave scheduled set so we aren't queued again.
+	  st->cancelled = true;
+	  return;
+	}
+      }
+      scheduleReaction(st);
+    }
+
+    void setCoalescing(unsigned int max_msgs, 
+		       const std::chrono::duration<long, std::micro> & budget, 
+		       TimerWheel * wheel) {
+      std::lock_guard<std::mutex> flock(frame_mtx);
+      flushFrame(); 
+      frame_max = max_msgs; 
+      frame_budget = budget; 
+      if(wheel != nullptr) frame_wheel = wheel; 
+      frame.reserve(max_msgs); 
+      coalescing = (max_msgs > 1); 
+    }
+
+    /**
+     * @brief add a message to the frame, and deliver the frame if it
+     * is full or old.
+     */
+    void coalesce(const std::shared_ptr<T> & msg, const Subscription & subs) {
+      std::lock_guard<std::mutex> flock(frame_mtx);
+      // setCoalescing may have turned it off while we waited.
+      if(!coalescing) {
+	std::unique_lock<std::mutex> lock(mtx);            
+	deliver(lock, msg, (subs == nullptr) ? -1 : subs->getIndex(this));
+	return; 
+      }
+      // the sender's own id never changes, so it can be looked up later. 
+      int omit_key = (subs == nullptr) ? -1 : subs->getIndex(this);
+      auto now = std::chrono::steady_clock::now(); 
+      if(frame.empty()) {
+	frame_opened = now; 
+	frame_gen++; 
+	// if nobody fills the frame, the wheel will deliver it.
+	auto guard = later; 
+	auto gen = frame_gen; 
+	frame_wheel->schedule(now + frame_budget, [guard, gen]() {
+	    std::lock_guard<std::mutex> glock(guard->mtx);
+	    if(guard->mbox == nullptr) return; 
+	    guard->mbox->flushExpired(gen);
+	  });
+      }
+      frame.push_back(std::make_pair(msg, omit_key));
+      if((frame.size() >= frame_max) || ((now - frame_opened) >= frame_budget)) {
+	flushFrame();
+      }
+    }
+
+    /**
+     * @brief Deliver the frame. The caller holds frame_mtx.
+     */
+    void flushFrame() {
+      if(frame.empty()) return; 
+      std::unique_lock<std::mutex> lock(mtx);            
+      for(auto & f : frame) {
+	deliver(lock, f.first, f.second); 
+      }
+      frame.clear(); 
+    }
+
+    /// the timer wheel's half of coalescing
+    void flushExpired(uint64_t gen) {
+      std::lock_guard<std::mutex> flock(frame_mtx);
+      // a frame that filled up first is long gone.
+      if(gen == frame_gen) flushFrame(); 
+    }
+
+    /// the timer wheel's half of putAt
+    void putLater(const std::shared_ptr<T> & msg, int omit_key) {
+      std::unique_lock<std::mutex> lock(mtx);
+      deliver(lock, msg, omit_key);
+    }
+
+    std::map<int, SubscriberQueue> message_queues; 
+    std::map<std::string, ConsumerGroup> groups; 
+    std::shared_ptr<LaterGuard> later; 
+    int subscription_counter; 
+
+    unsigned int default_capacity; 
+    OverflowPolicy default_policy; 
+    unsigned long total_dropped; 
+    /// read by stats(subs) without the lock
+    std::atomic<bool> measure_latency; 
+    bool stamp_messages; 
+    bool default_conflate; 
+    std::function<long(const T &)> default_conflation_key; 
+
+    /// the history that new subscribers get, oldest first
+    std::list<Entry> retained; 
+    bool retaining; 
+    /// the most messages (or keys) to keep -- zero for no limit when keeping by key
+    unsigned int retain_depth; 
+    /// if set, keep only the newest message for each key
+    std::function<long(const T &)> retain_key; 
+    std::unordered_map<long, typename std::list<Entry>::iterator> retained_by_key; 
+
+    /// producers blocked on a full queue wait here
+    std::condition_variable space_cv; 
+    unsigned int blocked_producers; 
+
+    /// coalescing: messages put, but not yet delivered. Taken before mtx.
+    std::mutex frame_mtx; 
+    std::atomic<bool> coalescing; 
+    std::vector<std::pair<std::shared_ptr<T>, int>> frame; 
+    unsigned int frame_max; 
+    std::chrono::microseconds frame_budget; 
+    TimerWheel * frame_wheel; 
+    std::chrono::steady_clock::time_point frame_opened; 
+    /// bumped each time a frame is opened, so a stale timer does nothing
+    uint64_t frame_gen; 
+
+    /**
+     * @brief make a subscriber queue. The caller holds the lock.
+     */
+    Subscription addSubscriber(const std::function<bool(const T &)> & filter) {
+      // make a subscriber queue -- constructed in place, as the
+      // condition variable can't be copied.
+      auto & sq = message_queues[subscription_counter];
+      sq.capacity = default_capacity;
+      sq.policy = default_policy; 
+      sq.filter = filter; 
+      if(default_conflate) applyConflation(sq, true, default_conflation_key);
+      sq.counters = std::make_shared<MailBoxCounters>(subscription_counter);
+
+      // what will the subscriber number be? 
+      Subscription ret(new SubscriptionCl(this,
+					  subscription_counter, 
+					  sq.counters));
+      sq.owner = ret.get(); 
+      
+      subscription_counter++;
+      return ret;
+    }
+
+    SubscriberQueue & getSubscriber(int idx) {
+      auto it = message_queues.find(idx);
+      if(it == message_queues.end()) {
+	throw MissingSubscriber(getName(), "get()", idx);
+      }
+      return it->second;
+    }
+
+    /**
+     * @brief find the subscriber's queue.
+     * @throws SubscriberEvicted if the subscriber has been cut off. 
+     */
+    SubscriberQueue & getSubscriber(Subscription & subs) {
+      auto & sq = getSubscriber(subs->getIndex(this));
+      checkEvicted(sq, subs);
+      return sq; 
+    }
+
+    void checkEvicted(SubscriberQueue & sq, Subscription & subs) {
+      if(sq.evicted) {
+	throw SubscriberEvicted(getName(), subs->getIndex(this));
+      }
+    }
+
+    /**
+     * @brief Put one message in every subscriber's queue, applying
+     * each subscriber's overflow policy. The caller holds the lock.
+     */
+    void deliver(std::unique_lock<std::mutex> & lock, 
+		 const std::shared_ptr<T> & msg, int omit_key) {
+      // First wait until every subscriber with a BLOCK policy has
+      // room, so that the message still lands in every queue at once.
+      while(true) {
+	// the queue lengths may have changed while we were waiting. 
+	for(auto & g : groups) pickMember(g.second, msg, omit_key);
+	if(!mustBlock(msg, omit_key)) break; 
+	blocked_producers++; 
+	space_cv.wait(lock);
+	blocked_producers--; 
+      }
+      for(auto & g : groups) {
+	if(g.second.chosen >= 0) g.second.next++; 
+      }
+
+      Entry e;
+      e.msg = msg; 
+      if(measure_latency || stamp_messages) e.stamp = std::chrono::steady_clock::now();
+      
+      for(auto & q : message_queues) {
+	if(q.first == omit_key) continue; 
+	auto & sq = q.second; 
+	if(sq.evicted || !wants(sq, msg)) continue; 
+	if((sq.group != nullptr) && (sq.group->chosen != q.first)) continue; 
+	if(!sq.rate.isAll() && !sq.rate.admit(std::chrono::steady_clock::now())) {
+	  sq.counters->recordDecimated(); 
+	  continue; 
+	}
+	if(replaceLatest(sq, e)) continue; 
+	if(sq.full()) {
+	  if(sq.policy == DROP_NEWEST) {
+	    dropMessages(sq, 1);
+	    continue; 
+	  }
+	  else if(sq.policy == DROP_OLDEST) {
+	    while(sq.full()) {
+	      popFront(sq);
+	      dropMessages(sq, 1);
+	    }
+	  }
+	  else if(sq.policy == EVICT) {
+	    unsigned long count = sq.mqueue.size() + 1; 
+	    clearQueue(sq);
+	    dropMessages(sq, count);
+	    sq.evicted = true; 
+	    // wake the subscriber so that it finds out
+	    sq.cv.notify_one();
+	    callAttention(sq);
+	    signalReady(sq); 
+	    continue; 
+	  }
+	}
+	pushBack(sq, e);
+	// the event fd only fires on the empty to non-empty edge
+	if(sq.mqueue.size() == 1) signalReady(sq); 
+	// only bother the subscriber if it is waiting for this message
+	if((sq.wait_count != 0) && (sq.mqueue.size() >= sq.wait_count)) {
+	  // we've satisfied the waiter, don't notify it again. 
+	  sq.wait_count = 0; 
+	  sq.cv.notify_one();
+	}
+	if((sq.group != nullptr) && sq.group->steal && 
+	   (sq.mqueue.size() >= sq.group->steal_threshold)) {
+	  wakeIdleMember(*sq.group);
+	}
+      }
+      if(retaining) retain(e); 
+    }
+
+    /**
+     * @brief Add a message to the history. The caller holds the lock.
+     */
+    void retain(const Entry & e) {
+      if(retain_key) {
+	if(e.msg == nullptr) return; 
+	long k = retain_key(*e.msg); 
+	auto it = retained_by_key.find(k);
+	if(it != retained_by_key.end()) retained.erase(it->second);
+	retained.push_back(e); 
+	retained_by_key[k] = std::prev(retained.end()); 
+      }
+      else {
+	retained.push_back(e); 
+      }
+      trimRetained(); 
+    }
+
+    void trimRetained() {
+      while((retain_depth != 0) && (retained.size() > retain_depth)) {
+	if(retain_key) retained_by_key.erase(retain_key(*retained.front().msg));
+	retained.pop_front(); 
+      }
+    }
+
+    void clearRetained() {
+      retained.clear(); 
+      retained_by_key.clear(); 
+    }
+
+    /**
+     * @brief Give a new subscriber the history. The subscriber's
+     * filter and delivery rate apply, as they would in deliver, and
+     * a bounded queue gets only the newest messages that fit. The
+     * caller holds the lock.
+     */
+    void replay(SubscriberQueue & sq) {
+      std::vector<const Entry *> wanted; 
+      auto now = std::chrono::steady_clock::now(); 
+      for(auto & e : retained) {
+	if(!wants(sq, e.msg)) continue; 
+	if(!sq.rate.isAll() && !sq.rate.admit(now)) {
+	  sq.counters->recordDecimated(); 
+	  continue; 
+	}
+	wanted.push_back(&e);
+      }
+      size_t first = 0; 
+      if((sq.capacity != 0) && (wanted.size() > sq.capacity)) first = wanted.size() - sq.capacity; 
+      for(size_t i = first; i < wanted.size(); i++) {
+	if(!replaceLatest(sq, *wanted[i])) pushBack(sq, *wanted[i]);
+      }
+    }
+
+    bool mustBlock(const std::shared_ptr<T> & msg, int omit_key) {
+      for(auto & q : message_queues) {
+	auto & sq = q.second;
+	if((q.first != omit_key) && !sq.evicted && (sq.policy == BLOCK) && sq.full()
+	   && ((sq.group == nullptr) || (sq.group->chosen == q.first))
+	   && wants(sq, msg) && !holdsKey(sq, msg)
+	   && (sq.rate.isAll() || sq.rate.wouldAdmit(std::chrono::steady_clock::now()))) {
+	  return true; 
+	}
+      }
+      return false; 
+    }
+
+    /**
+     * @brief Which member of a consumer group should get this message?
+     *
+     * The one with the shortest queue that has room, or failing that,
+     * the one with the shortest queue. Ties go to the first member
+     * at or after g.next. The answer is left in g.chosen.
+     */
+    void pickMember(ConsumerGroup & g, const std::shared_ptr<T> & msg, int omit_key) {
+      g.chosen = -1; 
+      bool best_full = true; 
+      size_t best_size = 0; 
+      unsigned int n = g.members.size();
+      for(unsigned int i = 0; i < n; i++) {
+	int key = g.members[(g.next + i) % n];
+	if(key == omit_key) continue; 
+	auto & sq = message_queues[key];
+	if(sq.evicted || !wants(sq, msg)) continue; 
+	bool full = sq.full(); 
+	size_t size = sq.mqueue.size();
+	if((g.chosen < 0) || (!full && best_full) || 
+	   ((full == best_full) && (size < best_size))) {
+	  g.chosen = key; 
+	  best_full = full; 
+	  best_size = size; 
+	}
+      }
+    }
+
+    /**
+     * @brief If this subscriber has run dry and its group allows
+     * stealing, take the oldest message it wants from the busiest
+     * member that has one. A member with a filter only steals what
+     * the filter passes.
+     */
+    void steal(SubscriberQueue & sq) {
+      if(!sq.mqueue.empty() || (sq.group == nullptr) || !sq.group->steal) return; 
+      SubscriberQueue * victim = nullptr; 
+      size_t at = 0; 
+      for(auto key : sq.group->members) {
+	auto & other = message_queues[key];
+	if(other.evicted || (&other == &sq)) continue; 
+	if((victim != nullptr) && (other.mqueue.size() <= victim->mqueue.size())) continue; 
+	for(size_t i = 0; i < other.mqueue.size(); i++) {
+	  if(wants(sq, other.mqueue[i].msg)) {
+	    victim = &other; 
+	    at = i; 
+	    break; 
+	  }
+	}
+      }
+      if(victim == nullptr) return; 
+      Entry e = takeAt(*victim, at);
+      victim->counters->recordStolenOut(victim->mqueue.size());
+      if(!replaceLatest(sq, e)) {
+	placeBack(sq, e);
+	sq.counters->recordStolenIn(sq.mqueue.size());
+      }
+      madeRoom();
+    }
+
+    /**
+     * @brief A member's queue has backed up. Stop the spin of every
+     * member with nothing to do, and wake one that is asleep, so
+     * that they can steal. The caller holds the lock.
+     */
+    void wakeIdleMember(ConsumerGroup & g) {
+      bool woke = false; 
+      for(auto key : g.members) {
+	auto & other = message_queues[key];
+	if(other.evicted || !other.mqueue.empty()) continue; 
+	callAttention(other);
+	if(!woke && (other.wait_count != 0)) {
+	  other.cv.notify_one();
+	  woke = true; 
+	}
+      }
+    }
+
+    /**
+     * @brief end the subscriber's spin, if it is spinning in waitGet.
+     */
+    void callAttention(SubscriberQueue & sq) {
+      if(sq.owner != nullptr) sq.owner->attention.store(true, std::memory_order_release);
+    }
+
+    /**
+     * @brief does this subscriber want this message? 
+     */
+    bool wants(SubscriberQueue & sq, const std::shared_ptr<T> & msg) {
+      return !sq.filter || (msg == nullptr) || sq.filter(*msg); 
+    }
+
+    /**
+     * @brief the subscriber's queue just went from empty to
+     * non-empty (or it was evicted). Tell anyone who is watching.
+     */
+    void signalReady(SubscriberQueue & sq) {
+      signalEvent(sq); 
+      if(sq.on_ready) sq.on_ready(); 
+    }
+
+    /**
+     * @brief make the subscriber's event fd readable, if it has one.
+     */
+    void signalEvent(SubscriberQueue & sq) {
+#ifdef __linux__
+      if(sq.event_fd >= 0) {
+	uint64_t one = 1;
+	// if the counter is already non-zero this just adds to it, and
+	// the fd stays readable. Nothing to do if the write fails.
+	ssize_t r = ::write(sq.event_fd, &one, sizeof(one));
+	(void) r; 
+      }
+#endif
+    }
+
+    void dropMessages(SubscriberQueue & sq, unsigned long count) {
+      sq.counters->recordDrop(count, sq.mqueue.size());
+      total_dropped += count; 
+    }
+
+    /**
+     * @brief which conflation slot does this message belong in?
+     */
+    long conflationKey(SubscriberQueue & sq, const T & msg) {
+      return sq.conflation_key ? sq.conflation_key(msg) : 0; 
+    }
+
+    /**
+     * @brief does this conflating subscriber already have a message
+     * with msg's key waiting?
+     */
+    bool holdsKey(SubscriberQueue & sq, const std::shared_ptr<T> & msg) {
+      return sq.conflate && (msg != nullptr) && 
+	(sq.latest.count(conflationKey(sq, *msg)) != 0); 
+    }
+    
+    /**
+     * @brief If the subscriber conflates, and already has a message
+     * with the same key waiting, replace it with the new one. The new
+     * message takes the old one's place in line.
+     *
+     * @returns true if the message was replaced.
+     */
+    bool replaceLatest(SubscriberQueue & sq, const Entry & e) {
+      if(!sq.conflate || (e.msg == nullptr)) return false; 
+      auto it = sq.latest.find(conflationKey(sq, *e.msg));
+      if(it == sq.latest.end()) return false; 
+      *(it->second) = e; 
+      sq.counters->recordConflated();
+      return true; 
+    }
+
+    /**
+     * @brief add a message to the end of the subscriber's queue.
+     */
+    void pushBack(SubscriberQueue & sq, const Entry & e) {
+      placeBack(sq, e);
+      sq.counters->recordEnqueue(sq.mqueue.size());
+    }
+
+    /**
+     * @brief add a message to the end of the queue without counting it.
+     */
+    void placeBack(SubscriberQueue & sq, const Entry & e) {
+      sq.mqueue.push_back(e);
+      if(sq.conflate && (e.msg != nullptr)) {
+	// references to deque elements survive pushes and pops at the ends.
+	sq.latest[conflationKey(sq, *e.msg)] = &sq.mqueue.back(); 
+      }
+    }
+
+    /**
+     * @brief remove the oldest message from the subscriber's queue.
+     */
+    void popFront(SubscriberQueue & sq) {
+      auto & e = sq.mqueue.front();
+      if(!sq.latest.empty() && (e.msg != nullptr)) {
+	auto it = sq.latest.find(conflationKey(sq, *e.msg));
+	if((it != sq.latest.end()) && (it->second == &e)) sq.latest.erase(it);
+      }
+      sq.mqueue.pop_front();
+    }
+
+    /**
+     * @brief remove the message at position idx from the subscriber's
+     * queue, and return it.
+     */
+    Entry takeAt(SubscriberQueue & sq, size_t idx) {
+      Entry ret = sq.mqueue[idx];
+      if(idx == 0) {
+	popFront(sq);
+	return ret; 
+      }
+      sq.mqueue.erase(sq.mqueue.begin() + idx);
+      if(!sq.latest.empty()) {
+	// erasing from the middle moves the others, so find them again.
+	sq.latest.clear();
+	for(auto & e : sq.mqueue) {
+	  if(e.msg != nullptr) sq.latest[conflationKey(sq, *e.msg)] = &e; 
+	}
+      }
+      return ret; 
+    }
+
+    void clearQueue(SubscriberQueue & sq) {
+      sq.mqueue.clear();
+      sq.latest.clear();
+    }
+
+    /**
+     * @brief Turn conflation on or off for one subscriber queue. If
+     * it is turning on, throw away all but the newest message for
+     * each key already in the queue.
+     */
+    void applyConflation(SubscriberQueue & sq, bool on, 
+			 const std::function<long(const T &)> & key) {
+      sq.latest.clear();
+      sq.conflate = on; 
+      sq.conflation_key = key; 
+      if(!on) return; 
+      std::deque<Entry> old; 
+      std::swap(old, sq.mqueue);
+      for(auto & e : old) {
+	if(!replaceLatest(sq, e)) {
+	  sq.mqueue.push_back(e);
+	  if(e.msg != nullptr) sq.latest[conflationKey(sq, *e.msg)] = &sq.mqueue.back(); 
+	}
+      }
+      sq.counters->recordDepth(sq.mqueue.size());
+      madeRoom();
+    }
+
+    /**
+     * @brief take the oldest message out of a subscriber's queue. 
+     * The queue must not be empty.
+     */
+    std::shared_ptr<T> pop(SubscriberQueue & sq) {
+      auto ret = sq.mqueue.front().msg;
+      if(measure_latency) {
+	recordLatency(sq, sq.mqueue.front(), std::chrono::steady_clock::now());
+      }
+      popFront(sq);
+      sq.counters->recordDequeue(1, sq.mqueue.size());
+      return ret; 
+    }
+
+    void recordLatency(SubscriberQueue & sq, const Entry & e, 
+		       const std::chrono::steady_clock::time_point & now) {
+      // messages put before we started measuring have no stamp. 
+      if((e.stamp != std::chrono::steady_clock::time_point()) && 
+	 (now != std::chrono::steady_clock::time_point())) {
+	sq.counters->recordLatency(e.stamp, now);
+      }
+    }
+
+    /**
+     * @brief A queue got shorter, or went away. Let any blocked
+     * producers have another look. The caller holds the lock.
+     */
+    void madeRoom() {
+      if(blocked_producers != 0) space_cv.notify_all();
+    }
+    
+    /**
+     * @brief sleep until the subscriber has at least num_msgs messages
+     * waiting. The caller must hold the lock on mtx.
+     *
+     * @returns true if the messages arrived, false if we timed out.
+     */
+    bool waitForMessages(std::unique_lock<std::mutex> & lock, 
+			 SubscriberQueue & sq, 
+			 unsigned int num_msgs, 
+			 const std::chrono::duration<long, std::micro> & timeout) {
+      if(sq.mqueue.size() >= num_msgs) return true; 
+
+      // an idle group member woken by wakeIdleMember steals here.
+      auto ready = [this, &sq, num_msgs]() { 
+	steal(sq); 
+	return sq.evicted || sq.interrupted || (sq.mqueue.size() >= num_msgs); 
+      };
+      bool ret = true; 
+      sq.wait_count = num_msgs; 
+      if(timeout.count() == 0) {
+	sq.cv.wait(lock, ready);
+      }
+      else {
+	ret = sq.cv.wait_for(lock, timeout, ready);
+      }
+      sq.wait_count = 0;
+      sq.interrupted = false; 
+      return ret && (sq.evicted || (sq.mqueue.size() >= num_msgs));
     }
 
     // mutual exclusion stuff
@@ -0,0 +1,298 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <map>
+#include <functional>
+#include <mutex>
+#include <typeinfo>
+#include "MailBox.hxx"
+#include "Exception.hxx"
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file MailBoxRegistry.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::MailBoxRegistry MailBoxRegistry: finding mailboxes by topic
+ *
+ * MailBoxBase exists so that mailboxes of different types can be
+ * kept in one map, keyed by name. But every lookup then pays for a
+ * string compare or three, and for MailBoxBase::convert's
+ * dynamic_pointer_cast.
+ *
+ * A SoDa::MailBoxRegistry does the string work once. Each topic name
+ * is interned into a small integer handle. Looking a mailbox up by
+ * handle is an index into a table, and the mailbox's type is checked
+ * by comparing type_info, not by a dynamic cast.
+ *
+ * Topic names are hierarchical, with the levels separated by dots:
+ * "rx.main.spectrum", "rx.sub.spectrum", "tx.power". The registry
+ * keeps them in a trie, one level per node. A pattern can use "*"
+ * for any one level, and "**" for any number of levels (including
+ * none):
+ *
+ * - "rx.*.spectrum" matches "rx.main.spectrum" and "rx.sub.spectrum"
+ * - "rx.**" matches everything under "rx"
+ *
+ * '''match(pattern)''' walks the trie and returns the handles of
+ * the mailboxes that match right now. '''watch(pattern, callback)'''
+ * calls the callback for every mailbox that matches now, and for each
+ * matching mailbox that is added later. Either way, the pattern
+ * matching is done once, when the subscriber asks, and never on a put.
+ *
+ * \code
+ *   SoDa::MailBoxRegistry reg("radio");
+ *   reg.add("rx.main.spectrum", SoDa::makeMailBox<Spectrum>("main"));
+ *   reg.add("rx.sub.spectrum", SoDa::makeMailBox<Spectrum>("sub"));
+ *
+ *   for(auto h : reg.match("rx.*.spectrum")) {
+ *     subs.push_back(reg.get<SoDa::MailBox<Spectrum>>(h)->subscribe());
+ *   }
+ * \endcode
+ */
+
+namespace SoDa {
+
+  /**
+   * @class MailBoxRegistry
+   * @brief Intern mailbox topics into handles, and find them by
+   * handle, name, or wildcard pattern.
+   */
+  class MailBoxRegistry : public NoCopy {
+  public:
+    /// a registry's name for a topic
+    typedef unsigned int Handle;
+
+    /**
+     * @brief Catch this when you don't care why the registry threw an exception
+     */
+    class Exception : public SoDa::Exception {
+    public:
+      Exception(const std::string & name, const std::string & problem) :
+	SoDa::Exception("SoDa::MailBoxRegistry[" + name + "] " + problem) {
+      }
+    };
+
+    /**
+     * @brief A topic was empty, had an empty level, had white space
+     * in it, or used a wildcard where one isn't allowed.
+     */
+    class BadTopic : public Exception {
+    public:
+      BadTopic(const std::string & name, const std::string & topic) :
+	Exception(name, "bad topic name [" + topic + "]") {
+      }
+    };
+
+    /**
+     * @brief The handle doesn't name a mailbox, or the mailbox isn't
+     * the type the caller asked for.
+     */
+    class BadLookup : public Exception {
+    public:
+      BadLookup(const std::string & name, const std::string & topic, const std::string & problem) :
+	Exception(name, "topic [" + topic + "] " + problem) {
+      }
+    };
+
+    /**
+     * @brief constructor
+     * @param name the name of the registry
+     */
+    MailBoxRegistry(const std::string & name);
+
+    /**
+     * @brief Get the handle for a topic, creating one if the topic is
+     * new. The handle is good for the life of the registry, whether or
+     * not a mailbox has been added for the topic yet.
+     *
+     * @param topic dotted topic name. No wildcards.
+     * @returns the topic's handle
+     */
+    Handle intern(const std::string & topic);
+
+    /**
+     * @brief Add a mailbox to the registry.
+     *
+     * @param topic dotted topic name. No wildcards.
+     * @param mbox_p the mailbox. It may be any flavor of mailbox.
+     * @returns the topic's handle
+     * @throws BadLookup if the topic already has a mailbox.
+     */
+    template<typename MB>
+    Handle add(const std::string & topic, std::shared_ptr<MB> mbox_p) {
+      std::vector<std::function<void(Handle)>> to_call;
+      Handle h;
+      {
+	std::lock_guard<std::mutex> lock(mtx);
+	h = internLocked(topic);
+	auto & e = entries[h];
+	if(e.base != nullptr) {
+	  throw BadLookup(name, topic, "already has a mailbox");
+	}
+	e.base = mbox_p;
+	e.typed = mbox_p;
+	e.type = &typeid(MB);
+	to_call = watchersFor(h);
+      }
+      // call the watchers without the lock, so that they can look
+      // things up.
+      for(auto & cb : to_call) cb(h);
+      return h;
+    }
+
+    /**
+     * @brief Find a mailbox by handle.
+     *
+     * @tparam MB the mailbox type, for instance SoDa::MailBox<Spectrum>
+     * @param h a handle from intern, add, or match
+     * @returns the mailbox
+     * @throws BadLookup if there's no mailbox for the handle, or it
+     * isn't an MB.
+     */
+    template<typename MB>
+    std::shared_ptr<MB> get(Handle h) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto & e = entry(h);
+      if(e.base == nullptr) {
+	throw BadLookup(name, e.topic, "has no mailbox");
+      }
+      if(*(e.type) != typeid(MB)) {
+	throw BadLookup(name, e.topic, "holds a different type of mailbox");
+      }
+      return std::static_pointer_cast<MB>(e.typed);
+    }
+
+    /**
+     * @brief Find a mailbox by topic name.
+     *
+     * @tparam MB the mailbox type, for instance SoDa::MailBox<Spectrum>
+     * @param topic dotted topic name. No wildcards.
+     * @returns the mailbox
+     * @throws BadLookup if there's no mailbox for the topic, or it
+     * isn't an MB.
+     */
+    template<typename MB>
+    std::shared_ptr<MB> get(const std::string & topic) {
+      return get<MB>(intern(topic));
+    }
+
+    /**
+     * @brief Find a mailbox by handle, whatever its type.
+     * @returns the mailbox, or nullptr if the topic has no mailbox yet.
+     */
+    std::shared_ptr<MailBoxBase> getBase(Handle h);
+
+    /**
+     * @brief What topic does this handle stand for?
+     */
+    std::string topic(Handle h);
+
+    /**
+     * @brief Find the mailboxes whose topics match a pattern.
+     *
+     * @param pattern a dotted topic name that may use "*" for any one
+     * level and "**" for any number of levels.
+     * @returns the handles of the matching topics that have mailboxes.
+     */
+    std::vector<Handle> match(const std::string & pattern);
+
+    /**
+     * @brief Keep an eye out for mailboxes that match a pattern.
+     *
+     * The callback is called (from this thread) for each mailbox that
+     * matches now, and later from add for each mailbox that matches
+     * when it is added. It is called without the registry's lock held.
+     *
+     * @param pattern a dotted topic name that may use "*" and "**"
+     * @param callback gets the handle of each matching mailbox
+     */
+    void watch(const std::string & pattern, const std::function<void(Handle)> & callback);
+
+    const std::string & getName() const { return name; }
+
+  protected:
+    /**
+     * @brief one level of the topic trie
+     */
+    struct Node {
+      std::map<std::string, std::unique_ptr<Node>> children;
+      /// the handle for the topic that ends here, or -1
+      long handle = -1;
+    };
+
+    struct Entry {
+      std::string topic;
+      std::vector<std::string> levels;
+      std::shared_ptr<MailBoxBase> base;
+      /// the same mailbox, as its own type
+      std::shared_ptr<void> typed;
+      const std::type_info * type = nullptr;
+    };
+
+    struct Watcher {
+      std::vector<std::string> pattern;
+      std::function<void(Handle)> callback;
+    };
+
+    Handle internLocked(const std::string & topic);
+    Entry & entry(Handle h);
+    std::vector<std::string> splitTopic(const std::string & topic, bool wildcards_ok);
+
+    /// walk the trie, collecting the handles under node that match pattern[pos...]
+    void matchNode(Node * node, const std::vector<std::string> & pattern, unsigned int pos,
+		   std::vector<bool> & seen, std::vector<Handle> & ret);
+    /// does this topic match this pattern?
+    static bool matchLevels(const std::vector<std::string> & topic, unsigned int tpos,
+			    const std::vector<std::string> & pattern, unsigned int ppos);
+    std::vector<std::function<void(Handle)>> watchersFor(Handle h);
+
+    std::string name;
+    Node root;
+    std::vector<Entry> entries;
+    std::vector<Watcher> watchers;
+    std::mutex mtx;
+  };
+
+  typedef std::shared_ptr<MailBoxRegistry> MailBoxRegistryPtr;
+
+  /**
+   * @brief Make a registry and return a shared pointer to it.
+   *
+   * @param name the name of the registry
+   * @returns shared pointer to a MailBoxRegistry
+   */
+  MailBoxRegistryPtr makeMailBoxRegistry(const std::string & name);
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "MailBox.hxx"
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file MailBoxSelector.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::MailBoxSelector MailBoxSelector: waiting on many mailboxes at once
+ *
+ * A control thread in a radio might listen to half a dozen mailboxes,
+ * each carrying a different kind of message. It can't sit in waitGet
+ * on any one of them, and calling get on each in turn either burns
+ * the processor or adds latency (or both).
+ *
+ * A SoDa::MailBoxSelector watches a set of subscriptions, to
+ * mailboxes of any message type, and '''waitAny''' sleeps until at
+ * least one of them has mail. It returns the indices of all the
+ * subscriptions that are ready. The list starts just past the
+ * subscription that was served first last time, so a busy mailbox
+ * can't starve the others.
+ *
+ * \code
+ *   SoDa::MailBoxSelector sel("control");
+ *   auto cmd_idx = sel.add(cmd_mbox, cmd_subs);
+ *   auto status_idx = sel.add(status_mbox, status_subs);
+ *   while(true) {
+ *     for(auto idx : sel.waitAny()) {
+ *       if(idx == cmd_idx) handleCommand(cmd_mbox->get(cmd_subs));
+ *       else if(idx == status_idx) handleStatus(status_mbox->get(status_subs));
+ *     }
+ *   }
+ * \endcode
+ *
+ * The selector finds out about new mail through the mailbox's
+ * '''addReadyCallback''' hook, so a mailbox costs nothing while it is
+ * quiet. Each subscription must stay alive as long as the selector
+ * is in use.
+ */
+
+namespace SoDa {
+
+  /**
+   * @class MailBoxSelector
+   * @brief Wait for mail on any of several subscriptions.
+   *
+   * A selector is meant to be used by a single thread: the one that
+   * owns the subscriptions.
+   */
+  class MailBoxSelector : public NoCopy {
+  public:
+    /**
+     * @brief constructor
+     * @param name the name of the selector
+     */
+    MailBoxSelector(const std::string & name);
+
+    /**
+     * @brief Watch a subscription.
+     *
+     * @param mailbox_p the mailbox. It must support addReadyCallback
+     * and readyCount, as SoDa::MailBox does. Any ready callback the
+     * subscription already has (a SoDa::MergedReader's, say) is kept.
+     * @param subs the subscription to that mailbox. The selector
+     * keeps a reference to it, so it must outlive the selector.
+     * @returns the index that waitAny will use for this subscription.
+     */
+    template<typename MBoxPtr, typename Subs>
+    unsigned int add(MBoxPtr mailbox_p, Subs & subs) {
+      unsigned int idx = ready_checks.size();
+      Subs * subs_p = &subs;
+      ready_checks.push_back([mailbox_p, subs_p]() {
+	  try {
+	    return mailbox_p->readyCount(*subs_p) != 0;
+	  }
+	  catch (MailBoxBase::SubscriberEvicted & e) {
+	    // let the caller's get find out about it.
+	    return true;
+	  }
+	});
+      // The callback holds the shared state, not the selector, so a
+      // mailbox that outlives the selector won't call into a dead object.
+      auto state_p = state;
+      mailbox_p->addReadyCallback(subs, [state_p]() { state_p->signal(); });
+      return idx;
+    }
+
+    /**
+     * @brief Wait until at least one subscription has mail waiting.
+     *
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns the indices of the subscriptions that have mail, in
+     * fairness order. Empty if the timeout expired first.
+     */
+    std::vector<unsigned int> waitAny(const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0));
+
+    /**
+     * @brief Which subscriptions have mail right now? This doesn't wait.
+     *
+     * @returns the indices of the subscriptions that have mail, in
+     * fairness order.
+     */
+    std::vector<unsigned int> ready();
+
+    /**
+     * @brief how many subscriptions is the selector watching?
+     */
+    unsigned int size() const { return ready_checks.size(); }
+
+    const std::string & getName() const { return name; }
+
+  protected:
+    /**
+     * @brief The part of the selector that the mailboxes' ready
+     * callbacks can see.
+     */
+    struct State {
+      std::mutex mtx;
+      std::condition_variable cv;
+      /// set by a callback since the last time waitAny looked
+      bool signaled = false;
+
+      void signal() {
+	std::lock_guard<std::mutex> lock(mtx);
+	signaled = true;
+	cv.notify_one();
+      }
+    };
+
+    std::string name;
+    std::shared_ptr<State> state;
+    std::vector<std::function<bool()>> ready_checks;
+    /// where the next scan starts
+    unsigned int next;
+  };
+
+  typedef std::shared_ptr<MailBoxSelector> MailBoxSelectorPtr;
+
+  /**
+   * @brief Make a selector and return a shared pointer to it.
+   *
+   * @param name the name of the selector
+   * @returns shared pointer to a MailBoxSelector
+   */
+  MailBoxSelectorPtr makeMailBoxSelector(const std::string & name);
+}
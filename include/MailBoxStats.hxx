@@ -0,0 +1,242 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file MailBoxStats.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+namespace SoDa {
+
+  /**
+   * @class MailBoxStats
+   * @brief A snapshot of one subscriber's traffic counters.
+   */
+  struct MailBoxStats {
+    /// which subscriber this is
+    int subscriber;
+    /// messages that landed in the subscriber's queue
+    unsigned long enqueued;
+    /// messages the subscriber took out of its queue (or cleared)
+    unsigned long dequeued;
+    /// messages that were dropped on the subscriber's account
+    unsigned long dropped;
+    /// waiting messages that were replaced by a newer one
+    unsigned long conflated;
+    /// messages the subscriber's delivery rate skipped
+    unsigned long decimated;
+    /// messages this consumer group member took from a sibling's queue
+    unsigned long stolen_in;
+    /// messages a sibling took out of this member's queue
+    unsigned long stolen_out;
+    /// messages waiting in the queue
+    unsigned int depth;
+    /// the deepest the queue has ever been
+    unsigned int high_water;
+    /**
+     * Time from put to get, if the mailbox is keeping track.
+     * latency[0] counts messages that waited less than one
+     * microsecond, latency[i] counts those that waited at least
+     * 2^(i-1) and less than 2^i microseconds. The last bucket
+     * catches everything longer. Empty if latency isn't being
+     * measured.
+     */
+    std::vector<unsigned long> latency;
+  };
+
+  /**
+   * @class MailBoxCounters
+   * @brief The live counters behind a MailBoxStats snapshot.
+   *
+   * The mailbox updates the counters while it holds its own lock, but
+   * they are all atomic so that a monitor can read them at any time
+   * without getting in the way.
+   */
+  class MailBoxCounters : public NoCopy {
+  public:
+    static const unsigned int num_latency_buckets = 32;
+
+    MailBoxCounters(int subscriber) : subscriber(subscriber) {
+      enqueued.store(0);
+      dequeued.store(0);
+      dropped.store(0);
+      conflated.store(0);
+      decimated.store(0);
+      stolen_in.store(0);
+      stolen_out.store(0);
+      depth.store(0);
+      high_water.store(0);
+      for(auto & b : latency) b.store(0);
+    }
+
+    /**
+     * @brief count a message into the queue
+     * @param new_depth the queue's depth after the push
+     */
+    void recordEnqueue(unsigned int new_depth) {
+      enqueued.fetch_add(1, std::memory_order_relaxed);
+      setDepth(new_depth);
+    }
+
+    /**
+     * @brief count messages out of the queue
+     * @param count how many left
+     * @param new_depth the queue's depth after they left
+     */
+    void recordDequeue(unsigned long count, unsigned int new_depth) {
+      dequeued.fetch_add(count, std::memory_order_relaxed);
+      setDepth(new_depth);
+    }
+
+    void recordDrop(unsigned long count, unsigned int new_depth) {
+      dropped.fetch_add(count, std::memory_order_relaxed);
+      setDepth(new_depth);
+    }
+
+    /**
+     * @brief count a waiting message that was replaced by a newer one
+     */
+    void recordConflated() {
+      conflated.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief count a message that the delivery rate skipped
+     */
+    void recordDecimated() {
+      decimated.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief count a message moved into the queue from a sibling's
+     * @param new_depth the queue's depth after the push
+     */
+    void recordStolenIn(unsigned int new_depth) {
+      stolen_in.fetch_add(1, std::memory_order_relaxed);
+      setDepth(new_depth);
+    }
+
+    /**
+     * @brief count a message a sibling took out of the queue
+     * @param new_depth the queue's depth after it left
+     */
+    void recordStolenOut(unsigned int new_depth) {
+      stolen_out.fetch_add(1, std::memory_order_relaxed);
+      setDepth(new_depth);
+    }
+
+    /**
+     * @brief note a change in the queue depth that wasn't an enqueue,
+     * dequeue, or drop.
+     */
+    void recordDepth(unsigned int new_depth) {
+      setDepth(new_depth);
+    }
+
+    /**
+     * @brief count a message's trip through the queue
+     * @param enqueued_at when it was put
+     * @param now when it was taken out
+     */
+    void recordLatency(const std::chrono::steady_clock::time_point & enqueued_at,
+		       const std::chrono::steady_clock::time_point & now) {
+      long us = std::chrono::duration_cast<std::chrono::microseconds>(now - enqueued_at).count();
+      unsigned int b = 0;
+      while((us > 0) && (b < (num_latency_buckets - 1))) {
+	us = us >> 1;
+	b++;
+      }
+      latency[b].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief how many messages are waiting right now?
+     */
+    unsigned int currentDepth() const {
+      return depth.load(std::memory_order_acquire);
+    }
+
+    unsigned long droppedCount() const {
+      return dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief copy the counters
+     * @param with_latency include the latency histogram
+     */
+    MailBoxStats snapshot(bool with_latency) const {
+      MailBoxStats ret;
+      ret.subscriber = subscriber;
+      ret.enqueued = enqueued.load(std::memory_order_relaxed);
+      ret.dequeued = dequeued.load(std::memory_order_relaxed);
+      ret.dropped = dropped.load(std::memory_order_relaxed);
+      ret.conflated = conflated.load(std::memory_order_relaxed);
+      ret.decimated = decimated.load(std::memory_order_relaxed);
+      ret.stolen_in = stolen_in.load(std::memory_order_relaxed);
+      ret.stolen_out = stolen_out.load(std::memory_order_relaxed);
+      ret.depth = depth.load(std::memory_order_relaxed);
+      ret.high_water = high_water.load(std::memory_order_relaxed);
+      if(with_latency) {
+	for(auto & b : latency) {
+	  ret.latency.push_back(b.load(std::memory_order_relaxed));
+	}
+      }
+      return ret;
+    }
+
+  protected:
+    void setDepth(unsigned int new_depth) {
+      // release, so that a spinning subscriber that sees the new
+      // depth will find the message when it takes the lock.
+      depth.store(new_depth, std::memory_order_release);
+      // only the mailbox (holding its lock) writes the high water mark.
+      if(new_depth > high_water.load(std::memory_order_relaxed)) {
+	high_water.store(new_depth, std::memory_order_relaxed);
+      }
+    }
+
+    int subscriber;
+    std::atomic<unsigned long> enqueued;
+    std::atomic<unsigned long> dequeued;
+    std::atomic<unsigned long> dropped;
+    std::atomic<unsigned long> conflated;
+    std::atomic<unsigned long> decimated;
+    std::atomic<unsigned long> stolen_in;
+    std::atomic<unsigned long> stolen_out;
+    std::atomic<unsigned int> depth;
+    std::atomic<unsigned int> high_water;
+    std::atomic<unsigned long> latency[num_latency_buckets];
+  };
+}
@@ -0,0 +1,346 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "MailBox.hxx"
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file MergedReader.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::MergedReader MergedReader: reading several mailboxes in time order
+ *
+ * A thread that consumes several streams of time-tagged blocks
+ * usually needs to handle them in time order, not in the order the
+ * threads that made them happened to get around to it. Sorting by
+ * hand means buffering everything and then sorting it.
+ *
+ * A SoDa::MergedReader does a k-way merge instead. It holds at most
+ * one message from each subscription, the oldest one, in a heap.
+ * '''next''' hands back the message at the top of the heap and
+ * replaces it with the next one from the same mailbox.
+ *
+ * By default, messages are ordered by the time they were put. (The
+ * reader turns on SoDa::MailBox::stampMessages for each mailbox.)
+ * That order is exact. The reader notes the time before it looks in
+ * the mailboxes, and if one of them was empty, it only hands over a
+ * message stamped before then. Anything put in the empty mailbox
+ * after the reader looked has a later stamp.
+ *
+ * Messages can instead be ordered by a time tag of their own, the
+ * time of the first sample in a block, for instance. Pass
+ * '''setTimeTag''' a function that pulls it out of a message. Now a
+ * mailbox that is empty might still get a message with an older tag,
+ * so the reader waits for every mailbox to have something before it
+ * hands over the oldest message. It won't wait forever, though. A
+ * message that was put more than '''lookahead''' ago is handed over
+ * even if some mailbox is still empty. If an older message shows up
+ * after that, it is handed over as soon as it is seen, and counted in
+ * '''lateCount'''.
+ *
+ * \code
+ *   SoDa::MergedReader<Block> reader("blocks", std::chrono::milliseconds(20));
+ *   reader.setTimeTag([](const Block & b) { return b.first_sample_time; });
+ *   reader.add(rx_a, subs_a);
+ *   reader.add(rx_b, subs_b);
+ *   while(true) {
+ *     auto b = reader.next();
+ *     process(b);
+ *   }
+ * \endcode
+ */
+
+namespace SoDa {
+
+  /**
+   * @class MergedReader
+   * @brief Read from several MailBox subscriptions in time order.
+   *
+   * A reader is meant to be used by a single thread: the one that
+   * owns the subscriptions.
+   */
+  template<typename T>
+  class MergedReader : public NoCopy {
+  public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    typedef std::function<TimePoint(const T &)> TimeTag;
+
+    /**
+     * @brief constructor
+     * @param name the name of the reader
+     * @param lookahead when ordering by time tag, hand a message over
+     * once it is this old, even if some mailbox is still empty.
+     */
+    MergedReader(const std::string & name,
+		 const std::chrono::duration<long, std::micro> & lookahead = std::chrono::microseconds(0)) :
+      name(name), lookahead(lookahead), state(std::make_shared<State>()) {
+      last_key = TimePoint();
+      late_count = 0;
+    }
+
+    /**
+     * @brief Order messages by a tag of their own, rather than by
+     * the time they were put. Call this before the first call to next.
+     *
+     * @param tag returns the message's time tag
+     */
+    void setTimeTag(const TimeTag & tag) {
+      time_tag = tag;
+    }
+
+    /**
+     * @brief Read from a subscription.
+     *
+     * @param mailbox_p the mailbox. This turns on its message stamps.
+     * @param subs the subscription to that mailbox. The reader keeps
+     * a reference to it, so it must outlive the reader. Any ready
+     * callback already installed on the subscription (by a
+     * SoDa::MailBoxSelector, say) is kept.
+     * @returns the index that next will report for messages from this
+     * subscription.
+     */
+    unsigned int add(MailBoxPtr<T> mailbox_p, typename MailBox<T>::Subscription & subs) {
+      unsigned int idx = sources.size();
+      mailbox_p->stampMessages(true);
+      Source s;
+      s.mailbox_p = mailbox_p;
+      s.subs_p = &subs;
+      sources.push_back(s);
+      // next() sleeps on state, so a put on any source wakes it.
+      auto state_p = state;
+      mailbox_p->addReadyCallback(subs, [state_p]() { state_p->signal(); });
+      return idx;
+    }
+
+    /**
+     * @brief Get the oldest message from any of the subscriptions,
+     * waiting for one if necessary.
+     *
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns the oldest message, or nullptr if the timeout expired.
+     */
+    std::shared_ptr<T> next(const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      unsigned int source;
+      return next(source, timeout);
+    }
+
+    /**
+     * @brief Get the oldest message from any of the subscriptions,
+     * waiting for one if necessary.
+     *
+     * @param source set to the index (from add) of the subscription
+     * the message came from.
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns the oldest message, or nullptr if the timeout expired.
+     */
+    std::shared_ptr<T> next(unsigned int & source,
+			    const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      while(true) {
+	// Clear the flag before we look. Any mail that arrives after
+	// we've looked will set it again, and we won't sleep through it.
+	{
+	  std::lock_guard<std::mutex> lock(state->mtx);
+	  state->signaled = false;
+	}
+
+	// A put stamps its message under the mailbox lock, so anything
+	// stamped before the cutoff was there to be seen by fill.
+	auto cutoff = std::chrono::steady_clock::now();
+	unsigned int missing = fill();
+	auto now = std::chrono::steady_clock::now();
+	if(!heads.empty()) {
+	  bool ready = (missing == 0);
+	  if(!ready && time_tag) {
+	    ready = (heads.top().stamp + lookahead <= now);
+	  }
+	  else if(!ready) {
+	    // an empty mailbox might have been handed something older
+	    // after we looked. Look again.
+	    if(heads.top().stamp >= cutoff) continue;
+	    ready = true;
+	  }
+	  if(ready) return pop(source);
+	}
+	if((timeout.count() != 0) && (now >= deadline)) return nullptr;
+
+	// wait for mail, or for the oldest head to get old enough.
+	bool forever = (timeout.count() == 0);
+	auto wake = deadline;
+	if(!heads.empty()) {
+	  auto ripe = heads.top().stamp + lookahead;
+	  if(forever || (ripe < wake)) wake = ripe;
+	  forever = false;
+	}
+
+	std::unique_lock<std::mutex> lock(state->mtx);
+	auto signaled = [this]() { return state->signaled; };
+	if(forever) state->cv.wait(lock, signaled);
+	else state->cv.wait_until(lock, wake, signaled);
+      }
+    }
+
+    /**
+     * @brief How many messages has the reader taken from the
+     * mailboxes, but not yet handed over?
+     */
+    unsigned int pending() const { return heads.size(); }
+
+    /**
+     * @brief How many messages were handed over out of order,
+     * because they showed up after the lookahead had expired on a
+     * newer one? This is always zero unless setTimeTag was called.
+     */
+    unsigned long lateCount() const { return late_count; }
+
+    /**
+     * @brief how many subscriptions is the reader merging?
+     */
+    unsigned int size() const { return sources.size(); }
+
+    const std::string & getName() const { return name; }
+
+  protected:
+    struct Source {
+      MailBoxPtr<T> mailbox_p;
+      typename MailBox<T>::Subscription * subs_p;
+      /// true if this source has a message in the heap
+      bool held = false;
+    };
+
+    /**
+     * @brief The oldest unread message from one source.
+     */
+    struct Head {
+      /// what we sort on: the time tag, or the put stamp
+      TimePoint key;
+      /// when the message was put
+      TimePoint stamp;
+      unsigned int source;
+      std::shared_ptr<T> msg;
+
+      /// the heap keeps the greatest element on top, so turn it over.
+      bool operator<(const Head & other) const {
+	if(key != other.key) return key > other.key;
+	return source > other.source;
+      }
+    };
+
+    /**
+     * @brief The part of the reader that the mailboxes' ready
+     * callbacks can see.
+     */
+    struct State {
+      std::mutex mtx;
+      std::condition_variable cv;
+      /// set by a callback since the last time next looked
+      bool signaled = false;
+
+      void signal() {
+	std::lock_guard<std::mutex> lock(mtx);
+	signaled = true;
+	cv.notify_one();
+      }
+    };
+
+    /**
+     * @brief Take a message from each source that doesn't have one
+     * in the heap.
+     *
+     * @returns the number of sources that are still empty.
+     */
+    unsigned int fill() {
+      unsigned int missing = 0;
+      for(unsigned int i = 0; i < sources.size(); i++) {
+	auto & s = sources[i];
+	if(s.held) continue;
+	Head h;
+	h.msg = s.mailbox_p->get(*(s.subs_p), h.stamp);
+	if(h.msg == nullptr) {
+	  missing++;
+	  continue;
+	}
+	h.key = time_tag ? time_tag(*h.msg) : h.stamp;
+	h.source = i;
+	heads.push(h);
+	s.held = true;
+      }
+      return missing;
+    }
+
+    std::shared_ptr<T> pop(unsigned int & source) {
+      auto h = heads.top();
+      heads.pop();
+      sources[h.source].held = false;
+      if(h.key < last_key) late_count++;
+      else last_key = h.key;
+      source = h.source;
+      return h.msg;
+    }
+
+    std::string name;
+    std::chrono::microseconds lookahead;
+    std::shared_ptr<State> state;
+    std::vector<Source> sources;
+    std::priority_queue<Head> heads;
+    TimeTag time_tag;
+    /// the newest key handed over so far
+    TimePoint last_key;
+    unsigned long late_count;
+  };
+
+  template<typename T>
+  using MergedReaderPtr = std::shared_ptr<MergedReader<T>>;
+
+  /**
+   * @brief Make a merged reader and return a shared pointer to it.
+   *
+   * @param name the name of the reader
+   * @param lookahead see MergedReader::MergedReader
+   * @returns shared pointer to a MergedReader
+   */
+  template<typename T>
+  MergedReaderPtr<T> makeMergedReader(const std::string & name,
+				      const std::chrono::duration<long, std::micro> & lookahead = std::chrono::microseconds(0)) {
+    return std::make_shared<MergedReader<T>>(name, lookahead);
+  }
+}
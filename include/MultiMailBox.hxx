@@ -0,0 +1,632 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <new>
+#include <iterator>
+#include "MailBox.hxx"
+#include "Exception.hxx"
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file MultiMailBox.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::MultiMailBox MultiMailBox: one mailbox, many message types
+ *
+ * A SoDa::MailBox carries one type. A control channel with a dozen
+ * kinds of command would need a dozen mailboxes, a dozen
+ * subscriptions, and a dozen polls in every loop.
+ *
+ * A SoDa::MultiMailBox<Ts...> carries any of the types Ts. Each
+ * message is a SoDa::MultiMessage<Ts...>, a tagged union that holds
+ * its value inline, so a put doesn't allocate anything for it. (A
+ * large alternative is best sent as a std::shared_ptr.) The value is
+ * copied into each subscriber's queue.
+ *
+ * A reader handles a message with a visitor: anything that can be
+ * called with each of the types. SoDa::overloaded builds one out of
+ * lambdas. A visitor that misses a type won't compile.
+ *
+ * \code
+ *   struct Tune { double freq; };
+ *   struct Mode { int mode; };
+ *   struct Stop { };
+ *   SoDa::MultiMailBox<Tune, Mode, Stop> cmd("cmd");
+ *   auto subs = cmd.subscribe();
+ *   ...
+ *   cmd.put(Tune{ 144.2e6 });
+ *   ...
+ *   bool done = false;
+ *   auto handler = SoDa::overloaded([&](const Tune & t) { retune(t.freq); },
+ *                                   [&](const Mode & m) { setMode(m.mode); },
+ *                                   [&](const Stop &) { done = true; });
+ *   while(!done) cmd.waitDispatch(subs, handler);
+ * \endcode
+ *
+ * '''dispatch''' and '''waitDispatch''' hand one message to the
+ * visitor. '''dispatchAll''' hands over everything that is waiting,
+ * after one wakeup. The visitor runs without the mailbox lock, so it
+ * may put to the mailbox.
+ *
+ * A subscriber that only cares about some of the types can say so
+ * with '''subscribeTo<Us...>()'''. The others never reach its queue.
+ */
+
+namespace SoDa {
+
+  namespace MultiDetail {
+    /// the index of U in Ts, or sizeof...(Ts) if it isn't there
+    template<typename U, typename... Ts> struct IndexOf;
+    template<typename U>
+    struct IndexOf<U> {
+      static const unsigned int value = 0;
+    };
+    template<typename U, typename... Ts>
+    struct IndexOf<U, U, Ts...> {
+      static const unsigned int value = 0;
+    };
+    template<typename U, typename T, typename... Ts>
+    struct IndexOf<U, T, Ts...> {
+      static const unsigned int value = 1 + IndexOf<U, Ts...>::value;
+    };
+
+    template<typename... Ts> struct Largest;
+    template<>
+    struct Largest<> {
+      static const size_t size = 1;
+      static const size_t align = 1;
+    };
+    template<typename T, typename... Ts>
+    struct Largest<T, Ts...> {
+      static const size_t size = (sizeof(T) > Largest<Ts...>::size) ? sizeof(T) : Largest<Ts...>::size;
+      static const size_t align = (alignof(T) > Largest<Ts...>::align) ? alignof(T) : Largest<Ts...>::align;
+    };
+
+    template<typename... Ts> struct TypeList { };
+
+    /// one bit for each of the types Us, by their place in Ts
+    template<typename L, typename... Us> struct MaskOf;
+    template<typename... Ts>
+    struct MaskOf<TypeList<Ts...>> {
+      static const uint64_t value = 0;
+    };
+    template<typename... Ts, typename U, typename... Us>
+    struct MaskOf<TypeList<Ts...>, U, Us...> {
+      static_assert(IndexOf<U, Ts...>::value < sizeof...(Ts), "not one of the mailbox's types");
+      static const uint64_t value = (uint64_t(1) << IndexOf<U, Ts...>::value) | MaskOf<TypeList<Ts...>, Us...>::value;
+    };
+
+    template<typename T>
+    void destroy(void * p) { static_cast<T *>(p)->~T(); }
+    template<typename T>
+    void copy(void * dst, const void * src) { new (dst) T(*static_cast<const T *>(src)); }
+    template<typename T>
+    void move(void * dst, void * src) { new (dst) T(std::move(*static_cast<T *>(src))); }
+    template<typename T, typename V>
+    void visit(void * p, V & v) { v(*static_cast<T *>(p)); }
+  }
+
+  /**
+   * @class MultiMessage
+   * @brief A value of one of the types Ts, held inline.
+   */
+  template<typename... Ts>
+  class MultiMessage {
+    static_assert(sizeof...(Ts) > 0, "a MultiMessage needs at least one type");
+    static_assert(sizeof...(Ts) <= 64, "a MultiMessage can have at most 64 types");
+  public:
+    /**
+     * @brief The message didn't hold the type that was asked for.
+     */
+    class BadAccess : public SoDa::Exception {
+    public:
+      BadAccess() : SoDa::Exception("SoDa::MultiMessage asked for a type it doesn't hold") {
+      }
+    };
+
+    /// index() of a message that holds nothing
+    static const unsigned int npos = sizeof...(Ts);
+
+    /**
+     * @brief the position of U in Ts
+     */
+    template<typename U>
+    static constexpr unsigned int indexOf() {
+      return MultiDetail::IndexOf<typename std::decay<U>::type, Ts...>::value;
+    }
+
+    MultiMessage() : idx(npos) { }
+
+    template<typename U,
+	     typename = typename std::enable_if<(MultiDetail::IndexOf<typename std::decay<U>::type, Ts...>::value < sizeof...(Ts))>::type>
+    MultiMessage(U && v) : idx(npos) {
+      typedef typename std::decay<U>::type D;
+      new (&storage) D(std::forward<U>(v));
+      idx = indexOf<D>();
+    }
+
+    MultiMessage(const MultiMessage & other) : idx(npos) {
+      if(!other.empty()) {
+	copyTable()[other.idx](&storage, &other.storage);
+	idx = other.idx;
+      }
+    }
+
+    MultiMessage(MultiMessage && other) : idx(npos) {
+      if(!other.empty()) {
+	moveTable()[other.idx](&storage, &other.storage);
+	idx = other.idx;
+      }
+    }
+
+    ~MultiMessage() { reset(); }
+
+    MultiMessage & operator=(const MultiMessage & other) {
+      if(this != &other) {
+	reset();
+	if(!other.empty()) {
+	  copyTable()[other.idx](&storage, &other.storage);
+	  idx = other.idx;
+	}
+      }
+      return *this;
+    }
+
+    MultiMessage & operator=(MultiMessage && other) {
+      if(this != &other) {
+	reset();
+	if(!other.empty()) {
+	  moveTable()[other.idx](&storage, &other.storage);
+	  idx = other.idx;
+	}
+      }
+      return *this;
+    }
+
+    /**
+     * @brief which of the types is it? npos if it is empty.
+     */
+    unsigned int index() const { return idx; }
+
+    bool empty() const { return idx == npos; }
+
+    /**
+     * @brief does the message hold a U?
+     */
+    template<typename U>
+    bool is() const { return idx == indexOf<U>(); }
+
+    /**
+     * @brief the value, if it is a U
+     * @throws BadAccess if it isn't
+     */
+    template<typename U>
+    U & as() {
+      if(!is<U>()) throw BadAccess();
+      return *reinterpret_cast<U *>(&storage);
+    }
+
+    template<typename U>
+    const U & as() const {
+      if(!is<U>()) throw BadAccess();
+      return *reinterpret_cast<const U *>(&storage);
+    }
+
+    /**
+     * @brief Call the visitor with the value. Does nothing if the
+     * message is empty.
+     *
+     * @param v anything that can be called with a reference to each of Ts
+     */
+    template<typename V>
+    void visit(V && v) {
+      if(empty()) return;
+      typedef void (*VisitFn)(void *, V &);
+      static const VisitFn table[] = { &MultiDetail::visit<Ts, V>... };
+      table[idx](&storage, v);
+    }
+
+    /**
+     * @brief Destroy the value, leaving the message empty.
+     */
+    void reset() {
+      if(!empty()) {
+	destroyTable()[idx](&storage);
+	idx = npos;
+      }
+    }
+
+  protected:
+    typedef void (*DestroyFn)(void *);
+    typedef void (*CopyFn)(void *, const void *);
+    typedef void (*MoveFn)(void *, void *);
+
+    static const DestroyFn * destroyTable() {
+      static const DestroyFn table[] = { &MultiDetail::destroy<Ts>... };
+      return table;
+    }
+    static const CopyFn * copyTable() {
+      static const CopyFn table[] = { &MultiDetail::copy<Ts>... };
+      return table;
+    }
+    static const MoveFn * moveTable() {
+      static const MoveFn table[] = { &MultiDetail::move<Ts>... };
+      return table;
+    }
+
+    typename std::aligned_storage<MultiDetail::Largest<Ts...>::size,
+				  MultiDetail::Largest<Ts...>::align>::type storage;
+    unsigned int idx;
+  };
+
+  /**
+   * @brief A visitor made from a set of functions, each of which
+   * handles some of the types.
+   */
+  template<typename... Fs> struct Overloaded;
+
+  template<typename F>
+  struct Overloaded<F> : F {
+    Overloaded(F f) : F(std::move(f)) { }
+    using F::operator();
+  };
+
+  template<typename F, typename... Fs>
+  struct Overloaded<F, Fs...> : F, Overloaded<Fs...> {
+    Overloaded(F f, Fs... fs) : F(std::move(f)), Overloaded<Fs...>(std::move(fs)...) { }
+    using F::operator();
+    using Overloaded<Fs...>::operator();
+  };
+
+  /**
+   * @brief Build a visitor out of lambdas.
+   *
+   * @param fs one function (usually a lambda) per type, or group of types
+   * @returns an object that can be called with any of the types the
+   * functions can.
+   */
+  template<typename... Fs>
+  Overloaded<Fs...> overloaded(Fs... fs) {
+    return Overloaded<Fs...>(std::move(fs)...);
+  }
+
+  /**
+   * @class MultiMailBox<Ts...>
+   * @brief A mailbox whose messages can be any of several types.
+   *
+   * @tparam Ts the types a message may hold
+   */
+  template<typename... Ts>
+  class MultiMailBox : public MailBoxBase, NoCopy {
+  public:
+    typedef MultiMessage<Ts...> Message;
+
+    MultiMailBox(const std::string & name) : MailBoxBase(name) {
+      subscription_counter = 0;
+    }
+
+  protected:
+    class SubscriptionCl {
+    public:
+      SubscriptionCl(MultiMailBox<Ts...> * mbox, int idx) {
+	this_mbox = mbox;
+	subscriber_index = idx;
+      }
+
+      ~SubscriptionCl() {
+	this_mbox->unsubscribe(subscriber_index);
+      }
+
+      int getIndex(MultiMailBox<Ts...> * mbox) const {
+	if(mbox != this_mbox) {
+	  throw SubscriptionMismatch(mbox->getName(), this_mbox->getName());
+	}
+	else {
+	  return subscriber_index;
+	}
+      }
+      /// selects the message queue
+      int subscriber_index;
+      /// double check that we're referencing the right mailbox
+      MultiMailBox<Ts...> * this_mbox;
+    };
+
+  public:
+    typedef std::unique_ptr<SubscriptionCl> Subscription;
+
+    /**
+     * @brief Subscribe the caller to every type of message.
+     *
+     * @returns a smart pointer to a subscriber object.
+     */
+    Subscription subscribe() {
+      return addSubscriber(~uint64_t(0));
+    }
+
+    /**
+     * @brief Subscribe the caller to just some of the types.
+     *
+     * @tparam Us the types the subscriber wants
+     * @returns a smart pointer to a subscriber object.
+     */
+    template<typename... Us>
+    Subscription subscribeTo() {
+      return addSubscriber(MultiDetail::MaskOf<MultiDetail::TypeList<Ts...>, Us...>::value);
+    }
+
+    /**
+     * @brief Place a message in every interested subscriber's queue.
+     *
+     * @param msg the message. It must be one of the types Ts (or a
+     * MultiMessage). Each subscriber gets its own copy.
+     * @param subs If supplied, the message will *not* be enqueued to
+     * the sender's message queue.
+     */
+    template<typename U>
+    void put(U && msg, const Subscription & subs = nullptr) {
+      int omit_key = (subs == nullptr) ? -1 : subs->getIndex(this);
+      Message m(std::forward<U>(msg));
+      if(m.empty()) return;
+      uint64_t bit = uint64_t(1) << m.index();
+      std::lock_guard<std::mutex> lock(mtx);
+      for(auto & q : message_queues) {
+	auto & sq = q.second;
+	if((q.first == omit_key) || ((sq.mask & bit) == 0)) continue;
+	sq.mqueue.push_back(m);
+	if(sq.waiting) {
+	  sq.waiting = false;
+	  sq.cv.notify_one();
+	}
+      }
+    }
+
+    /**
+     * @brief Take the oldest message for this subscriber. This does
+     * not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param msg the message is moved here.
+     * @returns true if there was a message.
+     */
+    bool get(Subscription & subs, Message & msg) {
+      std::lock_guard<std::mutex> lock(mtx);
+      return pop(getSubscriber(subs), msg);
+    }
+
+    /**
+     * @brief Take the oldest message for this subscriber, waiting for
+     * one if there isn't any.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param msg the message is moved here.
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns true if there was a message, false if the timeout expired.
+     */
+    bool waitGet(Subscription & subs, Message & msg,
+		 const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      std::unique_lock<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs);
+      waitForMail(lock, sq, timeout);
+      return pop(sq, msg);
+    }
+
+    /**
+     * @brief Hand the oldest message to a visitor. This does not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param visitor called with the message. It runs without the
+     * mailbox lock.
+     * @returns true if there was a message.
+     */
+    template<typename V>
+    bool dispatch(Subscription & subs, V && visitor) {
+      Message m;
+      if(!get(subs, m)) return false;
+      m.visit(visitor);
+      return true;
+    }
+
+    /**
+     * @brief Hand the oldest message to a visitor, waiting for one if
+     * there isn't any.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param visitor called with the message. It runs without the
+     * mailbox lock.
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns true if there was a message, false if the timeout expired.
+     */
+    template<typename V>
+    bool waitDispatch(Subscription & subs, V && visitor,
+		      const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      Message m;
+      if(!waitGet(subs, m, timeout)) return false;
+      m.visit(visitor);
+      return true;
+    }
+
+    /**
+     * @brief Hand every waiting message, oldest first, to a visitor.
+     * The subscriber's queue is swapped out under the lock, and the
+     * visitor runs after it is released. This does not block. If the
+     * visitor throws, the messages it hadn't seen yet are put back at
+     * the front of the queue before the exception goes on.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param visitor called with each message.
+     * @returns the number of messages handled.
+     */
+    template<typename V>
+    unsigned int dispatchAll(Subscription & subs, V && visitor) {
+      std::deque<Message> taken;
+      {
+	std::lock_guard<std::mutex> lock(mtx);
+	taken.swap(getSubscriber(subs).mqueue);
+      }
+      unsigned int done = 0;
+      try {
+	for(auto & m : taken) {
+	  done++;
+	  m.visit(visitor);
+	}
+      }
+      catch (...) {
+	// the message that threw was handled; the rest go back in
+	// front of anything that arrived since.
+	std::lock_guard<std::mutex> lock(mtx);
+	auto sqi = message_queues.find(subs->getIndex(this));
+	if(sqi != message_queues.end()) {
+	  auto & q = sqi->second.mqueue;
+	  q.insert(q.begin(),
+		   std::make_move_iterator(taken.begin() + done),
+		   std::make_move_iterator(taken.end()));
+	}
+	throw;
+      }
+      return done;
+    }
+
+    /**
+     * Return the number of messages waiting for this subscriber
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @returns count of outstanding messages for this subscriber
+     */
+    unsigned int readyCount(Subscription & subs) {
+      std::lock_guard<std::mutex> lock(mtx);
+      return getSubscriber(subs).mqueue.size();
+    }
+
+    /**
+     * @brief Drop every message waiting for this subscriber.
+     *
+     * @param subs -- identifies the subscription we're clearing
+     */
+    void clear(Subscription & subs) {
+      std::lock_guard<std::mutex> lock(mtx);
+      getSubscriber(subs).mqueue.clear();
+    }
+
+    void unsubscribe(int subid) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if(message_queues.erase(subid) == 0) {
+	throw MissingSubscriber(getName(), "unsubscribe()", subid);
+      }
+    }
+
+    /**
+     * @brief how many subscribers are there?
+     */
+    unsigned int subscriberCount() {
+      std::lock_guard<std::mutex> lock(mtx);
+      return message_queues.size();
+    }
+
+  protected:
+    struct SubscriberQueue {
+      std::deque<Message> mqueue;
+      std::condition_variable cv;
+      /// one bit for each type the subscriber wants
+      uint64_t mask = ~uint64_t(0);
+      /// true while the subscriber is asleep in waitGet
+      bool waiting = false;
+    };
+
+    Subscription addSubscriber(uint64_t mask) {
+      std::lock_guard<std::mutex> lock(mtx);
+      int idx = subscription_counter++;
+      message_queues[idx].mask = mask;
+      return Subscription(new SubscriptionCl(this, idx));
+    }
+
+    SubscriberQueue & getSubscriber(Subscription & subs) {
+      int idx = subs->getIndex(this);
+      auto it = message_queues.find(idx);
+      if(it == message_queues.end()) {
+	throw MissingSubscriber(getName(), "get()", idx);
+      }
+      return it->second;
+    }
+
+    bool pop(SubscriberQueue & sq, Message & msg) {
+      if(sq.mqueue.empty()) return false;
+      msg = std::move(sq.mqueue.front());
+      sq.mqueue.pop_front();
+      return true;
+    }
+
+    void waitForMail(std::unique_lock<std::mutex> & lock, SubscriberQueue & sq,
+		     const std::chrono::duration<long, std::micro> & timeout) {
+      auto has_mail = [&sq]() { return !sq.mqueue.empty(); };
+      if(has_mail()) return;
+      sq.waiting = true;
+      if(timeout.count() == 0) {
+	sq.cv.wait(lock, has_mail);
+      }
+      else {
+	sq.cv.wait_for(lock, timeout, has_mail);
+      }
+      sq.waiting = false;
+    }
+
+    std::mutex mtx;
+    std::map<int, SubscriberQueue> message_queues;
+    int subscription_counter;
+  };
+
+  template<typename... Ts>
+  using MultiMailBoxPtr = std::shared_ptr<MultiMailBox<Ts...>>;
+
+  /**
+   * @brief Make a multi-type mailbox and return a shared pointer to it.
+   *
+   * @param mname Name of the mailbox.
+   * @returns shared pointer to a MultiMailBox object
+   */
+  template<typename... Ts>
+  MultiMailBoxPtr<Ts...> makeMultiMailBox(const std::string & mname) {
+    return std::make_shared<MultiMailBox<Ts...>>(mname);
+  }
+}
@@ -0,0 +1,416 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include "MailBox.hxx"
+#include "Exception.hxx"
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file Pipeline.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::Pipeline Pipeline: chains of worker threads
+ *
+ * Most radio code ends up as a chain: capture, then filter, then
+ * FFT, then a detector. Each link is a thread that subscribes to one
+ * mailbox, gets a message, works on it, and puts the result in the
+ * next mailbox. Writing that loop over and over gets old, and so does
+ * rewriting it when one of the links turns out to be too slow for a
+ * single thread.
+ *
+ * A SoDa::Stage is one link. It owns its worker threads. Give it an
+ * input mailbox, an output mailbox, and a function that turns an In
+ * into an Out:
+ *
+ * \code
+ *   SoDa::Pipeline pipe("rx");
+ *   pipe.add<Samples, Samples>("filter", capture_mb, filtered_mb, doFilter);
+ *   pipe.add<Samples, Spectrum>("fft", filtered_mb, spectrum_mb, doFFT, 4);
+ *   pipe.add<Spectrum, Detection>("detect", spectrum_mb, detect_mb, doDetect);
+ *   pipe.start();
+ *   ...
+ *   for(auto & s : pipe.stats()) {
+ *     std::cout << s.name << " " << s.utilization << "\n";
+ *   }
+ *   pipe.stop();
+ * \endcode
+ *
+ * The last argument to add is the number of replicas: worker threads
+ * that share the stage's work. They join a consumer group (see
+ * SoDa::MailBox) named for the stage, so each message is worked on
+ * by exactly one of them. With more than one replica, the results
+ * can come out in a different order than the inputs went in.
+ *
+ * Each worker takes everything that is waiting, up to the stage's
+ * batch size, in one getBatch, and puts its results with one
+ * putBatch. The messages are std::shared_ptrs, and they are moved
+ * from one mailbox to the next; the payload is never copied. If the
+ * function returns nullptr, nothing is put for that input. If it
+ * throws, nothing is put for that input either, and the stage counts
+ * the failure.
+ *
+ * An idle worker sleeps in waitGet until there is mail, or until
+ * stop interrupts it.
+ *
+ * If the input mailbox's overflow policy is EVICT, a worker that
+ * falls behind is cut off. It works on whatever it had already
+ * taken, and then quits; the stage counts it in '''stats''' as
+ * evicted. The other replicas carry on. Restart the stage (stop,
+ * then start) to put the worker back.
+ *
+ * '''stats''' reports how busy each stage has been: the fraction of
+ * its workers' time spent in the stage function, the number of
+ * messages it has handled, and how many are waiting for it. A stage
+ * whose utilization is near one, with a growing backlog, needs
+ * another replica.
+ */
+
+namespace SoDa {
+
+  /**
+   * @brief How busy has a stage been?
+   */
+  struct StageStats {
+    std::string name;
+    unsigned int replicas;
+    /// messages taken from the input mailbox
+    unsigned long processed;
+    /// messages put to the output mailbox
+    unsigned long produced;
+    /// messages waiting for the stage right now
+    unsigned long backlog;
+    /// messages for which the stage function threw an exception
+    unsigned long failed;
+    /// workers that quit because the input mailbox evicted them
+    unsigned long evicted;
+    /// fraction of the workers' time spent working, since start
+    double utilization;
+  };
+
+  /**
+   * @class StageBase
+   * @brief The part of a stage that doesn't care what it carries, so
+   * that a Pipeline can hold stages of any type.
+   */
+  class StageBase : public NoCopy {
+  public:
+    /**
+     * @brief Catch this when you don't care why the stage threw an exception
+     */
+    class Exception : public SoDa::Exception {
+    public:
+      Exception(const std::string & name, const std::string & problem) :
+	SoDa::Exception("SoDa::Stage[" + name + "] " + problem) {
+      }
+    };
+
+    /**
+     * @brief constructor
+     * @param name the name of the stage. It is also the name of the
+     * consumer group the workers join.
+     * @param replicas number of worker threads
+     * @param batch most messages a worker takes at one time
+     */
+    StageBase(const std::string & name, unsigned int replicas, unsigned int batch);
+
+    /**
+     * @brief The workers call into the derived class, so its
+     * destructor must call stop, not this one.
+     */
+    virtual ~StageBase() { }
+
+    /**
+     * @brief Subscribe and start the worker threads.
+     * @throws Exception if the stage is already running.
+     */
+    void start();
+
+    /**
+     * @brief Tell the workers to finish, and wait for them. Messages
+     * still waiting in the input mailbox are not processed. It is OK
+     * to call this on a stage that isn't running.
+     */
+    void stop();
+
+    /**
+     * @brief How busy has the stage been? This may be called from
+     * any thread, even while another is stopping the stage.
+     */
+    StageStats stats();
+
+    bool isRunning() const { return running.load(); }
+
+    const std::string & getName() const { return name; }
+
+  protected:
+    /// subscribe worker i to the input mailbox
+    virtual void subscribeWorker(unsigned int i) = 0;
+    /// run worker i until stopping is set
+    virtual void work(unsigned int i) = 0;
+    /// drop the workers' subscriptions
+    virtual void unsubscribeWorkers() = 0;
+    /// how many messages are waiting for the workers?
+    virtual unsigned long backlog() = 0;
+    /// interrupt the workers' waits so they see stopping
+    virtual void wakeWorkers() = 0;
+
+    /// count a batch, and the time it took
+    void recordBatch(unsigned long in, unsigned long out,
+		     const std::chrono::steady_clock::duration & busy);
+
+    std::string name;
+    unsigned int replicas;
+    unsigned int batch;
+    std::atomic<bool> stopping;
+    std::atomic<bool> running;
+    std::vector<std::thread> workers;
+    /// guards the subscriptions against stats while start and stop
+    /// change them
+    std::mutex mtx;
+
+    std::atomic<unsigned long> processed;
+    std::atomic<unsigned long> produced;
+    /// nanoseconds, summed over all the workers
+    std::atomic<unsigned long> busy_ns;
+    std::atomic<unsigned long> failed;
+    std::atomic<unsigned long> evicted;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point stop_time;
+  };
+
+  typedef std::shared_ptr<StageBase> StageBasePtr;
+
+  /**
+   * @class Stage
+   * @brief Worker threads that take In messages from one mailbox and
+   * put Out messages in another.
+   *
+   * @tparam In the input mailbox's message type
+   * @tparam Out the output mailbox's message type
+   */
+  template<typename In, typename Out>
+  class Stage : public StageBase {
+  public:
+    typedef std::function<std::shared_ptr<Out>(std::shared_ptr<In>)> Func;
+
+    /**
+     * @brief constructor
+     *
+     * @param name the name of the stage
+     * @param input take messages from this mailbox
+     * @param output put results in this mailbox
+     * @param func turns an In into an Out. Return nullptr to put nothing.
+     * With more than one replica, it is called from several threads at once.
+     * @param replicas number of worker threads
+     * @param batch most messages a worker takes at one time
+     */
+    Stage(const std::string & name,
+	  MailBoxPtr<In> input, MailBoxPtr<Out> output,
+	  const Func & func,
+	  unsigned int replicas = 1, unsigned int batch = 32) :
+      StageBase(name, replicas, batch),
+      input(input), output(output), func(func) {
+      subs.resize(replicas);
+    }
+
+    ~Stage() {
+      // the workers use our members, so stop them before those go away.
+      stop();
+    }
+
+  protected:
+    void subscribeWorker(unsigned int i) {
+      subs[i] = input->subscribeGroup(name);
+    }
+
+    void unsubscribeWorkers() {
+      for(auto & s : subs) s = nullptr;
+    }
+
+    unsigned long backlog() {
+      unsigned long ret = 0;
+      for(auto & s : subs) {
+	if(s == nullptr) continue;
+	try {
+	  ret += input->readyCount(s);
+	}
+	catch (MailBoxBase::SubscriberEvicted & e) {
+	  // an evicted worker has nothing waiting.
+	}
+      }
+      return ret;
+    }
+
+    void wakeWorkers() {
+      for(auto & s : subs) {
+	if(s != nullptr) input->interrupt(s);
+      }
+    }
+
+    void work(unsigned int i) {
+      auto & my_subs = subs[i];
+      std::vector<std::shared_ptr<In>> in;
+      std::vector<std::shared_ptr<Out>> out;
+      bool cut_off = false;
+      while(!stopping && !cut_off) {
+	std::shared_ptr<In> m;
+	try {
+	  // stop interrupts the wait.
+	  m = input->waitGet(my_subs);
+	}
+	catch (MailBoxBase::SubscriberEvicted & e) {
+	  evicted++;
+	  return;
+	}
+	if(m == nullptr) continue;
+	auto t0 = std::chrono::steady_clock::now();
+	in.clear();
+	in.push_back(std::move(m));
+	try {
+	  if(batch > 1) input->getBatch(my_subs, in, batch - 1);
+	}
+	catch (MailBoxBase::SubscriberEvicted & e) {
+	  // finish what we already took, then quit.
+	  evicted++;
+	  cut_off = true;
+	}
+	out.clear();
+	for(auto & msg : in) {
+	  std::shared_ptr<Out> r;
+	  try {
+	    r = func(std::move(msg));
+	  }
+	  catch (...) {
+	    // one bad message mustn't take the whole process down.
+	    failed++;
+	    continue;
+	  }
+	  if(r != nullptr) out.push_back(std::move(r));
+	}
+	if(!out.empty()) output->putBatch(out.begin(), out.end());
+	recordBatch(in.size(), out.size(), std::chrono::steady_clock::now() - t0);
+      }
+    }
+
+    MailBoxPtr<In> input;
+    MailBoxPtr<Out> output;
+    Func func;
+    std::vector<typename MailBox<In>::Subscription> subs;
+  };
+
+  /**
+   * @class Pipeline
+   * @brief A set of stages that start, stop, and report together.
+   */
+  class Pipeline : public NoCopy {
+  public:
+    /**
+     * @brief constructor
+     * @param name the name of the pipeline
+     */
+    Pipeline(const std::string & name);
+
+    /**
+     * @brief The destructor stops the stages.
+     */
+    ~Pipeline();
+
+    /**
+     * @brief Add a stage to the pipeline. If the pipeline is running,
+     * the stage is started.
+     *
+     * @param name the name of the stage
+     * @param input take messages from this mailbox
+     * @param output put results in this mailbox
+     * @param func turns an In into an Out. Return nullptr to put nothing.
+     * @param replicas number of worker threads
+     * @param batch most messages a worker takes at one time
+     * @returns the stage
+     */
+    template<typename In, typename Out>
+    std::shared_ptr<Stage<In, Out>> add(const std::string & name,
+					MailBoxPtr<In> input, MailBoxPtr<Out> output,
+					const typename Stage<In, Out>::Func & func,
+					unsigned int replicas = 1, unsigned int batch = 32) {
+      auto ret = std::make_shared<Stage<In, Out>>(name, input, output, func, replicas, batch);
+      add(ret);
+      return ret;
+    }
+
+    /**
+     * @brief Add a stage that was built elsewhere.
+     */
+    void add(StageBasePtr stage);
+
+    /**
+     * @brief Start every stage, last one first, so that nothing is
+     * put before its consumers have subscribed.
+     */
+    void start();
+
+    /**
+     * @brief Stop every stage, first one first.
+     */
+    void stop();
+
+    /**
+     * @brief How busy has each stage been?
+     * @returns one StageStats per stage, in the order they were added.
+     */
+    std::vector<StageStats> stats();
+
+    const std::string & getName() const { return name; }
+
+  protected:
+    std::string name;
+    std::vector<StageBasePtr> stages;
+    bool running;
+  };
+
+  typedef std::shared_ptr<Pipeline> PipelinePtr;
+
+  /**
+   * @brief Make a pipeline and return a shared pointer to it.
+   *
+   * @param name the name of the pipeline
+   * @returns shared pointer to a Pipeline
+   */
+  PipelinePtr makePipeline(const std::string & name);
+}
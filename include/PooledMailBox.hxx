@@ -0,0 +1,638 @@
+#pragma once
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+#include "MailBox.hxx"
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file PooledMailBox.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::PooledMailBox PooledMailBox: recycled messages with intrusive reference counts
+ *
+ * Back in the SoDaRadio days, mailboxes came with a buffer allocator
+ * that recycled message objects. The MailBox page explains why that
+ * went away: for big messages like a large std::vector, allocating a
+ * fresh one was just as quick. For small, frequent messages it's a
+ * different story. Every std::make_shared is a trip through malloc,
+ * and every copy of the std::shared_ptr into a subscriber queue is an
+ * atomic increment.
+ *
+ * SoDa::PooledMailBox brings recycling back, for the cases where it
+ * pays. Messages are created with the mailbox's '''make''' method,
+ * which takes a block from a pool that belongs to the mailbox and
+ * constructs the message in place. The pool grows a slab at a time
+ * when it runs dry, and never gives the memory back until the mailbox
+ * goes away. Once the pool is big enough for the traffic, make and
+ * release never call malloc or free.
+ *
+ * The message handle is a SoDa::PooledPtr. It acts like a
+ * std::shared_ptr, but the reference count lives in the pool block
+ * alongside the message. A put that is handed its message with
+ * std::move bumps the count once for all of the subscribers,
+ * rather than once per subscriber, and a get moves the handle out of
+ * the queue without touching the count at all. When the last handle
+ * lets go, the message is destroyed and its block goes back on the
+ * pool's free list.
+ *
+ * The free list is a lock-free stack. Each block is named by an index
+ * rather than a pointer, and the top of the stack carries a tag that
+ * changes on every push and pop, so the stack can't be fooled by a
+ * block that was popped and pushed back while another thread was
+ * looking at it.
+ *
+ * Handles may outlive the mailbox. The pool sticks around until the
+ * last block comes home.
+ *
+ * Apart from the message type, PooledMailBox looks like SoDa::MailBox:
+ * subscribe, put, get, waitGet, readyCount, and so on.
+ */
+
+namespace SoDa {
+
+  template<typename T> class MessagePool;
+
+  /**
+   * @class PooledPtr<T>
+   * @brief A reference counted handle to a message that lives in a
+   * SoDa::MessagePool.
+   */
+  template<typename T>
+  class PooledPtr {
+  public:
+    PooledPtr() : blk(nullptr) { }
+    PooledPtr(std::nullptr_t) : blk(nullptr) { }
+
+    PooledPtr(const PooledPtr & other) : blk(other.blk) {
+      if(blk != nullptr) blk->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    PooledPtr(PooledPtr && other) : blk(other.blk) {
+      other.blk = nullptr;
+    }
+
+    ~PooledPtr() { reset(); }
+
+    PooledPtr & operator=(const PooledPtr & other) {
+      if(other.blk != nullptr) other.blk->refs.fetch_add(1, std::memory_order_relaxed);
+      reset();
+      blk = other.blk;
+      return *this;
+    }
+
+    PooledPtr & operator=(PooledPtr && other) {
+      if(this != &other) {
+	reset();
+	blk = other.blk;
+	other.blk = nullptr;
+      }
+      return *this;
+    }
+
+    PooledPtr & operator=(std::nullptr_t) {
+      reset();
+      return *this;
+    }
+
+    /**
+     * @brief let go of the message. If this was the last handle, the
+     * message is destroyed and its block is recycled.
+     */
+    void reset() {
+      if(blk != nullptr) {
+	if(blk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+	  blk->pool->recycle(blk);
+	}
+	blk = nullptr;
+      }
+    }
+
+    T * get() const { return (blk == nullptr) ? nullptr : blk->object(); }
+    T & operator*() const { return *(blk->object()); }
+    T * operator->() const { return blk->object(); }
+    explicit operator bool() const { return blk != nullptr; }
+
+    /**
+     * @brief how many handles refer to this message?
+     */
+    unsigned int useCount() const {
+      return (blk == nullptr) ? 0 : blk->refs.load(std::memory_order_relaxed);
+    }
+
+    bool operator==(const PooledPtr & other) const { return blk == other.blk; }
+    bool operator!=(const PooledPtr & other) const { return blk != other.blk; }
+    bool operator==(std::nullptr_t) const { return blk == nullptr; }
+    bool operator!=(std::nullptr_t) const { return blk != nullptr; }
+
+  protected:
+    friend class MessagePool<T>;
+    template<typename U> friend class PooledMailBox;
+
+    typedef typename MessagePool<T>::Block Block;
+
+    /// take over a reference that has already been counted
+    explicit PooledPtr(Block * b) : blk(b) { }
+
+    Block * blk;
+  };
+
+  /**
+   * @class MessagePool<T>
+   * @brief A slab allocator for messages of type T, with a lock-free free list.
+   *
+   * The pool is created by a SoDa::PooledMailBox. It deletes itself
+   * once its owner has retired it and every block has been returned.
+   */
+  template<typename T>
+  class MessagePool : public NoCopy {
+  public:
+    /**
+     * @brief The pool has grown as large as it can.
+     */
+    class Exhausted : public SoDa::Exception {
+    public:
+      Exhausted(unsigned long blocks) :
+	SoDa::Exception(SoDa::Format("SoDa::MessagePool ran out of room after %0 blocks.")
+			.addU(blocks).str()) {
+      }
+    };
+
+    /**
+     * @brief constructor
+     * @param slab_size the pool grows by this many blocks at a time.
+     */
+    MessagePool(unsigned int slab_size) : slab_size(slab_size) {
+      for(unsigned int i = 0; i < max_slabs; i++) slabs[i] = nullptr;
+      num_slabs.store(0);
+      free_top.store(0);
+      // the owner holds one reference
+      outstanding.store(1);
+    }
+
+    ~MessagePool() {
+      unsigned int ns = num_slabs.load();
+      for(unsigned int i = 0; i < ns; i++) delete[] slabs[i];
+    }
+
+    /**
+     * @brief construct a message in a block from the pool.
+     */
+    template<typename... Args>
+    PooledPtr<T> make(Args&&... args) {
+      Block * b = pop();
+      outstanding.fetch_add(1, std::memory_order_relaxed);
+      try {
+	new (&(b->storage)) T(std::forward<Args>(args)...);
+      }
+      catch (...) {
+	push(b);
+	outstanding.fetch_sub(1, std::memory_order_relaxed);
+	throw;
+      }
+      b->refs.store(1, std::memory_order_relaxed);
+      return PooledPtr<T>(b);
+    }
+
+    /**
+     * @brief The owner is done with the pool. It will go away when
+     * the last outstanding message is recycled.
+     */
+    void retire() {
+      if(outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    /**
+     * @brief how many blocks has the pool allocated?
+     */
+    unsigned long capacity() const {
+      return (unsigned long) num_slabs.load() * slab_size;
+    }
+
+  protected:
+    friend class PooledPtr<T>;
+
+    struct Block {
+      std::atomic<unsigned int> refs;
+      /// index+1 of the next block on the free list, 0 at the bottom
+      std::atomic<uint32_t> next_free;
+      MessagePool<T> * pool;
+      uint32_t index;
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+      T * object() { return reinterpret_cast<T*>(&storage); }
+    };
+
+    /**
+     * @brief the last handle let go -- destroy the message and put
+     * the block back on the free list.
+     */
+    void recycle(Block * b) {
+      b->object()->~T();
+      push(b);
+      if(outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    Block * blockAt(uint32_t idx) {
+      return &(slabs[idx / slab_size][idx % slab_size]);
+    }
+
+    // The top of the free list is (tag << 32) | (index + 1).
+    static uint64_t packTop(uint64_t old_top, uint32_t idx_plus_one) {
+      return (((old_top >> 32) + 1) << 32) | idx_plus_one;
+    }
+
+    Block * pop() {
+      while(true) {
+	uint64_t top = free_top.load(std::memory_order_acquire);
+	uint32_t ip1 = uint32_t(top & 0xffffffff);
+	if(ip1 == 0) {
+	  grow(top);
+	  continue;
+	}
+	Block * b = blockAt(ip1 - 1);
+	uint64_t new_top = packTop(top, b->next_free.load(std::memory_order_relaxed));
+	if(free_top.compare_exchange_weak(top, new_top, std::memory_order_acq_rel)) {
+	  return b;
+	}
+      }
+    }
+
+    void push(Block * b) {
+      pushChain(b, b);
+    }
+
+    /// push a chain of blocks, already linked from first to last.
+    void pushChain(Block * first, Block * last) {
+      uint64_t top = free_top.load(std::memory_order_relaxed);
+      while(true) {
+	last->next_free.store(uint32_t(top & 0xffffffff), std::memory_order_relaxed);
+	uint64_t new_top = packTop(top, first->index + 1);
+	if(free_top.compare_exchange_weak(top, new_top, std::memory_order_acq_rel)) {
+	  return;
+	}
+      }
+    }
+
+    /**
+     * @brief add a slab to the pool, unless someone beat us to it.
+     * @param seen_top the empty free list top that sent us here.
+     */
+    void grow(uint64_t seen_top) {
+      std::lock_guard<std::mutex> lock(grow_mtx);
+      // did someone else refill the list while we waited for the lock?
+      if(free_top.load(std::memory_order_acquire) != seen_top) return;
+
+      unsigned int ns = num_slabs.load();
+      if(ns == max_slabs) {
+	throw Exhausted(capacity());
+      }
+      Block * slab = new Block[slab_size];
+      for(unsigned int i = 0; i < slab_size; i++) {
+	slab[i].pool = this;
+	slab[i].index = ns * slab_size + i;
+	slab[i].refs.store(0, std::memory_order_relaxed);
+	slab[i].next_free.store(slab[i].index + 2, std::memory_order_relaxed);
+      }
+      slabs[ns] = slab;
+      num_slabs.store(ns + 1, std::memory_order_release);
+      pushChain(&slab[0], &slab[slab_size - 1]);
+    }
+
+    static const unsigned int max_slabs = 4096;
+    unsigned int slab_size;
+    Block * slabs[max_slabs];
+    std::atomic<unsigned int> num_slabs;
+
+    std::atomic<uint64_t> free_top;
+    /// live messages, plus one for the owner
+    std::atomic<long> outstanding;
+    std::mutex grow_mtx;
+  };
+
+  /**
+   * @class PooledMailBox<T>
+   * @brief Accept messages from the mailbox's own pool and distribute
+   * them to multiple subscribers.
+   *
+   * @tparam T Type of message that will be found in this mailbox
+   */
+  template<typename T>
+  class PooledMailBox : public MailBoxBase, NoCopy {
+  public:
+    typedef PooledPtr<T> MsgPtr;
+
+    /**
+     * @brief Create a mailbox.
+     *
+     * @param name the name of the mailbox
+     * @param slab_size the message pool grows by this many messages
+     * at a time.
+     */
+    PooledMailBox(std::string name, unsigned int slab_size = 256) :
+      MailBoxBase(name) {
+      pool = new MessagePool<T>(slab_size);
+      subscription_counter = 0;
+    }
+
+    ~PooledMailBox() {
+      message_queues.clear();
+      pool->retire();
+    }
+
+  protected:
+    class SubscriptionCl {
+    public:
+      SubscriptionCl(PooledMailBox<T> * mbox, int idx) {
+	this_mbox = mbox;
+	subscriber_index = idx;
+      }
+
+      ~SubscriptionCl() {
+	this_mbox->unsubscribe(subscriber_index);
+      }
+
+      int getIndex(PooledMailBox<T> * mbox) const {
+	if(mbox != this_mbox) {
+	  throw SubscriptionMismatch(mbox->getName(), this_mbox->getName());
+	}
+	else {
+	  return subscriber_index;
+	}
+      }
+      /// selects the message queue
+      int subscriber_index;
+      /// double check that we're referencing the right mailbox
+      PooledMailBox<T> * this_mbox;
+    };
+
+  public:
+    typedef std::unique_ptr<SubscriptionCl> Subscription;
+
+    /**
+     * @brief Create a message from the mailbox's pool.
+     *
+     * @param args passed along to T's constructor
+     * @returns a handle to the new message
+     */
+    template<typename... Args>
+    MsgPtr make(Args&&... args) {
+      return pool->make(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Subscribe the caller to a mailbox.
+     *
+     * @returns a smart pointer to a subscriber object.
+     */
+    Subscription subscribe() {
+      std::lock_guard<std::mutex> lock(mtx);
+      Subscription ret(new SubscriptionCl(this, subscription_counter));
+      message_queues[subscription_counter];
+      subscription_counter++;
+      return ret;
+    }
+
+    /**
+     * Get a message out of the mailbox for this subscriber. This does
+     * not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @returns The oldest message in the subscriber's mailbox, or a null
+     * handle if there isn't one.
+     */
+    MsgPtr get(Subscription & subs) {
+      std::lock_guard<std::mutex> lock(mtx);
+      return getSubscriber(subs).pop();
+    }
+
+    /**
+     * @brief Get a message out of the mailbox for this subscriber,
+     * waiting for one to arrive if the mailbox is empty.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns The oldest message in the subscriber's mailbox, or a null handle
+     * if the timeout expired before a message arrived.
+     */
+    MsgPtr waitGet(Subscription & subs,
+		   const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      std::unique_lock<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs);
+      auto ready = [&sq]() { return sq.count != 0; };
+      if(!ready()) {
+	sq.waiting = true;
+	if(timeout.count() == 0) {
+	  sq.cv.wait(lock, ready);
+	}
+	else {
+	  sq.cv.wait_for(lock, timeout, ready);
+	}
+	sq.waiting = false;
+      }
+      return sq.pop();
+    }
+
+    /**
+     * @brief Place a message in every subscriber's mailbox
+     *
+     * The message's reference count is bumped once for all of the
+     * subscribers. Hand the message over with std::move and put won't
+     * have to touch the count again when msg goes out of scope.
+     *
+     * @param msg The message to be sent to every subscriber.
+     * @param subs If supplied, messages will *not* be enqueued to the sender's
+     * message queue.
+     */
+    void put(MsgPtr msg, const Subscription & subs = nullptr) {
+      if(msg.blk == nullptr) return;
+      std::lock_guard<std::mutex> lock(mtx);
+      int omit_key = subscription_counter;
+      if(subs != nullptr) {
+	omit_key = subs->getIndex(this);
+      }
+
+      unsigned int n = message_queues.size();
+      if(message_queues.count(omit_key) != 0) n--;
+      if(n == 0) return;
+
+      // msg's own reference goes to the first subscriber, so we need
+      // n - 1 more.
+      if(n > 1) msg.blk->refs.fetch_add(n - 1, std::memory_order_relaxed);
+      auto blk = msg.blk;
+      msg.blk = nullptr;
+      for(auto & q : message_queues) {
+	if(q.first != omit_key) {
+	  auto & sq = q.second;
+	  sq.push(MsgPtr(blk));
+	  if(sq.waiting) sq.cv.notify_one();
+	}
+      }
+    }
+
+    /**
+     * Return the number of messages in the queue for this subscriber.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     *
+     * @returns count of outstanding messages for this subscriber
+     */
+    unsigned int readyCount(Subscription & subs) {
+      std::lock_guard<std::mutex> lock(mtx);
+      return getSubscriber(subs).count;
+    }
+
+    /**
+     * Return the smallest number of waiting messages in
+     * the queue for all subscribers
+     *
+     * @returns count of outstanding messages in the shortest
+     * subscriber queue.
+     */
+    unsigned int minReadyCount() {
+      std::lock_guard<std::mutex> lock(mtx);
+      unsigned int ret = ~0;
+      for(auto & q : message_queues) {
+	unsigned int qs = q.second.count;
+	ret = (ret < qs) ? ret : qs;
+      }
+      return ret;
+    }
+
+    /**
+     * @brief Empty the subscriber's mailbox
+     *
+     * @param subs -- identifies the subscription we're clearing
+     */
+    void clear(Subscription & subs) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto & sq = getSubscriber(subs);
+      while(sq.count != 0) sq.pop();
+    }
+
+    void unsubscribe(int subid) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if(message_queues.erase(subid) == 0) {
+	throw MissingSubscriber(getName(), "unsubscribe()", subid);
+      }
+    }
+
+    unsigned int subscriberCount() {
+      std::lock_guard<std::mutex> lock(mtx);
+      return message_queues.size();
+    }
+
+    /**
+     * @brief How many messages can the pool hold before it has to grow?
+     */
+    unsigned long poolCapacity() const {
+      return pool->capacity();
+    }
+
+  protected:
+    /**
+     * @brief Each subscriber's queue is a circular buffer that grows
+     * when it must, and never shrinks. So in the steady state a push
+     * or pop doesn't allocate anything.
+     */
+    struct SubscriberQueue {
+      std::vector<MsgPtr> buf;
+      unsigned int head = 0;
+      unsigned int count = 0;
+      bool waiting = false;
+      std::condition_variable cv;
+
+      void push(MsgPtr && m) {
+	if(count == buf.size()) {
+	  std::vector<MsgPtr> nbuf((buf.size() == 0) ? 16 : (2 * buf.size()));
+	  for(unsigned int i = 0; i < count; i++) {
+	    nbuf[i] = std::move(buf[(head + i) % buf.size()]);
+	  }
+	  buf.swap(nbuf);
+	  head = 0;
+	}
+	buf[(head + count) % buf.size()] = std::move(m);
+	count++;
+      }
+
+      MsgPtr pop() {
+	if(count == 0) return MsgPtr();
+	MsgPtr ret = std::move(buf[head]);
+	head = (head + 1) % buf.size();
+	count--;
+	return ret;
+      }
+    };
+
+    SubscriberQueue & getSubscriber(Subscription & subs) {
+      int idx = subs->getIndex(this);
+      auto it = message_queues.find(idx);
+      if(it == message_queues.end()) {
+	throw MissingSubscriber(getName(), "get()", idx);
+      }
+      return it->second;
+    }
+
+    std::map<int, SubscriberQueue> message_queues;
+    int subscription_counter;
+
+    MessagePool<T> * pool;
+
+    std::mutex mtx;
+  };
+
+  /**
+   * @brief Make a pooled mailbox and return a shared pointer to it.
+   *
+   * @param mname Name of the mailbox.
+   * @param slab_size the message pool grows by this many messages at a time.
+   * @returns shared pointer to a PooledMailBox object
+   */
+  template<typename T>
+  std::shared_ptr<PooledMailBox<T>> makePooledMailBox(const std::string & mname,
+						       unsigned int slab_size = 256) {
+    return std::make_shared<PooledMailBox<T>>(mname, slab_size);
+  }
+
+  template<typename T>
+  using PooledMailBoxPtr = std::shared_ptr<PooledMailBox<T>>;
+}
@@ -0,0 +1,888 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <functional>
+#include "MailBox.hxx"
+#include "Format.hxx"
+#include "NoCopy.hxx"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <climits>
+#include <cerrno>
+#endif
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file SharedMailBox.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::SharedMailBox SharedMailBox: mailboxes between processes
+ *
+ * Splitting a radio into several processes keeps a crash in one part
+ * from taking down the rest. But then the messages have to get from
+ * one process to another, and pushing them through a socket means
+ * serializing every one, and copying it twice.
+ *
+ * A SoDa::SharedMailBox lives in a POSIX shared memory segment that
+ * every process on the box can map. Inside is the same sort of ring
+ * that SoDa::BroadcastMailBox uses: one ring of slots, a claim
+ * counter, and one cursor per subscriber. A put copies the message
+ * into a slot once, and every subscriber in every process reads it
+ * from there. A subscriber asleep in waitGet sleeps on a futex in the
+ * segment, so a put in one process wakes a reader in another.
+ *
+ * Because the messages themselves live in the segment, T must be
+ * trivially copyable: no pointers, no std::string, no std::vector.
+ * For raw bytes, use SoDa::ShmBytes<N>, which holds up to N bytes and
+ * a length.
+ *
+ * \code
+ *   // in every process
+ *   SoDa::SharedMailBox<Tuning> tune("radio.tune", 256, 16);
+ *   auto subs = tune.subscribe();
+ *   ...
+ *   Tuning t;
+ *   if(tune.waitGet(subs, t, std::chrono::milliseconds(100))) retune(t);
+ *   ...
+ *   tune.put(Tuning{ 144.2e6, 0 });
+ * \endcode
+ *
+ * The first process to open a name creates the segment, and sets the
+ * ring size and subscriber limit. Everyone after that must ask for a
+ * mailbox of the same message size, or the constructor throws
+ * SharedMailBox::Mismatch. The segment outlives the processes that use
+ * it; call '''SharedMailBox::remove(name)''' to get rid of it.
+ *
+ * A subscriber that stops reading stalls the producers when the ring
+ * fills, as with SoDa::BroadcastMailBox. But a subscriber whose
+ * process has died can't catch up, so a producer that is stuck
+ * checks whether each cursor's owner is still alive, and frees the
+ * cursors of the ones that aren't.
+ *
+ * A producer can die too, after it has claimed a slot and before it
+ * has published its message. Each put records its process and the
+ * sequence number it claimed in a table in the segment. A subscriber
+ * that has been stuck on an unpublished slot for a while looks for
+ * the slot's claim there. If the process that holds it is gone, the
+ * slot is marked skipped, and every subscriber steps over it. A
+ * subscriber asleep in waitGet notices when the next message
+ * arrives. The table has max_subscribers entries, so that many puts
+ * can be under way at once; any more wait their turn.
+ *
+ * Like the rest of the library, the get and put that take a
+ * std::shared_ptr<T> are here too, so code written for
+ * SoDa::MailBox can use a SharedMailBox without much change. They
+ * copy the message in or out of the segment. '''read''' hands a
+ * callback a reference to the message in the slot, with no copy at
+ * all.
+ *
+ * SharedMailBox only works on Linux.
+ */
+
+namespace SoDa {
+
+  /**
+   * @brief A byte payload for a SharedMailBox.
+   *
+   * @tparam N the most bytes it can hold
+   */
+  template<unsigned int N>
+  struct ShmBytes {
+    uint32_t len;
+    unsigned char data[N];
+
+    /**
+     * @brief copy bytes in
+     * @returns the number of bytes copied; no more than N.
+     */
+    unsigned int assign(const void * src, unsigned int count) {
+      len = (count < N) ? count : N;
+      std::memcpy(data, src, len);
+      return len;
+    }
+  };
+
+#ifdef __linux__
+  /**
+   * @class SharedMailBox<T>
+   * @brief A broadcast mailbox in shared memory, usable from several
+   * processes at once.
+   *
+   * @tparam T Type of message that will be found in this mailbox. It
+   * must be trivially copyable.
+   */
+  template<typename T>
+  class SharedMailBox : public MailBoxBase, NoCopy {
+    static_assert(std::is_trivially_copyable<T>::value,
+		  "SharedMailBox messages must be trivially copyable");
+  public:
+    /**
+     * @brief The segment exists, but it was made for a different kind
+     * of mailbox.
+     */
+    class Mismatch : public Exception {
+    public:
+      Mismatch(const std::string & name, const std::string & problem) :
+	Exception(name, "shared segment " + problem) {
+      }
+    };
+
+    /**
+     * @brief Something went wrong creating or mapping the segment.
+     */
+    class SystemError : public Exception {
+    public:
+      SystemError(const std::string & name, const std::string & call, int err) :
+	Exception(name, call + " failed: " + std::string(strerror(err))) {
+      }
+    };
+
+    /**
+     * @brief The mailbox already has max_subscribers subscribers.
+     */
+    class TooManySubscribers : public Exception {
+    public:
+      TooManySubscribers(const std::string & name, unsigned int max_subs) :
+	Exception(name, SoDa::Format("::subscribe() limit of %0 subscribers exceeded.")
+		  .addU(max_subs).str()) {
+      }
+    };
+
+    /**
+     * @brief Open a shared mailbox, creating it if this is the first
+     * process to ask for it.
+     *
+     * @param name the name of the mailbox. Every process that uses
+     * the same name gets the same mailbox. It may not contain a '/'.
+     * @param ring_size the ring will hold at least this many messages.
+     * The actual size is rounded up to a power of two. Ignored if the
+     * mailbox already exists.
+     * @param max_subscribers the mailbox can have at most this many
+     * subscribers, over all processes. Ignored if the mailbox already exists.
+     * @throws Mismatch if the existing segment holds a different size
+     * of message.
+     * @throws SystemError if the segment can't be created or mapped.
+     */
+    SharedMailBox(const std::string & name,
+		  unsigned int ring_size = 1024,
+		  unsigned int max_subscribers = 64) : MailBoxBase(name) {
+      unsigned long sz = 2;
+      while(sz < ring_size) sz = sz << 1;
+      if(max_subscribers == 0) max_subscribers = 1;
+
+      std::string path = shmName(name);
+      bool creator = true;
+      int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+      if((fd < 0) && (errno == EEXIST)) {
+	creator = false;
+	fd = shm_open(path.c_str(), O_RDWR, 0600);
+      }
+      if(fd < 0) throw SystemError(name, "shm_open", errno);
+
+      if(creator) {
+	map_size = segmentSize(sz, max_subscribers);
+	if(ftruncate(fd, map_size) < 0) {
+	  int err = errno;
+	  close(fd);
+	  shm_unlink(path.c_str());
+	  throw SystemError(name, "ftruncate", err);
+	}
+      }
+      else {
+	// the creator may not have set the size yet.
+	struct stat st;
+	for(int i = 0; ; i++) {
+	  if(fstat(fd, &st) < 0) {
+	    int err = errno;
+	    close(fd);
+	    throw SystemError(name, "fstat", err);
+	  }
+	  if(st.st_size >= off_t(sizeof(Header))) break;
+	  if(i > 10000) {
+	    close(fd);
+	    throw Mismatch(name, "was never initialized");
+	  }
+	  std::this_thread::yield();
+	}
+	map_size = st.st_size;
+      }
+
+      void * p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      int err = errno;
+      close(fd);
+      if(p == MAP_FAILED) throw SystemError(name, "mmap", err);
+      base = static_cast<char *>(p);
+      header = reinterpret_cast<Header *>(base);
+
+      if(creator) {
+	initialize(sz, max_subscribers);
+      }
+      else {
+	for(int i = 0; header->ready.load(std::memory_order_acquire) == 0; i++) {
+	  if(i > 10000) {
+	    munmap(base, map_size);
+	    throw Mismatch(name, "was never initialized");
+	  }
+	  std::this_thread::yield();
+	}
+	if((header->magic != magic_number) || (header->msg_size != sizeof(T)) ||
+	   (map_size < segmentSize(header->ring_size, header->max_subscribers))) {
+	  munmap(base, map_size);
+	  throw Mismatch(name, "holds a different kind of message");
+	}
+      }
+      mask = header->ring_size - 1;
+      cursors = reinterpret_cast<Cursor *>(base + cursorOffset());
+      claims = reinterpret_cast<ClaimEntry *>(base + claimOffset(header->max_subscribers));
+      slots = reinterpret_cast<Slot *>(base + slotOffset(header->max_subscribers));
+    }
+
+    ~SharedMailBox() {
+      munmap(base, map_size);
+    }
+
+    /**
+     * @brief Remove a shared mailbox's name. Processes that have it
+     * open can keep using it; the memory goes away when the last one
+     * lets go.
+     *
+     * @param name the name of the mailbox
+     * @returns true if there was such a mailbox.
+     */
+    static bool remove(const std::string & name) {
+      return shm_unlink(shmName(name).c_str()) == 0;
+    }
+
+  protected:
+    class SubscriptionCl {
+    public:
+      SubscriptionCl(SharedMailBox<T> * mbox, int idx) {
+	this_mbox = mbox;
+	subscriber_index = idx;
+	stall_seq = ~0UL;
+      }
+
+      ~SubscriptionCl() {
+	this_mbox->unsubscribe(subscriber_index);
+      }
+
+      int getIndex(SharedMailBox<T> * mbox) const {
+	if(mbox != this_mbox) {
+	  throw SubscriptionMismatch(mbox->getName(), this_mbox->getName());
+	}
+	else {
+	  return subscriber_index;
+	}
+      }
+      /// selects the cursor
+      int subscriber_index;
+      /// double check that we're referencing the right mailbox
+      SharedMailBox<T> * this_mbox;
+      /// the unpublished sequence number this subscriber is stuck on
+      unsigned long stall_seq;
+      /// when to look for the owner of the claim on stall_seq
+      std::chrono::steady_clock::time_point stall_check;
+    };
+
+  public:
+    typedef std::unique_ptr<SubscriptionCl> Subscription;
+
+    /**
+     * @brief Subscribe the caller to a mailbox. The subscriber will
+     * see every message put after the subscription was made, by any
+     * process.
+     *
+     * @returns a smart pointer to a subscriber object.
+     * @throws TooManySubscribers if all the cursors are taken.
+     */
+    Subscription subscribe() {
+      for(unsigned int i = 0; i < header->max_subscribers; i++) {
+	auto & cur = cursors[i];
+	uint32_t expect = FREE;
+	// the cursor is ours once we've moved it out of FREE. Producers
+	// ignore it until it is ACTIVE, after its sequence is set.
+	if(cur.state.compare_exchange_strong(expect, JOINING)) {
+	  cur.pid = getpid();
+	  // Become ACTIVE holding a sequence no producer can have passed
+	  // yet, and only then look at the claim. A producer that
+	  // scanned the cursors before we were active claimed a sequence
+	  // below the one we read, so it can't wrap the ring past us.
+	  cur.seq.store(header->gating.load());
+	  cur.state.store(ACTIVE);
+	  cur.seq.store(header->claim.load());
+	  return Subscription(new SubscriptionCl(this, i));
+	}
+      }
+      throw TooManySubscribers(getName(), header->max_subscribers);
+    }
+
+    /**
+     * @brief Hand the oldest unread message to a callback, in place.
+     * Nothing is copied. This does not block.
+     *
+     * The reference is good only until the callback returns.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param callback called with the message
+     * @returns true if there was a message.
+     */
+    template<typename F>
+    bool read(Subscription & subs, F callback) {
+      int idx = subs->getIndex(this);
+      auto & cur = cursors[idx];
+      unsigned long seq = cur.seq.load(std::memory_order_relaxed);
+      while(true) {
+	Slot & s = slots[seq & mask];
+	uint64_t p = s.published.load(std::memory_order_acquire);
+	if((p != seq) && (p != (seq | skipped_bit))) {
+	  // if the producer died, the slot is marked now. Look again.
+	  if(abandoned(subs, seq)) continue;
+	  return false;
+	}
+	// we hold the slot until we move our cursor past it.
+	bool skip = (p != seq) || (s.origin == idx);
+	if(!skip) callback(static_cast<const T &>(s.msg));
+	seq++;
+	cur.seq.store(seq, std::memory_order_release);
+	if(!skip) return true;
+      }
+    }
+
+    /**
+     * @brief Copy the oldest unread message out of the mailbox. This
+     * does not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param msg the message is copied here.
+     * @returns true if there was a message.
+     */
+    bool get(Subscription & subs, T & msg) {
+      return read(subs, [&msg](const T & m) { msg = m; });
+    }
+
+    /**
+     * @brief Get an object out of the mailbox for this subscriber. This
+     * does not block.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @returns a copy of the oldest unread message, or nullptr if there isn't one.
+     */
+    std::shared_ptr<T> get(Subscription & subs) {
+      std::shared_ptr<T> ret;
+      read(subs, [&ret](const T & m) { ret = std::make_shared<T>(m); });
+      return ret;
+    }
+
+    /**
+     * @brief Copy a message out of the mailbox, waiting for one to
+     * arrive if the mailbox is empty.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param msg the message is copied here.
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns true if there was a message, false if the timeout expired.
+     */
+    bool waitGet(Subscription & subs, T & msg,
+		 const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      return waitRead(subs, [&msg](const T & m) { msg = m; }, timeout);
+    }
+
+    /**
+     * @brief Get an object out of the mailbox for this subscriber,
+     * waiting for one to arrive if the mailbox is empty.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @param timeout give up after this long. If timeout is zero,
+     * wait forever.
+     * @returns a copy of the oldest unread message, or nullptr
+     * if the timeout expired before a message arrived.
+     */
+    std::shared_ptr<T> waitGet(Subscription & subs,
+			       const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      std::shared_ptr<T> ret;
+      waitRead(subs, [&ret](const T & m) { ret = std::make_shared<T>(m); }, timeout);
+      return ret;
+    }
+
+    /**
+     * @brief Like read, but wait for a message if there isn't one.
+     *
+     * @returns true if there was a message, false if the timeout expired.
+     */
+    template<typename F>
+    bool waitRead(Subscription & subs, F callback,
+		  const std::chrono::duration<long, std::micro> & timeout = std::chrono::microseconds(0)) {
+      if(read(subs, callback)) return true;
+
+      auto & cur = cursors[subs->getIndex(this)];
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      while(true) {
+	header->sleepers.fetch_add(1);
+	uint32_t ticket = header->wake_seq.load();
+	// Either we see the published slot, or the producer sees that
+	// we are asleep and bumps wake_seq. (The producer has a
+	// matching fence.)
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	unsigned long seq = cur.seq.load(std::memory_order_relaxed);
+	uint64_t p = slots[seq & mask].published.load(std::memory_order_acquire);
+	bool ready = (p == seq) || (p == (seq | skipped_bit));
+	// If the slot has been claimed, its producer may have died, and
+	// nobody would wake us. Wake up now and then to check.
+	bool claimed = seq < header->claim.load();
+	std::chrono::steady_clock::duration check = std::chrono::milliseconds(abandon_check_ms);
+	bool timed_out = false;
+	if(!ready) {
+	  if((timeout.count() == 0) && !claimed) {
+	    futexWait(ticket, nullptr);
+	  }
+	  else {
+	    auto left = deadline - std::chrono::steady_clock::now();
+	    if(timeout.count() == 0) left = check;
+	    if(left.count() <= 0) {
+	      timed_out = true;
+	    }
+	    else {
+	      if(claimed && (left > check)) left = check;
+	      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+	      struct timespec ts;
+	      ts.tv_sec = ns / 1000000000;
+	      ts.tv_nsec = ns % 1000000000;
+	      futexWait(ticket, &ts);
+	    }
+	  }
+	}
+	header->sleepers.fetch_sub(1);
+	// the slot might have been our own message -- read will skip it.
+	if(read(subs, callback)) return true;
+	if(timed_out) return false;
+      }
+    }
+
+    /**
+     * @brief Copy a message into the ring, where every subscriber in
+     * every process can see it.
+     *
+     * @param msg The message to be sent to every subscriber.
+     * @param subs If supplied, the sender's own subscription will skip
+     * this message.
+     */
+    void put(const T & msg, const Subscription & subs = nullptr) {
+      int origin = (subs == nullptr) ? -1 : subs->getIndex(this);
+      auto & ce = acquireClaim();
+      unsigned long seq = header->claim.fetch_add(1);
+      ce.seq.store(seq + 1);
+      waitForSlot(seq);
+      publish(seq, msg, origin);
+      releaseClaim(ce);
+      wakeSleepers();
+    }
+
+    /**
+     * @brief Copy a message into the ring.
+     *
+     * @param msg The message to be sent to every subscriber. It is
+     * copied into the segment; the caller keeps the original.
+     * @param subs If supplied, the sender's own subscription will skip
+     * this message.
+     * @throws Exception if msg is nullptr. There's nothing to copy.
+     */
+    void put(std::shared_ptr<T> msg, const Subscription & subs = nullptr) {
+      if(msg == nullptr) {
+	throw Exception(getName(), "put() can't copy a null message into the segment");
+      }
+      put(*msg, subs);
+    }
+
+    /**
+     * Return the number of unread messages for this subscriber. This
+     * includes messages that have been claimed but not yet published,
+     * and messages that this subscriber will skip because it sent them.
+     *
+     * @param subs each user of a mailbox must have subscribed to the mailbox.
+     * @returns count of outstanding messages for this subscriber
+     */
+    unsigned int readyCount(Subscription & subs) {
+      auto & cur = cursors[subs->getIndex(this)];
+      unsigned long seq = cur.seq.load(std::memory_order_acquire);
+      unsigned long c = header->claim.load(std::memory_order_acquire);
+      return (c > seq) ? (c - seq) : 0;
+    }
+
+    /**
+     * @brief Skip over every published message for this subscriber.
+     *
+     * @param subs -- identifies the subscription we're clearing
+     */
+    void clear(Subscription & subs) {
+      while(read(subs, [](const T &) { })) { }
+    }
+
+    void unsubscribe(int subid) {
+      if((subid < 0) || (subid >= int(header->max_subscribers)) ||
+	 (cursors[subid].state.load() != ACTIVE)) {
+	throw MissingSubscriber(getName(), "unsubscribe()", subid);
+      }
+      // once we're free, producers won't wait for us.
+      cursors[subid].state.store(FREE);
+    }
+
+    /**
+     * @brief how many subscribers are there, in all processes?
+     */
+    unsigned int subscriberCount() {
+      unsigned int ret = 0;
+      for(unsigned int i = 0; i < header->max_subscribers; i++) {
+	if(cursors[i].state.load() == ACTIVE) ret++;
+      }
+      return ret;
+    }
+
+    /**
+     * @brief the number of messages the ring holds
+     */
+    unsigned long ringSize() const { return mask + 1; }
+
+  protected:
+    static const unsigned int cache_line = 64;
+    /// "SoDaShM2" -- the second layout, with the claim table
+    static const uint64_t magic_number = 0x536f446153684d32UL;
+    /// set in a slot's published sequence when its producer died
+    static const uint64_t skipped_bit = 1UL << 63;
+    /// a ClaimEntry's seq while its put is claiming a sequence number
+    static const uint64_t claiming = ~0UL;
+    /// how often a stuck subscriber looks for a dead producer
+    static const unsigned int abandon_check_ms = 10;
+
+    enum CursorState : uint32_t { FREE = 0, JOINING = 1, ACTIVE = 2 };
+
+    /**
+     * @brief The start of the segment. Everything in it has to make
+     * sense to every process that maps it, so there are no pointers.
+     */
+    struct Header {
+      uint64_t magic;
+      uint64_t msg_size;
+      uint64_t ring_size;
+      uint32_t max_subscribers;
+      /// set once the creator has filled everything in
+      std::atomic<uint32_t> ready;
+      char pad0[cache_line - 4 * sizeof(uint64_t)];
+      /// the next sequence number a producer will claim
+      std::atomic<uint64_t> claim;
+      char pad1[cache_line - sizeof(uint64_t)];
+      /// cached copy of the slowest cursor
+      std::atomic<uint64_t> gating;
+      char pad2[cache_line - sizeof(uint64_t)];
+      /// the futex: bumped by a producer that finds sleepers
+      std::atomic<uint32_t> wake_seq;
+      /// number of subscribers sleeping in waitGet, in all processes
+      std::atomic<uint32_t> sleepers;
+    };
+
+    /**
+     * @brief Each subscriber's cursor sits on its own cache line.
+     */
+    struct Cursor {
+      std::atomic<uint64_t> seq;
+      std::atomic<uint32_t> state;
+      /// the process that owns the cursor
+      int32_t pid;
+      char pad[cache_line - sizeof(uint64_t) - 2 * sizeof(uint32_t)];
+    };
+
+    /**
+     * @brief A put that is under way. A subscriber stuck on an
+     * unpublished slot looks here to see whether the process that
+     * claimed it is still alive.
+     */
+    struct ClaimEntry {
+      /// the claimed sequence number plus one, claiming, or zero
+      std::atomic<uint64_t> seq;
+      /// the process that owns the entry, zero if it is free
+      std::atomic<int32_t> pid;
+      char pad[cache_line - sizeof(uint64_t) - sizeof(int32_t)];
+    };
+
+    struct Slot {
+      /// the sequence number of the message in this slot, with
+      /// skipped_bit set if its producer died before publishing it
+      std::atomic<uint64_t> published;
+      /// the subscriber that sent this message, if it asked to be skipped
+      int32_t origin;
+      T msg;
+    };
+
+    static std::string shmName(const std::string & name) {
+      return "/SoDaMailBox." + name;
+    }
+
+    static size_t roundUp(size_t v) {
+      return (v + cache_line - 1) & ~size_t(cache_line - 1);
+    }
+
+    static size_t cursorOffset() {
+      return roundUp(sizeof(Header));
+    }
+
+    static size_t claimOffset(unsigned int max_subscribers) {
+      return roundUp(cursorOffset() + max_subscribers * sizeof(Cursor));
+    }
+
+    static size_t slotOffset(unsigned int max_subscribers) {
+      return roundUp(claimOffset(max_subscribers) + max_subscribers * sizeof(ClaimEntry));
+    }
+
+    static size_t segmentSize(unsigned long ring_size, unsigned int max_subscribers) {
+      return slotOffset(max_subscribers) + ring_size * sizeof(Slot);
+    }
+
+    /**
+     * @brief Set up a new segment. ftruncate filled it with zeros, so
+     * only the things that aren't zero need to be set.
+     */
+    void initialize(unsigned long ring_size, unsigned int max_subscribers) {
+      header->magic = magic_number;
+      header->msg_size = sizeof(T);
+      header->ring_size = ring_size;
+      header->max_subscribers = max_subscribers;
+      Slot * s = reinterpret_cast<Slot *>(base + slotOffset(max_subscribers));
+      for(unsigned long i = 0; i < ring_size; i++) {
+	// nothing has been published yet -- sequence 0 is not in slot 0
+	s[i].published.store(i + 1, std::memory_order_relaxed);
+      }
+      header->ready.store(1, std::memory_order_release);
+    }
+
+    /**
+     * @brief wait until every subscriber has read the message that used to
+     * be in the slot for sequence number seq.
+     */
+    void waitForSlot(unsigned long seq) {
+      unsigned long ring_size = mask + 1;
+      unsigned int tries = 0;
+      while((seq >= ring_size) && (header->gating.load(std::memory_order_acquire) <= (seq - ring_size))) {
+	unsigned long min_seq = slowestCursor(seq);
+	unsigned long old_gate = header->gating.load(std::memory_order_relaxed);
+	while((old_gate < min_seq) &&
+	      !header->gating.compare_exchange_weak(old_gate, min_seq)) { }
+	if(min_seq <= (seq - ring_size)) {
+	  // every so often, see whether we're waiting on the dead.
+	  if((++tries & 0x3ff) == 0) reapDead();
+	  std::this_thread::yield();
+	}
+      }
+    }
+
+    /**
+     * @brief free the cursors of subscribers whose processes have died.
+     */
+    void reapDead() {
+      for(unsigned int i = 0; i < header->max_subscribers; i++) {
+	auto & cur = cursors[i];
+	if(cur.state.load() != ACTIVE) continue;
+	if((kill(cur.pid, 0) < 0) && (errno == ESRCH)) {
+	  uint32_t expect = ACTIVE;
+	  cur.state.compare_exchange_strong(expect, FREE);
+	}
+      }
+    }
+
+    /**
+     * @brief Take a free entry in the claim table. It says we are
+     * claiming until the caller fills in the sequence number.
+     */
+    ClaimEntry & acquireClaim() {
+      int32_t me = getpid();
+      unsigned int n = header->max_subscribers;
+      // spread the threads out, so they don't all fight over entry 0.
+      unsigned int start = std::hash<std::thread::id>()(std::this_thread::get_id()) % n;
+      for(unsigned int tries = 0; ; tries++) {
+	auto & ce = claims[(start + tries) % n];
+	int32_t expect = 0;
+	if((ce.pid.load(std::memory_order_relaxed) == 0) &&
+	   ce.pid.compare_exchange_strong(expect, me)) {
+	  // before the claim counter moves, so that a subscriber that
+	  // sees the new claim also sees us.
+	  ce.seq.store(claiming);
+	  return ce;
+	}
+	if(((tries + 1) % n) == 0) {
+	  // the table is full. Maybe some of it belongs to the dead.
+	  liveClaim(~0UL);
+	  std::this_thread::yield();
+	}
+      }
+    }
+
+    void releaseClaim(ClaimEntry & ce) {
+      ce.seq.store(0);
+      ce.pid.store(0);
+    }
+
+    /**
+     * @brief Is a live process working on a put of sequence number
+     * seq (or on one whose number we can't know yet)? Entries owned
+     * by dead processes are freed along the way.
+     */
+    bool liveClaim(unsigned long seq) {
+      bool ret = false;
+      for(unsigned int i = 0; i < header->max_subscribers; i++) {
+	auto & ce = claims[i];
+	uint64_t c = ce.seq.load();
+	int32_t pid = ce.pid.load();
+	if(pid == 0) continue;
+	if((kill(pid, 0) < 0) && (errno == ESRCH)) {
+	  // the seq field is stale, but it doesn't matter once the
+	  // pid is zero.
+	  ce.pid.compare_exchange_strong(pid, 0);
+	  continue;
+	}
+	if((c == claiming) || (c == seq + 1)) ret = true;
+      }
+      return ret;
+    }
+
+    /**
+     * @brief This subscriber is stuck on an unpublished slot. If it
+     * has been stuck a while, and the producer that claimed the slot
+     * is dead, mark the slot skipped.
+     *
+     * @returns true if the slot has been marked or published, and
+     * is worth another look.
+     */
+    bool abandoned(Subscription & subs, unsigned long seq) {
+      // nobody has claimed it yet.
+      if(seq >= header->claim.load()) return false;
+      auto now = std::chrono::steady_clock::now();
+      auto check = std::chrono::milliseconds(abandon_check_ms);
+      if(subs->stall_seq != seq) {
+	subs->stall_seq = seq;
+	subs->stall_check = now + check;
+	return false;
+      }
+      if(now < subs->stall_check) return false;
+      subs->stall_check = now + check;
+      if(liveClaim(seq)) return false;
+
+      // The producer may have published after all, just now. Only
+      // the slot's previous lap can be replaced.
+      Slot & s = slots[seq & mask];
+      uint64_t p = s.published.load();
+      while((p != seq) && (p != (seq | skipped_bit))) {
+	if(s.published.compare_exchange_weak(p, seq | skipped_bit)) break;
+      }
+      return true;
+    }
+
+    void publish(unsigned long seq, const T & msg, int origin) {
+      Slot & s = slots[seq & mask];
+      s.msg = msg;
+      s.origin = origin;
+      s.published.store(seq, std::memory_order_release);
+    }
+
+    void wakeSleepers() {
+      // pairs with the fence in waitRead
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(header->sleepers.load(std::memory_order_relaxed) != 0) {
+	header->wake_seq.fetch_add(1);
+	syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->wake_seq),
+		FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+      }
+    }
+
+    void futexWait(uint32_t ticket, struct timespec * ts) {
+      // This is not a private futex: the sleepers and the wakers are
+      // in different processes.
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->wake_seq),
+	      FUTEX_WAIT, ticket, ts, nullptr, 0);
+    }
+
+    /**
+     * @brief find the oldest unread sequence number over all subscribers.
+     * If there are no subscribers, nobody is holding any slots.
+     */
+    unsigned long slowestCursor(unsigned long seq) {
+      unsigned long ret = seq;
+      for(unsigned int i = 0; i < header->max_subscribers; i++) {
+	auto & cur = cursors[i];
+	if(cur.state.load(std::memory_order_acquire) != ACTIVE) continue;
+	unsigned long cs = cur.seq.load(std::memory_order_acquire);
+	ret = (cs < ret) ? cs : ret;
+      }
+      return ret;
+    }
+
+    char * base;
+    size_t map_size;
+    Header * header;
+    Cursor * cursors;
+    ClaimEntry * claims;
+    Slot * slots;
+    unsigned long mask;
+  };
+
+  /**
+   * @brief Open (or create) a shared mailbox and return a shared pointer to it.
+   *
+   * @param mname Name of the mailbox.
+   * @param ring_size the ring will hold at least this many messages.
+   * @param max_subscribers the mailbox can have at most this many subscribers.
+   * @returns shared pointer to a SharedMailBox object
+   */
+  template<typename T>
+  std::shared_ptr<SharedMailBox<T>> makeSharedMailBox(const std::string & mname,
+						      unsigned int ring_size = 1024,
+						      unsigned int max_subscribers = 64) {
+    return std::make_shared<SharedMailBox<T>>(mname, ring_size, max_subscribers);
+  }
+
+  template<typename T>
+  using SharedMailBoxPtr = std::shared_ptr<SharedMailBox<T>>;
+#endif
+}
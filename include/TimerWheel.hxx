@@ -0,0 +1,207 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file TimerWheel.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::TimerWheel TimerWheel: lots of timers, one thread
+ *
+ * Retries, periodic polls, and scheduled retuning all want something
+ * to happen later. A thread that sleeps for each of them is easy to
+ * write, but a few thousand sleeping threads is a lot of stacks.
+ *
+ * A SoDa::TimerWheel keeps any number of timers and runs them all
+ * from one service thread. '''schedule(when, callback)''' returns a
+ * TimerID that '''cancel''' can use to take the timer back. Both take
+ * constant time, however many timers are pending.
+ *
+ * The wheel counts time in ticks (a millisecond, unless you ask for
+ * something else). It is really four wheels of 256 slots. The first
+ * holds timers that expire in the next 256 ticks, one slot per tick.
+ * The second holds timers that expire in the next 65536 ticks, one
+ * slot per 256 ticks, and so on. Each time the first wheel comes back
+ * around, the timers in the next slot of the second wheel are spread
+ * out over the first. Timers further out than the fourth wheel can
+ * reach (about 49 days of millisecond ticks) are parked in its last
+ * slot and looked at again when it comes around.
+ *
+ * A timer never fires early, and fires no more than a tick (plus
+ * scheduling noise) late. Callbacks run on the service thread, one at
+ * a time, without any wheel lock held. A callback may schedule or
+ * cancel timers, but it shouldn't take long.
+ *
+ * '''TimerWheel::shared()''' is a wheel that anyone in the process can
+ * use. SoDa::MailBox::putAt and SoDa::MailBox::putAfter use it.
+ */
+
+namespace SoDa {
+
+  /**
+   * @class TimerWheel
+   * @brief A hierarchical timer wheel with its own service thread.
+   */
+  class TimerWheel : public NoCopy {
+  public:
+    /// names a pending timer
+    typedef uint64_t TimerID;
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @brief constructor. This starts the service thread.
+     *
+     * @param name the name of the wheel
+     * @param tick the wheel's resolution
+     */
+    TimerWheel(const std::string & name,
+	       const std::chrono::duration<long, std::micro> & tick = std::chrono::milliseconds(1));
+
+    /**
+     * @brief Stop the service thread. Timers that haven't fired, won't.
+     */
+    ~TimerWheel();
+
+    /**
+     * @brief Call a function at (or just after) a given time.
+     *
+     * @param when when to call it. If this is in the past, the
+     * callback runs on the next tick.
+     * @param callback the function to call
+     * @returns an id that can be passed to cancel
+     */
+    TimerID schedule(const Clock::time_point & when, const std::function<void()> & callback);
+
+    /**
+     * @brief Call a function after a delay.
+     *
+     * @param delay how long to wait
+     * @param callback the function to call
+     * @returns an id that can be passed to cancel
+     */
+    TimerID scheduleAfter(const std::chrono::duration<long, std::micro> & delay,
+			  const std::function<void()> & callback);
+
+    /**
+     * @brief Take back a timer that hasn't fired yet.
+     *
+     * @param id from schedule or scheduleAfter
+     * @returns true if the timer was cancelled, false if it had
+     * already fired (or was never there).
+     */
+    bool cancel(TimerID id);
+
+    /**
+     * @brief how many timers are waiting to fire?
+     */
+    unsigned long pending();
+
+    const std::string & getName() const { return name; }
+
+    /**
+     * @brief The wheel that everyone can share. It is made, and its
+     * thread started, the first time anyone asks for it.
+     */
+    static TimerWheel & shared();
+
+  protected:
+    static const unsigned int slot_bits = 8;
+    static const unsigned int num_slots = 1 << slot_bits;
+    static const unsigned int slot_mask = num_slots - 1;
+    static const unsigned int num_levels = 4;
+
+    /**
+     * @brief A timer. Timers in the same slot are kept in a doubly
+     * linked list, by index into the nodes table, so that a timer
+     * can be unlinked without looking for it.
+     */
+    struct Node {
+      std::function<void()> callback;
+      uint64_t expire;
+      /// bumped each time the node is freed, so stale ids don't match
+      uint32_t generation = 0;
+      /// the slot (level * num_slots + slot) this node is in, or -1 if it is free
+      int slot = -1;
+      int prev = -1;
+      int next = -1;
+    };
+
+    uint64_t tickOf(const Clock::time_point & when);
+    Clock::time_point timeOf(uint64_t tick);
+
+    /// put a node in the slot for its expiry. The caller holds the lock.
+    void insert(int idx);
+    /// take a node out of its slot. The caller holds the lock.
+    void unlink(int idx);
+    int allocNode();
+    void freeNode(int idx);
+
+    /**
+     * @brief Process tick current, moving the callbacks that are due
+     * to fired. The caller holds the lock.
+     */
+    void advance(std::vector<std::function<void()>> & fired);
+    /// spread a slot of an upper wheel out over the wheels below it
+    void cascade(unsigned int level);
+
+    void serviceLoop();
+
+    std::string name;
+    Clock::duration tick;
+    Clock::time_point epoch;
+
+    std::vector<Node> nodes;
+    int free_head;
+    int heads[num_levels * num_slots];
+    unsigned long level_count[num_levels];
+    unsigned long num_pending;
+
+    /// the next tick to process
+    uint64_t current;
+    /// the tick the service thread will wake up for
+    uint64_t wake_tick;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping;
+    std::thread service_thread;
+  };
+}
@@ -0,0 +1,243 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "NoCopy.hxx"
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file WaitStrategy.hxx
+ * @author Matt Reilly (kb1vc)
+ * @date Oct 16, 2026
+ */
+
+/**
+ * @page SoDa::WaitStrategy WaitStrategy: how a subscriber waits for mail
+ *
+ * A subscriber that calls waitGet on an empty mailbox normally goes
+ * to sleep on a condition variable, and the producer wakes it up.
+ * That costs nothing while the subscriber waits, but a wakeup takes
+ * a trip through the kernel, and that can take tens of microseconds.
+ * A latency-critical thread on a core of its own would rather keep
+ * looking. A background thread would rather sleep.
+ *
+ * A SoDa::WaitStrategy describes what a subscriber does while it
+ * waits. There are five kinds:
+ *
+ * - WaitStrategy::BLOCK go to sleep right away. This is the default.
+ * - WaitStrategy::BUSY_SPIN check for mail over and over, and never
+ *   sleep. Lowest latency, and it burns a whole core.
+ * - WaitStrategy::SPIN_YIELD spin for a while, then keep checking but
+ *   yield the processor between checks.
+ * - WaitStrategy::SPIN_PARK spin for a while, then sleep. The number
+ *   of spins adapts: when spinning pays off the subscriber spins a
+ *   little longer next time, and when it ends up sleeping anyway it
+ *   spins half as long.
+ * - WaitStrategy::TIMED_SPIN spin for a fixed amount of time, then sleep.
+ *
+ * The strategy keeps count of how each wait ended: during the spin,
+ * during the yield phase, asleep, or by timing out. If the park count
+ * is high, spinning isn't buying much. If the spin count is high, it
+ * is.
+ *
+ * Each subscription has its own strategy, set with the mailbox's
+ * '''setWaitStrategy(subs, kind)''' and read back with
+ * '''waitStats(subs)'''. SoDa::MailBox and SoDa::LockFreeMailBox both
+ * support it.
+ */
+
+namespace SoDa {
+
+  /**
+   * @class WaitStrategy
+   * @brief How a subscriber waits for a message, and how those waits
+   * turned out.
+   *
+   * A strategy belongs to one subscription, and is only used by the
+   * subscriber's thread. The counters may be read from anywhere.
+   */
+  class WaitStrategy : public NoCopy {
+  public:
+    enum Kind {
+      BLOCK, ///< sleep right away
+      BUSY_SPIN, ///< never sleep
+      SPIN_YIELD, ///< spin, then yield between checks
+      SPIN_PARK, ///< spin (adaptively), then sleep
+      TIMED_SPIN ///< spin for a fixed time, then sleep
+    };
+
+    /**
+     * @brief How the waits have turned out so far.
+     */
+    struct Stats {
+      /// the message arrived while we were spinning
+      unsigned long spin;
+      /// the message arrived while we were yielding
+      unsigned long yield;
+      /// we went to sleep
+      unsigned long park;
+      /// we gave up
+      unsigned long timeout;
+      /// the current spin limit (it changes for SPIN_PARK)
+      unsigned int spin_limit;
+    };
+
+    WaitStrategy() {
+      configure(BLOCK);
+    }
+
+    /**
+     * @brief Pick a strategy.
+     *
+     * @param kind which strategy
+     * @param spin_count spin this many times before yielding or
+     * sleeping. For SPIN_PARK this is the starting point.
+     * @param spin_time how long TIMED_SPIN spins before sleeping
+     */
+    void configure(Kind kind, unsigned int spin_count = 1000,
+		   const std::chrono::duration<long, std::micro> & spin_time = std::chrono::microseconds(50)) {
+      this->kind = kind;
+      this->spin_count = (spin_count == 0) ? 1 : spin_count;
+      this->spin_time = spin_time;
+      spin_limit.store(this->spin_count, std::memory_order_relaxed);
+      spin_hits.store(0);
+      yield_hits.store(0);
+      park_hits.store(0);
+      timeout_hits.store(0);
+    }
+
+    Kind getKind() const { return kind; }
+
+    /**
+     * @brief Run the busy part of the wait.
+     *
+     * @param ready returns true when the wait is over. It is called
+     * without any locks held.
+     * @param deadline give up at this time
+     * @returns true if ready() came true, false if the caller should
+     * go to sleep (or has run out of time).
+     */
+    template<typename Ready>
+    bool spin(Ready ready, const std::chrono::steady_clock::time_point & deadline) {
+      if(kind == BLOCK) return false;
+
+      auto spin_until = std::chrono::steady_clock::time_point::max();
+      if(kind == TIMED_SPIN) {
+	spin_until = std::chrono::steady_clock::now() + spin_time;
+      }
+      unsigned int lim = spin_limit.load(std::memory_order_relaxed);
+
+      for(unsigned long i = 0; ; i++) {
+	if(ready()) {
+	  spin_hits.fetch_add(1, std::memory_order_relaxed);
+	  if(kind == SPIN_PARK) {
+	    // it paid off -- spin a little longer next time.
+	    unsigned int nlim = lim + (lim >> 3) + 1;
+	    spin_limit.store((nlim > (16 * spin_count)) ? (16 * spin_count) : nlim,
+			     std::memory_order_relaxed);
+	  }
+	  return true;
+	}
+	// don't read the clock on every trip around.
+	if((i & 63) == 63) {
+	  auto now = std::chrono::steady_clock::now();
+	  if(now >= deadline) return false;
+	  if((kind == TIMED_SPIN) && (now >= spin_until)) return false;
+	}
+	if(((kind == SPIN_YIELD) || (kind == SPIN_PARK)) && (i >= lim)) break;
+	pause();
+      }
+
+      if(kind == SPIN_YIELD) {
+	while(!ready()) {
+	  if(std::chrono::steady_clock::now() >= deadline) return false;
+	  std::this_thread::yield();
+	}
+	yield_hits.fetch_add(1, std::memory_order_relaxed);
+	return true;
+      }
+
+      // SPIN_PARK -- spinning didn't help, so spin less next time.
+      lim = lim >> 1;
+      spin_limit.store((lim < 16) ? 16 : lim, std::memory_order_relaxed);
+      return false;
+    }
+
+    /**
+     * @brief The caller went to sleep after spin returned false.
+     * @param got_one true if the sleep ended with a message, false if
+     * it timed out.
+     */
+    void parked(bool got_one) {
+      if(got_one) park_hits.fetch_add(1, std::memory_order_relaxed);
+      else timeout_hits.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief How have the waits turned out?
+     */
+    Stats stats() const {
+      Stats ret;
+      ret.spin = spin_hits.load(std::memory_order_relaxed);
+      ret.yield = yield_hits.load(std::memory_order_relaxed);
+      ret.park = park_hits.load(std::memory_order_relaxed);
+      ret.timeout = timeout_hits.load(std::memory_order_relaxed);
+      ret.spin_limit = spin_limit.load(std::memory_order_relaxed);
+      return ret;
+    }
+
+    /**
+     * @brief When should a wait with this timeout give up?
+     * @param timeout zero means never
+     */
+    static std::chrono::steady_clock::time_point deadline(const std::chrono::duration<long, std::micro> & timeout) {
+      if(timeout.count() == 0) return std::chrono::steady_clock::time_point::max();
+      return std::chrono::steady_clock::now() + timeout;
+    }
+
+  protected:
+    /// be polite to the other hyperthread on this core
+    static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+
+    Kind kind;
+    unsigned int spin_count;
+    std::chrono::duration<long, std::micro> spin_time;
+
+    std::atomic<unsigned int> spin_limit;
+    std::atomic<unsigned long> spin_hits;
+    std::atomic<unsigned long> yield_hits;
+    std::atomic<unsigned long> park_hits;
+    std::atomic<unsigned long> timeout_hits;
+  };
+}
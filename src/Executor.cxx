@@ -0,0 +1,145 @@
+#include "Executor.hxx"
+
+/*
+BSD 2-Clause License
+
+Copyright (c) 2026, Matt Reilly - kb1vc
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+namespace SoDa {
+  /// the executor and worker index of the calling thread, if it is a worker
+  static thread_local Executor * current_executor = nullptr;
+  static thread_local unsigned int current_worker = 0;
+
+  Executor::Executor(const std::string & name, unsigned int num_workers) :
+    name(name) {
+    if(num_workers == 0) num_workers = std::thread::hardware_concurrency();
+    if(num_workers == 0) num_workers = 1;
+    next_worker = 0;
+    num_queued = 0;
+    num_stolen = 0;
+    sleepers = 0;
+    stopping = false;
+    for(unsigned int i = 0; i < num_workers; i++) {
+      workers.push_back(std::unique_ptr<Worker>(new Worker));
+      workers.back()->executed = 0;
+    }
+    // every queue must exist before any worker goes looking to steal.
+    for(unsigned int i = 0; i < num_workers; i++) {
+      workers[i]->thread = std::thread(&Executor::workLoop, this, i);
+    }
+  }
+
+  Executor::~Executor() {
+    {
+      std::lock_guard<std::mutex> lock(idle_mtx);
+      stopping = true;
+      idle_cv.notify_all();
+    }
+    for(auto & w : workers) w->thread.join();
+  }
+
+  void Executor::submit(const Task & task) {
+    if(stopping) throw Exception(name, "submit() the executor is shutting down");
+    unsigned int idx;
+    if(current_executor == this) idx = current_worker;
+    else idx = next_worker.fetch_add(1) % workers.size();
+    // count it first, so the count is never less than what is queued.
+    num_queued.fetch_add(1);
+    {
+      std::lock_guard<std::mutex> lock(workers[idx]->mtx);
+      workers[idx]->tasks.push_back(task);
+    }
+    // A worker counts itself as a sleeper before it looks at
+    // num_queued, so either it sees this task or we see it.
+    if(sleepers.load() != 0) {
+      std::lock_guard<std::mutex> lock(idle_mtx);
+      idle_cv.notify_one();
+    }
+  }
+
+  std::vector<unsigned long> Executor::executedCounts() const {
+    std::vector<unsigned long> ret;
+    for(auto & w : workers) ret.push_back(w->executed);
+    return ret;
+  }
+
+  bool Executor::popLocal(unsigned int idx, Task & task) {
+    auto & w = *workers[idx];
+    std::lock_guard<std::mutex> lock(w.mtx);
+    if(w.tasks.empty()) return false;
+    task = std::move(w.tasks.front());
+    w.tasks.pop_front();
+    return true;
+  }
+
+  bool Executor::steal(unsigned int idx, Task & task) {
+    unsigned int n = workers.size();
+    for(unsigned int i = 1; i < n; i++) {
+      auto & w = *workers[(idx + i) % n];
+      // don't wait on a busy queue; there may be another one to rob.
+      std::unique_lock<std::mutex> lock(w.mtx, std::try_to_lock);
+      if(!lock.owns_lock() || w.tasks.empty()) continue;
+      task = std::move(w.tasks.back());
+      w.tasks.pop_back();
+      num_stolen++;
+      return true;
+    }
+    return false;
+  }
+
+  void Executor::workLoop(unsigned int idx) {
+    current_executor = this;
+    current_worker = idx;
+    Task task;
+    while(!stopping) {
+      if(popLocal(idx, task) || steal(idx, task)) {
+	num_queued.fetch_sub(1);
+	task();
+	task = nullptr;
+	workers[idx]->executed++;
+	continue;
+      }
+
+      std::unique_lock<std::mutex> lock(idle_mtx);
+      sleepers.fetch_add(1);
+      // A task might be queued where we couldn't get at it (a queue
+      // that was locked when we tried to steal), so don't sleep for long
+      // while there is work about.
+      if(num_queued.load() == 0) {
+	idle_cv.wait(lock, [this]() { return stopping || (num_queued.load() != 0); });
+      }
+      else {
+	idle_cv.wait_for(lock, std::chrono::microseconds(100));
+      }
+      sleepers.fetch_sub(1);
+    }
+  }
+
+  ExecutorPtr makeExecutor(const std::string & name, unsigned int num_workers) {
+    return std::make_shared<Executor>(name, num_workers);
+  }
+}
@@ -0,0 +1,263 @@
+#include "Journal.hxx"
+#include "Format.hxx"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+/*
+BSD 2-Clause License
+
+Copyright (c) 2026, Matt Reilly - kb1vc
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+namespace SoDa {
+  /// "SoDaJnl1"
+  static const char journal_magic[8] = { 'S', 'o', 'D', 'a', 'J', 'n', 'l', '1' };
+
+  /**
+   * @brief The start of each segment file.
+   */
+  struct JournalSegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t segment;
+    /// when the segment was started, in nanoseconds of the system clock
+    int64_t created_ns;
+    char pad[40];
+  };
+
+  /**
+   * @brief The start of each record. A record of size zero marks the
+   * end of the segment, which is what a freshly extended file holds.
+   */
+  struct JournalRecordHeader {
+    /// the whole record, header and padding included. Written last.
+    uint32_t size;
+    uint32_t len;
+    uint32_t check;
+    uint32_t pad;
+    int64_t stamp_ns;
+  };
+
+  static size_t roundUp8(size_t v) {
+    return (v + 7) & ~size_t(7);
+  }
+
+  /// FNV-1a, to catch records that were only partly written
+  static uint32_t journalCheck(const void * data, uint32_t len) {
+    auto p = static_cast<const unsigned char *>(data);
+    uint32_t h = 2166136261u;
+    for(uint32_t i = 0; i < len; i++) {
+      h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+  }
+
+  static std::string errnoString(const std::string & call) {
+    return call + " failed: " + std::string(strerror(errno));
+  }
+
+  JournalWriter::JournalWriter(const std::string & prefix, size_t segment_size, Commit commit) :
+    prefix(prefix), commit_mode(commit) {
+    // a segment must at least hold its header and one small record.
+    size_t page = sysconf(_SC_PAGESIZE);
+    if(segment_size < page) segment_size = page;
+    this->segment_size = segment_size;
+    fd = -1;
+    base = nullptr;
+    segment_idx = 0;
+    records = 0;
+    remove(prefix);
+    openSegment();
+  }
+
+  JournalWriter::~JournalWriter() {
+    closeSegment();
+  }
+
+  std::string JournalWriter::segmentName(const std::string & prefix, unsigned int idx) {
+    return prefix + SoDa::Format(".%0.jnl").addI(idx, 6, '\000', '0').str();
+  }
+
+  unsigned int JournalWriter::remove(const std::string & prefix) {
+    unsigned int ret = 0;
+    while(::unlink(segmentName(prefix, ret).c_str()) == 0) ret++;
+    return ret;
+  }
+
+  void JournalWriter::append(const void * data, uint32_t len, int64_t stamp_ns) {
+    size_t need = sizeof(JournalRecordHeader) + roundUp8(len);
+    if(need > (segment_size - sizeof(JournalSegmentHeader))) {
+      throw Exception(prefix, SoDa::Format("append() a record of %0 bytes won't fit in a segment")
+		      .addU(len).str());
+    }
+    if((used + need) > segment_size) {
+      closeSegment();
+      segment_idx++;
+      openSegment();
+    }
+    auto h = reinterpret_cast<JournalRecordHeader *>(base + used);
+    std::memcpy(base + used + sizeof(JournalRecordHeader), data, len);
+    h->len = len;
+    h->check = journalCheck(data, len);
+    h->stamp_ns = stamp_ns;
+    // a reader that sees the size will see the rest.
+    std::atomic_thread_fence(std::memory_order_release);
+    h->size = need;
+    used += need;
+    records++;
+  }
+
+  void JournalWriter::commit() {
+    if((commit_mode == NONE) || (used == committed)) return;
+    // msync wants a page aligned start.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t from = committed & ~(page - 1);
+    if(msync(base + from, used - from, (commit_mode == SYNC) ? MS_SYNC : MS_ASYNC) < 0) {
+      throw Exception(prefix, errnoString("msync()"));
+    }
+    committed = used;
+  }
+
+  void JournalWriter::openSegment() {
+    std::string name = segmentName(prefix, segment_idx);
+    fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) throw Exception(prefix, errnoString("open(" + name + ")"));
+    // ftruncate would leave a sparse file, and a page the disk has no
+    // room for would only show up as a SIGBUS when a record landed in
+    // it. Claim the blocks now, where running out can be reported.
+    int err = posix_fallocate(fd, 0, segment_size);
+    if(err != 0) {
+      ::close(fd);
+      errno = err;
+      throw Exception(prefix, errnoString("posix_fallocate(" + name + ")"));
+    }
+    void * p = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED) {
+      ::close(fd);
+      throw Exception(prefix, errnoString("mmap(" + name + ")"));
+    }
+    base = static_cast<char *>(p);
+    auto h = reinterpret_cast<JournalSegmentHeader *>(base);
+    std::memcpy(h->magic, journal_magic, sizeof(journal_magic));
+    h->version = 1;
+    h->segment = segment_idx;
+    h->created_ns = std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::system_clock::now().time_since_epoch()).count();
+    used = sizeof(JournalSegmentHeader);
+    committed = 0;
+  }
+
+  void JournalWriter::closeSegment() {
+    if(base == nullptr) return;
+    commit();
+    munmap(base, segment_size);
+    base = nullptr;
+    // Leave room for an end marker, so a reader doesn't walk off the
+    // end of a full segment.
+    size_t keep = used + sizeof(JournalRecordHeader);
+    if(keep > segment_size) keep = segment_size;
+    if(ftruncate(fd, keep) == 0) {
+      if(commit_mode == SYNC) fsync(fd);
+    }
+    ::close(fd);
+    fd = -1;
+  }
+
+  JournalReader::JournalReader(const std::string & prefix) : prefix(prefix) {
+    base = nullptr;
+    torn = 0;
+    if(!openSegment(0)) {
+      throw JournalWriter::Exception(prefix, "there is no journal named " +
+				     JournalWriter::segmentName(prefix, 0));
+    }
+  }
+
+  JournalReader::~JournalReader() {
+    closeSegment();
+  }
+
+  bool JournalReader::openSegment(unsigned int idx) {
+    closeSegment();
+    std::string name = JournalWriter::segmentName(prefix, idx);
+    int fd = ::open(name.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if((fstat(fd, &st) < 0) || (size_t(st.st_size) < sizeof(JournalSegmentHeader))) {
+      ::close(fd);
+      return false;
+    }
+    void * p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED) return false;
+    base = static_cast<char *>(p);
+    map_size = st.st_size;
+    auto h = reinterpret_cast<const JournalSegmentHeader *>(base);
+    if(std::memcmp(h->magic, journal_magic, sizeof(journal_magic)) != 0) {
+      closeSegment();
+      throw JournalWriter::Exception(prefix, name + " isn't a journal segment");
+    }
+    pos = sizeof(JournalSegmentHeader);
+    segment_idx = idx;
+    return true;
+  }
+
+  void JournalReader::closeSegment() {
+    if(base == nullptr) return;
+    munmap(base, map_size);
+    base = nullptr;
+  }
+
+  bool JournalReader::next(const char * & data, uint32_t & len, int64_t & stamp_ns) {
+    while(base != nullptr) {
+      if((pos + sizeof(JournalRecordHeader)) <= map_size) {
+	auto h = reinterpret_cast<const JournalRecordHeader *>(base + pos);
+	uint32_t size = h->size;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if(size != 0) {
+	  const char * d = base + pos + sizeof(JournalRecordHeader);
+	  if((size >= sizeof(JournalRecordHeader)) && ((pos + size) <= map_size) &&
+	     (h->len <= (size - sizeof(JournalRecordHeader))) &&
+	     (journalCheck(d, h->len) == h->check)) {
+	    data = d;
+	    len = h->len;
+	    stamp_ns = h->stamp_ns;
+	    pos += size;
+	    return true;
+	  }
+	  // the writer didn't finish this one. Nothing after it in the
+	  // segment can be trusted.
+	  torn++;
+	}
+      }
+      // on to the next segment, if there is one.
+      if(!openSegment(segment_idx + 1)) return false;
+    }
+    return false;
+  }
+}
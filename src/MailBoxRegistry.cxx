@@ -0,0 +1,189 @@
+#include "MailBoxRegistry.hxx"
+#include <cctype>
+
+/*
+BSD 2-Clause License
+
+Copyright (c) 2026, Matt Reilly - kb1vc
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+namespace SoDa {
+  MailBoxRegistry::MailBoxRegistry(const std::string & name) : name(name) {
+  }
+
+  MailBoxRegistry::Handle MailBoxRegistry::intern(const std::string & topic) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return internLocked(topic);
+  }
+
+  std::shared_ptr<MailBoxBase> MailBoxRegistry::getBase(Handle h) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return entry(h).base;
+  }
+
+  std::string MailBoxRegistry::topic(Handle h) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return entry(h).topic;
+  }
+
+  std::vector<MailBoxRegistry::Handle> MailBoxRegistry::match(const std::string & pattern) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto levels = splitTopic(pattern, true);
+    std::vector<bool> seen(entries.size(), false);
+    std::vector<Handle> ret;
+    matchNode(&root, levels, 0, seen, ret);
+    return ret;
+  }
+
+  void MailBoxRegistry::watch(const std::string & pattern,
+			      const std::function<void(Handle)> & callback) {
+    std::vector<Handle> now;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      Watcher w;
+      w.pattern = splitTopic(pattern, true);
+      w.callback = callback;
+      std::vector<bool> seen(entries.size(), false);
+      matchNode(&root, w.pattern, 0, seen, now);
+      watchers.push_back(w);
+    }
+    for(auto h : now) callback(h);
+  }
+
+  MailBoxRegistry::Handle MailBoxRegistry::internLocked(const std::string & topic) {
+    auto levels = splitTopic(topic, false);
+    Node * node = &root;
+    for(auto & l : levels) {
+      auto & child = node->children[l];
+      if(child == nullptr) child = std::unique_ptr<Node>(new Node);
+      node = child.get();
+    }
+    if(node->handle < 0) {
+      node->handle = entries.size();
+      Entry e;
+      e.topic = topic;
+      e.levels = levels;
+      entries.push_back(e);
+    }
+    return Handle(node->handle);
+  }
+
+  MailBoxRegistry::Entry & MailBoxRegistry::entry(Handle h) {
+    if(h >= entries.size()) {
+      throw BadLookup(name, std::to_string(h), "is not a valid handle");
+    }
+    return entries[h];
+  }
+
+  std::vector<std::string> MailBoxRegistry::splitTopic(const std::string & topic, bool wildcards_ok) {
+    // split by hand: splitVec squashes spaces and drops empty
+    // fields, so "a..b" and "a.b." would quietly become "a.b".
+    std::vector<std::string> levels;
+    std::string::size_type start = 0;
+    while(true) {
+      auto dot = topic.find('.', start);
+      if(dot == std::string::npos) {
+	levels.push_back(topic.substr(start));
+	break;
+      }
+      levels.push_back(topic.substr(start, dot - start));
+      start = dot + 1;
+    }
+    for(auto & l : levels) {
+      if(l.empty()) throw BadTopic(name, topic);
+      for(auto c : l) {
+	if(std::isspace(static_cast<unsigned char>(c))) throw BadTopic(name, topic);
+      }
+      bool is_wild = (l == "*") || (l == "**");
+      if((l.find('*') != std::string::npos) && !(wildcards_ok && is_wild)) {
+	throw BadTopic(name, topic);
+      }
+    }
+    return levels;
+  }
+
+  void MailBoxRegistry::matchNode(Node * node, const std::vector<std::string> & pattern,
+				  unsigned int pos,
+				  std::vector<bool> & seen, std::vector<Handle> & ret) {
+    if(pos == pattern.size()) {
+      // "**" can match more than one way, so don't report a topic twice.
+      if((node->handle >= 0) && !seen[node->handle] &&
+	 (entries[node->handle].base != nullptr)) {
+	seen[node->handle] = true;
+	ret.push_back(Handle(node->handle));
+      }
+      return;
+    }
+
+    auto & lev = pattern[pos];
+    if(lev == "**") {
+      // match no levels here...
+      matchNode(node, pattern, pos + 1, seen, ret);
+      // ...or one or more.
+      for(auto & c : node->children) {
+	matchNode(c.second.get(), pattern, pos, seen, ret);
+      }
+    }
+    else if(lev == "*") {
+      for(auto & c : node->children) {
+	matchNode(c.second.get(), pattern, pos + 1, seen, ret);
+      }
+    }
+    else {
+      auto it = node->children.find(lev);
+      if(it != node->children.end()) {
+	matchNode(it->second.get(), pattern, pos + 1, seen, ret);
+      }
+    }
+  }
+
+  bool MailBoxRegistry::matchLevels(const std::vector<std::string> & topic, unsigned int tpos,
+				    const std::vector<std::string> & pattern, unsigned int ppos) {
+    if(ppos == pattern.size()) return tpos == topic.size();
+    if(pattern[ppos] == "**") {
+      for(unsigned int t = tpos; t <= topic.size(); t++) {
+	if(matchLevels(topic, t, pattern, ppos + 1)) return true;
+      }
+      return false;
+    }
+    if(tpos == topic.size()) return false;
+    if((pattern[ppos] != "*") && (pattern[ppos] != topic[tpos])) return false;
+    return matchLevels(topic, tpos + 1, pattern, ppos + 1);
+  }
+
+  std::vector<std::function<void(MailBoxRegistry::Handle)>> MailBoxRegistry::watchersFor(Handle h) {
+    std::vector<std::function<void(Handle)>> ret;
+    auto & levels = entries[h].levels;
+    for(auto & w : watchers) {
+      if(matchLevels(levels, 0, w.pattern, 0)) ret.push_back(w.callback);
+    }
+    return ret;
+  }
+
+  MailBoxRegistryPtr makeMailBoxRegistry(const std::string & name) {
+    return std::make_shared<MailBoxRegistry>(name);
+  }
+}
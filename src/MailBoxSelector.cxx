@@ -0,0 +1,79 @@
+#include "MailBoxSelector.hxx"
+
+/*
+BSD 2-Clause License
+
+Copyright (c) 2026, Matt Reilly - kb1vc
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+namespace SoDa {
+  MailBoxSelector::MailBoxSelector(const std::string & name) :
+    name(name), state(std::make_shared<State>()) {
+    next = 0;
+  }
+
+  std::vector<unsigned int> MailBoxSelector::ready() {
+    std::vector<unsigned int> ret;
+    unsigned int n = ready_checks.size();
+    for(unsigned int i = 0; i < n; i++) {
+      unsigned int idx = (next + i) % n;
+      if(ready_checks[idx]()) ret.push_back(idx);
+    }
+    // whoever was served first this time goes to the back of the line.
+    if(!ret.empty()) next = (ret[0] + 1) % n;
+    return ret;
+  }
+
+  std::vector<unsigned int> MailBoxSelector::waitAny(const std::chrono::duration<long, std::micro> & timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while(true) {
+      // Clear the flag before we look. Any mail that arrives after
+      // we've looked will set it again, and we won't sleep through it.
+      {
+	std::lock_guard<std::mutex> lock(state->mtx);
+	state->signaled = false;
+      }
+
+      // The ready checks take the mailbox locks. Don't hold our own
+      // lock while we do that, as the mailboxes call us with theirs held.
+      auto ret = ready();
+      if(!ret.empty()) return ret;
+
+      std::unique_lock<std::mutex> lock(state->mtx);
+      auto signaled = [this]() { return state->signaled; };
+      if(timeout.count() == 0) {
+	state->cv.wait(lock, signaled);
+      }
+      else if(!state->cv.wait_until(lock, deadline, signaled)) {
+	return ret;
+      }
+    }
+  }
+
+  MailBoxSelectorPtr makeMailBoxSelector(const std::string & name) {
+    return std::make_shared<MailBoxSelector>(name);
+  }
+}
@@ -0,0 +1,129 @@
+#include "Pipeline.hxx"
+
+/*
+BSD 2-Clause License
+
+Copyright (c) 2026, Matt Reilly - kb1vc
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+namespace SoDa {
+  StageBase::StageBase(const std::string & name, unsigned int replicas, unsigned int batch) :
+    name(name), replicas(replicas), batch(batch) {
+    if(replicas == 0) throw Exception(name, "needs at least one replica");
+    if(batch == 0) this->batch = 1;
+    stopping = false;
+    running = false;
+    processed = 0;
+    produced = 0;
+    busy_ns = 0;
+    failed = 0;
+    evicted = 0;
+  }
+
+  void StageBase::start() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if(running) throw Exception(name, "start() the stage is already running");
+    // subscribe everyone before any worker starts, so that nothing
+    // put after start returns can be missed.
+    for(unsigned int i = 0; i < replicas; i++) subscribeWorker(i);
+    stopping = false;
+    start_time = std::chrono::steady_clock::now();
+    running = true;
+    for(unsigned int i = 0; i < replicas; i++) {
+      workers.push_back(std::thread(&StageBase::work, this, i));
+    }
+  }
+
+  void StageBase::stop() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if(!running) return;
+    stopping = true;
+    wakeWorkers();
+    for(auto & w : workers) w.join();
+    workers.clear();
+    unsubscribeWorkers();
+    stop_time = std::chrono::steady_clock::now();
+    running = false;
+  }
+
+  StageStats StageBase::stats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    StageStats ret;
+    ret.name = name;
+    ret.replicas = replicas;
+    ret.processed = processed;
+    ret.produced = produced;
+    ret.failed = failed;
+    ret.evicted = evicted;
+    ret.backlog = running ? backlog() : 0;
+    auto end = running ? std::chrono::steady_clock::now() : stop_time;
+    double wall = std::chrono::duration<double, std::nano>(end - start_time).count() * replicas;
+    ret.utilization = (wall > 0.0) ? (double(busy_ns) / wall) : 0.0;
+    return ret;
+  }
+
+  void StageBase::recordBatch(unsigned long in, unsigned long out,
+			      const std::chrono::steady_clock::duration & busy) {
+    processed += in;
+    produced += out;
+    busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count();
+  }
+
+  Pipeline::Pipeline(const std::string & name) : name(name) {
+    running = false;
+  }
+
+  Pipeline::~Pipeline() {
+    stop();
+  }
+
+  void Pipeline::add(StageBasePtr stage) {
+    stages.push_back(stage);
+    if(running && !stage->isRunning()) stage->start();
+  }
+
+  void Pipeline::start() {
+    for(auto it = stages.rbegin(); it != stages.rend(); ++it) {
+      if(!(*it)->isRunning()) (*it)->start();
+    }
+    running = true;
+  }
+
+  void Pipeline::stop() {
+    for(auto & s : stages) s->stop();
+    running = false;
+  }
+
+  std::vector<StageStats> Pipeline::stats() {
+    std::vector<StageStats> ret;
+    for(auto & s : stages) ret.push_back(s->stats());
+    return ret;
+  }
+
+  PipelinePtr makePipeline(const std::string & name) {
+    return std::make_shared<Pipeline>(name);
+  }
+}
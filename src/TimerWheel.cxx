@@ -0,0 +1,238 @@
+#include "TimerWheel.hxx"
+
+/*
+BSD 2-Clause License
+
+Copyright (c) 2026, Matt Reilly - kb1vc
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+namespace SoDa {
+  TimerWheel::TimerWheel(const std::string & name,
+			 const std::chrono::duration<long, std::micro> & tick) :
+    name(name), tick(std::chrono::duration_cast<Clock::duration>(tick)) {
+    if(this->tick.count() <= 0) this->tick = std::chrono::milliseconds(1);
+    epoch = Clock::now();
+    free_head = -1;
+    for(auto & h : heads) h = -1;
+    for(auto & c : level_count) c = 0;
+    num_pending = 0;
+    current = 0;
+    wake_tick = ~uint64_t(0);
+    stopping = false;
+    service_thread = std::thread(&TimerWheel::serviceLoop, this);
+  }
+
+  TimerWheel::~TimerWheel() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stopping = true;
+      cv.notify_one();
+    }
+    service_thread.join();
+  }
+
+  TimerWheel::TimerID TimerWheel::schedule(const Clock::time_point & when,
+					   const std::function<void()> & callback) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if(num_pending == 0) {
+      // the wheel is empty, so it is safe to skip the ticks that went
+      // by while it was idle.
+      auto now_tick = uint64_t((Clock::now() - epoch) / tick);
+      if(now_tick > current) current = now_tick;
+    }
+    int idx = allocNode();
+    auto & n = nodes[idx];
+    n.callback = callback;
+    n.expire = tickOf(when);
+    if(n.expire < current) n.expire = current;
+    insert(idx);
+    num_pending++;
+    if(n.expire < wake_tick) cv.notify_one();
+    return (TimerID(n.generation) << 32) | TimerID(idx);
+  }
+
+  TimerWheel::TimerID TimerWheel::scheduleAfter(const std::chrono::duration<long, std::micro> & delay,
+						const std::function<void()> & callback) {
+    return schedule(Clock::now() + delay, callback);
+  }
+
+  bool TimerWheel::cancel(TimerID id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    uint32_t idx = uint32_t(id & 0xffffffff);
+    uint32_t gen = uint32_t(id >> 32);
+    if((idx >= nodes.size()) || (nodes[idx].slot < 0) || (nodes[idx].generation != gen)) {
+      return false;
+    }
+    unlink(idx);
+    freeNode(idx);
+    num_pending--;
+    return true;
+  }
+
+  unsigned long TimerWheel::pending() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return num_pending;
+  }
+
+  TimerWheel & TimerWheel::shared() {
+    static TimerWheel wheel("shared");
+    return wheel;
+  }
+
+  uint64_t TimerWheel::tickOf(const Clock::time_point & when) {
+    // round up, so that a timer never fires early.
+    auto d = when - epoch;
+    if(d.count() <= 0) return 0;
+    return uint64_t((d + tick - Clock::duration(1)) / tick);
+  }
+
+  TimerWheel::Clock::time_point TimerWheel::timeOf(uint64_t t) {
+    return epoch + tick * t;
+  }
+
+  void TimerWheel::insert(int idx) {
+    auto & n = nodes[idx];
+    uint64_t e = n.expire;
+    uint64_t delta = e - current;
+    unsigned int level = 0;
+    while((level < (num_levels - 1)) && (delta >= (uint64_t(1) << (slot_bits * (level + 1))))) {
+      level++;
+    }
+    if(delta >= (uint64_t(1) << (slot_bits * num_levels))) {
+      // too far out to see. Park it in the last slot the top wheel
+      // can reach; it will be looked at again when that comes around.
+      e = current + (uint64_t(1) << (slot_bits * num_levels)) - 1;
+    }
+    int slot = int(level * num_slots + ((e >> (slot_bits * level)) & slot_mask));
+    n.slot = slot;
+    n.prev = -1;
+    n.next = heads[slot];
+    if(n.next >= 0) nodes[n.next].prev = idx;
+    heads[slot] = idx;
+    level_count[level]++;
+  }
+
+  void TimerWheel::unlink(int idx) {
+    auto & n = nodes[idx];
+    if(n.prev >= 0) nodes[n.prev].next = n.next;
+    else heads[n.slot] = n.next;
+    if(n.next >= 0) nodes[n.next].prev = n.prev;
+    level_count[n.slot / num_slots]--;
+    n.prev = n.next = -1;
+  }
+
+  int TimerWheel::allocNode() {
+    if(free_head < 0) {
+      nodes.push_back(Node());
+      return int(nodes.size() - 1);
+    }
+    int ret = free_head;
+    free_head = nodes[ret].next;
+    nodes[ret].next = -1;
+    return ret;
+  }
+
+  void TimerWheel::freeNode(int idx) {
+    auto & n = nodes[idx];
+    n.callback = nullptr;
+    n.generation++;
+    n.slot = -1;
+    n.prev = -1;
+    n.next = free_head;
+    free_head = idx;
+  }
+
+  void TimerWheel::cascade(unsigned int level) {
+    int slot = int(level * num_slots + ((current >> (slot_bits * level)) & slot_mask));
+    int idx = heads[slot];
+    heads[slot] = -1;
+    while(idx >= 0) {
+      int next = nodes[idx].next;
+      level_count[level]--;
+      insert(idx);
+      idx = next;
+    }
+  }
+
+  void TimerWheel::advance(std::vector<std::function<void()>> & fired) {
+    if((current & slot_mask) == 0) {
+      // the bottom wheel has come around. Refill it from the one
+      // above, and so on up as long as each one has come around too.
+      for(unsigned int level = 1; level < num_levels; level++) {
+	cascade(level);
+	if(((current >> (slot_bits * level)) & slot_mask) != 0) break;
+      }
+    }
+    int slot = int(current & slot_mask);
+    int idx = heads[slot];
+    heads[slot] = -1;
+    while(idx >= 0) {
+      int next = nodes[idx].next;
+      level_count[0]--;
+      fired.push_back(std::move(nodes[idx].callback));
+      freeNode(idx);
+      num_pending--;
+      idx = next;
+    }
+    current++;
+  }
+
+  void TimerWheel::serviceLoop() {
+    std::vector<std::function<void()>> fired;
+    std::unique_lock<std::mutex> lock(mtx);
+    while(!stopping) {
+      if(num_pending == 0) {
+	wake_tick = ~uint64_t(0);
+	cv.wait(lock);
+	continue;
+      }
+
+      auto now_tick = uint64_t((Clock::now() - epoch) / tick);
+      while((current <= now_tick) && (num_pending != 0) && !stopping) {
+	advance(fired);
+	if(!fired.empty()) {
+	  // run the callbacks without the lock, so they can schedule more.
+	  lock.unlock();
+	  for(auto & f : fired) f();
+	  fired.clear();
+	  lock.lock();
+	}
+      }
+      if(stopping || (num_pending == 0)) continue;
+
+      // If nothing is in the bottom wheel, nothing can fire until it
+      // comes around again.
+      if((level_count[0] != 0) || ((current & slot_mask) == 0)) {
+	wake_tick = current;
+      }
+      else {
+	wake_tick = (current | slot_mask) + 1;
+      }
+      cv.wait_until(lock, timeOf(wake_tick));
+    }
+  }
+}
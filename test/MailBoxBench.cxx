@@ -0,0 +1,307 @@
+#include "../include/MailBox.hxx"
+#include "../include/LockFreeMailBox.hxx"
+#include "../include/BroadcastMailBox.hxx"
+#include "../include/Format.hxx"
+#include "../include/Options.hxx"
+#include "../include/Barrier.hxx"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <list>
+#include <algorithm>
+
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2026, Matt Reilly - kb1vc
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// MailBoxBench -- throughput and latency for the mailbox engines.
+//
+// Producer threads put timestamped messages, consumer threads get
+// them and note how long each one took to arrive. When the rings
+// hold a whole run (ring 0), each producer also subscribes, and
+// drains its own queue after each batch, so the echo and no-echo
+// paths both get exercised. With a smaller ring, only the consumers
+// subscribe, and the producers wait for them when the ring fills.
+//
+// Every combination of the swept parameters is run, and each run
+// prints one line of comma separated values on stdout:
+//
+// engine,producers,consumers,payload,batch,echo,ring,msgs,seconds,msgs_per_sec,p50_us,p99_us,p999_us
+//
+// msgs is the number of messages delivered to consumers, and
+// msgs_per_sec is that divided by the run time.
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchMsg {
+  BenchMsg(int payload_size) : payload(payload_size) {
+    stamp = Clock::now();
+  }
+  Clock::time_point stamp;
+  std::vector<char> payload;
+};
+
+typedef std::shared_ptr<BenchMsg> BenchMsgPtr;
+
+struct RunParams {
+  std::string engine;
+  int producers;
+  int consumers;
+  int payload;
+  int batch;
+  bool echo;
+  int msgs;
+  int ring;
+};
+
+template<typename MBoxPtr>
+void producer(MBoxPtr mbox_p, const RunParams & rp, SoDa::BarrierPtr start_p) {
+  // A producer stuck in put can't read its own subscription, and on
+  // a ring that is smaller than a run it would hold the ring up for
+  // everyone, itself included. So producers only listen when the
+  // rings hold a whole run. Otherwise the consumers alone push back.
+  bool listen = (rp.ring == 0);
+  decltype(mbox_p->subscribe()) subs;
+  if(listen) subs = mbox_p->subscribe();
+  bool skip_own = listen && !rp.echo;
+  std::vector<BenchMsgPtr> out;
+  std::vector<BenchMsgPtr> mine;
+  start_p->wait();
+
+  for(int i = 0; i < rp.msgs; i += rp.batch) {
+    int n = std::min(rp.batch, rp.msgs - i);
+    if(n == 1) {
+      auto m = std::make_shared<BenchMsg>(rp.payload);
+      if(skip_own) mbox_p->put(m, subs);
+      else mbox_p->put(m);
+    }
+    else {
+      out.clear();
+      for(int j = 0; j < n; j++) {
+	out.push_back(std::make_shared<BenchMsg>(rp.payload));
+      }
+      if(skip_own) mbox_p->putBatch(out.begin(), out.end(), subs);
+      else mbox_p->putBatch(out.begin(), out.end());
+    }
+    // keep our own queue from growing without bound.
+    if(listen) {
+      mine.clear();
+      mbox_p->getBatch(subs, mine);
+    }
+  }
+  // wait for the consumers to finish before we unsubscribe, so that
+  // the subscriber list is stable for the whole run.
+  start_p->wait();
+}
+
+template<typename MBoxPtr>
+void consumer(MBoxPtr mbox_p, const RunParams & rp, SoDa::BarrierPtr start_p,
+	      std::vector<double> * latencies, bool * timed_out) {
+  auto subs = mbox_p->subscribe();
+  long expected = long(rp.msgs) * rp.producers;
+  latencies->reserve(expected);
+  std::vector<BenchMsgPtr> in;
+  start_p->wait();
+
+  long got = 0;
+  while(got < expected) {
+    auto m = mbox_p->waitGet(subs, std::chrono::seconds(10));
+    if(m == nullptr) {
+      *timed_out = true;
+      break;
+    }
+    auto now = Clock::now();
+    latencies->push_back(std::chrono::duration<double, std::micro>(now - m->stamp).count());
+    got++;
+    if(rp.batch > 1) {
+      in.clear();
+      mbox_p->getBatch(subs, in, rp.batch - 1);
+      now = Clock::now();
+      for(auto & b : in) {
+	latencies->push_back(std::chrono::duration<double, std::micro>(now - b->stamp).count());
+      }
+      got += in.size();
+    }
+  }
+  start_p->wait();
+}
+
+double percentile(const std::vector<double> & sorted, double p) {
+  if(sorted.empty()) return 0.0;
+  size_t idx = size_t(p * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+template<typename MBoxPtr>
+bool runOne(MBoxPtr mbox_p, const RunParams & rp) {
+  // everyone waits at the barrier twice: once to start, once when done.
+  auto start_p = SoDa::makeBarrier("bench", rp.producers + rp.consumers + 1);
+  std::vector<std::vector<double>> latencies(rp.consumers);
+  std::unique_ptr<bool[]> timed_out(new bool[rp.consumers]);
+  std::list<std::thread *> threads;
+  for(int i = 0; i < rp.consumers; i++) {
+    timed_out[i] = false;
+    threads.push_back(new std::thread(consumer<MBoxPtr>, mbox_p, std::cref(rp), start_p,
+				      &latencies[i], &timed_out[i]));
+  }
+  for(int i = 0; i < rp.producers; i++) {
+    threads.push_back(new std::thread(producer<MBoxPtr>, mbox_p, std::cref(rp), start_p));
+  }
+
+  start_p->wait(std::chrono::seconds(60));
+  auto t0 = Clock::now();
+  start_p->wait(std::chrono::seconds(600));
+  auto t1 = Clock::now();
+  for(auto t : threads) {
+    t->join();
+    delete t;
+  }
+
+  std::vector<double> all;
+  bool ok = true;
+  for(int i = 0; i < rp.consumers; i++) {
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+    if(timed_out[i]) ok = false;
+  }
+  std::sort(all.begin(), all.end());
+
+  double secs = std::chrono::duration<double>(t1 - t0).count();
+  std::cout << SoDa::Format("%0,%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11,%12\n")
+    .addS(rp.engine)
+    .addI(rp.producers)
+    .addI(rp.consumers)
+    .addI(rp.payload)
+    .addI(rp.batch)
+    .addI(rp.echo ? 1 : 0)
+    .addI(rp.ring)
+    .addU(all.size())
+    // width 1, so that Format doesn't pad the fields.
+    .addF(secs, 'f', 1, 6)
+    .addF(double(all.size()) / secs, 'f', 1, 3)
+    .addF(percentile(all, 0.5), 'f', 1, 3)
+    .addF(percentile(all, 0.99), 'f', 1, 3)
+    .addF(percentile(all, 0.999), 'f', 1, 3);
+  if(!ok) {
+    std::cerr << SoDa::Format("%0 run with %1 producers and %2 consumers timed out\n")
+      .addS(rp.engine).addI(rp.producers).addI(rp.consumers);
+  }
+  return ok;
+}
+
+bool runEngine(const RunParams & rp) {
+  // A ring size of zero means room for a whole run, so the producers
+  // never wait for the consumers. The locked mailboxes get no limit.
+  unsigned int ring = (rp.ring == 0) ? (rp.msgs * rp.producers + rp.batch) : rp.ring;
+  unsigned int subs = rp.producers + rp.consumers;
+  if(rp.engine == "lockfree") {
+    return runOne(SoDa::makeLockFreeMailBox<BenchMsg>("bench", ring, subs), rp);
+  }
+  else if(rp.engine == "broadcast") {
+    return runOne(SoDa::makeBroadcastMailBox<BenchMsg>("bench", ring, subs), rp);
+  }
+  else if(rp.engine == "coalesced") {
+    // a 50 us budget needs a finer tick than the shared wheel has.
+    static SoDa::TimerWheel wheel("bench", std::chrono::microseconds(10));
+    auto mbox_p = SoDa::makeMailBox<BenchMsg>("bench");
+    if(rp.ring != 0) mbox_p->setCapacity(rp.ring);
+    mbox_p->setCoalescing(64, std::chrono::microseconds(50), wheel);
+    return runOne(mbox_p, rp);
+  }
+  else {
+    auto mbox_p = SoDa::makeMailBox<BenchMsg>("bench");
+    if(rp.ring != 0) mbox_p->setCapacity(rp.ring);
+    return runOne(mbox_p, rp);
+  }
+}
+
+template<typename T>
+void defaultTo(std::vector<T> & v, std::initializer_list<T> dflt) {
+  if(v.empty()) v = dflt;
+}
+
+int main(int argc, char ** argv) {
+  SoDa::Options cmd;
+  std::vector<std::string> engines;
+  std::vector<int> producers, consumers, payloads, batches, echoes, rings;
+  int msgs;
+  cmd.addV<std::string>(&engines, "engine", 'e', "Mailbox engine to run: locked, lockfree, broadcast, or coalesced. May be repeated.")
+    .addV<int>(&producers, "producers", 'p', "Number of producer threads. May be repeated.")
+    .addV<int>(&consumers, "consumers", 'c', "Number of consumer threads. May be repeated.")
+    .addV<int>(&payloads, "payload", 's', "Payload size in bytes. May be repeated.")
+    .addV<int>(&batches, "batch", 'b', "Messages per putBatch/getBatch. May be repeated.")
+    .addV<int>(&echoes, "echo", 'E', "1 to deliver a producer's messages to itself, 0 not to. May be repeated.")
+    .addV<int>(&rings, "ring", 'r', "Ring size, or queue limit for the locked engines. 0 holds a whole run. May be repeated.")
+    .add<int>(&msgs, "msgs", 'm', 10000, "Messages sent by each producer in each run.")
+    .addInfo("Sweep the mailbox engines over every combination of the parameters.\n"
+	     "Results go to stdout, one comma separated line per run.");
+
+  if(!cmd.parse(argc, argv)) exit(-1);
+
+  defaultTo(engines, {std::string("locked"), std::string("lockfree"), std::string("broadcast"),
+		       std::string("coalesced")});
+  defaultTo(producers, {1, 4});
+  defaultTo(consumers, {1, 4});
+  defaultTo(payloads, {16, 4096});
+  defaultTo(batches, {1, 32});
+  defaultTo(echoes, {0, 1});
+  defaultTo(rings, {0, 256});
+
+  std::cout << "engine,producers,consumers,payload,batch,echo,ring,msgs,seconds,msgs_per_sec,p50_us,p99_us,p999_us\n";
+
+  bool ok = true;
+  RunParams rp;
+  rp.msgs = msgs;
+  for(auto & e : engines) {
+    rp.engine = e;
+    for(auto p : producers) {
+      rp.producers = p;
+      for(auto c : consumers) {
+	rp.consumers = c;
+	for(auto s : payloads) {
+	  rp.payload = s;
+	  for(auto b : batches) {
+	    rp.batch = (b < 1) ? 1 : b;
+	    for(auto ec : echoes) {
+	      rp.echo = (ec != 0);
+	      for(auto r : rings) {
+		rp.ring = (r < 0) ? 0 : r;
+		ok = runEngine(rp) && ok;
+	      }
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+  if(!ok) {
+    std::cerr << "FAIL\n";
+    exit(-1);
+  }
+}
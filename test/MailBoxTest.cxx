@@ -1,4 +1,16 @@
 #include "../include/MailBox.hxx"
+#include "../include/LockFreeMailBox.hxx"
+#include "../include/BroadcastMailBox.hxx"
+#include "../include/PooledMailBox.hxx"
+#include "../include/MailBoxSelector.hxx"
+#include "../include/MailBoxRegistry.hxx"
+#include "../include/MergedReader.hxx"
+#include "../include/Pipeline.hxx"
+#include "../include/TimerWheel.hxx"
+#include "../include/SharedMailBox.hxx"
+#include "../include/Executor.hxx"
+#include "../include/MultiMailBox.hxx"
+#include "../include/Journal.hxx"
 #include <memory>
 #include "../include/Format.hxx"
 #include "../include/Options.hxx"
@@ -7,7 +19,13 @@
 #include <iostream>
 #include <thread>
 #include <functional>
+#include <stdexcept>
 #include <chrono>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 std::mutex mtx;
 
@@ -33,12 +51,24 @@ public:
 
 unsigned int MyMsg::tot_active = 0;
 
-int objMailBoxTest(SoDa::MailBoxPtr<MyMsg> mailbox_p, 
+// The pooled mailbox hands out its own messages.
+template<typename MBoxPtr>
+std::shared_ptr<MyMsg> makeTestMsg(MBoxPtr, int from, int v) {
+  return MyMsg::makeMsg(from, v);
+}
+
+SoDa::PooledPtr<MyMsg> makeTestMsg(SoDa::PooledMailBoxPtr<MyMsg> mailbox_p, int from, int v) {
+  return mailbox_p->make(from, v);
+}
+
+template<typename MBoxPtr>
+int objMailBoxTest(MBoxPtr mailbox_p, 
 		   int num_msgs, int num_threads, 
 		   int my_id, 
 		   std::shared_ptr<SoDa::Barrier> barrier_p, 
 		   int num_trials, 
-		   bool no_echo) {
+		   bool no_echo, 
+		   bool sync_trials) {
 
   //! [subscribe and wait]
   auto subs = mailbox_p->subscribe();
@@ -49,7 +79,7 @@ int objMailBoxTest(SoDa::MailBoxPtr<MyMsg> mailbox_p,
     // push some messages
     //! [send messages]
     for(int i = 0; i < num_msgs; i++) {
-      auto msg = MyMsg::makeMsg(my_id, i);
+      auto msg = makeTestMsg(mailbox_p, my_id, i);
       if(no_echo) {
 	mailbox_p->put(msg, subs);
       }
@@ -67,14 +97,17 @@ int objMailBoxTest(SoDa::MailBoxPtr<MyMsg> mailbox_p,
     unsigned long expected_msgs = num_msgs * num_threads;
     if(no_echo) expected_msgs -= num_msgs; 
 
-    for(int i = 0; i < expected_msgs;) {
+    for(int i = 0; i < expected_msgs; i++) {
       //! [get message]
-      auto p = mailbox_p->get(subs);
-      if(p != nullptr) {
-	i++;
-	msg_sum += p->v;
-	sender_sum += p->from;
+      auto p = mailbox_p->waitGet(subs, std::chrono::seconds(10));
+      if(p == nullptr) {
+	std::cerr << SoDa::Format("subscriber %0 timed out waiting for message %1\n")
+	  .addI(my_id)
+	  .addI(i);
+	return -1; 
       }
+      msg_sum += p->v;
+      sender_sum += p->from;
       //! [get message]    
     }
 
@@ -91,9 +124,11 @@ int objMailBoxTest(SoDa::MailBoxPtr<MyMsg> mailbox_p,
 	.addU(expected_sum);
       return -1;
     }
+
+    if(sync_trials) barrier_p->wait();
   }
 
-  std::shared_ptr<MyMsg> p; 
+  decltype(mailbox_p->get(subs)) p; 
   while((p = mailbox_p->get(subs)) != nullptr) {
     std::cerr << SoDa::Format("subscriber %0 got extra message from subscriber %1 : %2\n")
       .addI(my_id)
@@ -106,15 +141,9 @@ int objMailBoxTest(SoDa::MailBoxPtr<MyMsg> mailbox_p,
 }
 
   
-int testObjMessage(int msg_count, int num_threads, int num_trials, bool no_echo) {
-  //! [create a mailbox]
-  SoDa::MailBoxPtr<MyMsg> mailbox_p = SoDa::makeMailBox<MyMsg>("MessageMailbox");
-  //! [create a mailbox]
-
-  // Just testing the pointer conversion to make sure we can build
-  // tables of mailboxes that do the right thing. 
-  std::shared_ptr<SoDa::MailBoxBase> mb_p = mailbox_p;
-  SoDa::MailBoxPtr<MyMsg> nmm_p = SoDa::MailBoxBase::convert<SoDa::MailBox<MyMsg>>(mb_p);
+template<typename MBoxPtr>
+int testObjMessage(MBoxPtr mailbox_p, int msg_count, int num_threads, int num_trials, bool no_echo, 
+		   bool sync_trials = false) {
 
   //! [create a barrier]
   // each thread will wait at the barrier until everyone has finished
@@ -129,14 +158,15 @@ int testObjMessage(int msg_count, int num_threads, int num_trials, bool no_echo)
 
   //! [create threads]
   for(int i = 0; i < num_threads; i++) {
-    threads.push_back(new std::thread(objMailBoxTest,
+    threads.push_back(new std::thread(objMailBoxTest<MBoxPtr>,
 				      mailbox_p,
 				      msg_count, 
 				      num_threads,
 				      i,
 				      barrier_p, 
 				      num_trials,
-				      no_echo));
+				      no_echo, 
+				      sync_trials));
   }
   //! [create threads]  
   std::cerr << SoDa::Format("Waiting to join threads\n");
@@ -175,27 +205,1742 @@ void testMBoxConversion() {
   }
 }
 
+void testMBoxWait() {
+  SoDa::MailBoxPtr<MyMsg> mailbox_p = SoDa::makeMailBox<MyMsg>("WaitMailbox");
+  auto subs = mailbox_p->subscribe();
+
+  // nothing there -- we should time out
+  auto p = mailbox_p->waitGet(subs, std::chrono::milliseconds(10));
+  if(p != nullptr) {
+    std::cerr << "testMBoxWait: waitGet on an empty mailbox returned a message\n";
+    exit(-1);
+  }
+
+  // now have another thread deliver a few messages while we wait
+  std::thread sender([mailbox_p]() {
+      for(int i = 0; i < 4; i++) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	mailbox_p->put(MyMsg::makeMsg(0, i));
+      }
+    });
+
+  auto count = mailbox_p->waitReady(subs, 4, std::chrono::seconds(10));
+  sender.join();
+  if(count != 4) {
+    std::cerr << "testMBoxWait: waitReady returned " << count << " expected 4\n";
+    exit(-1);
+  }
+  for(int i = 0; i < 4; i++) {
+    p = mailbox_p->waitGet(subs);
+    if((p == nullptr) || (p->v != i)) {
+      std::cerr << "testMBoxWait: waitGet returned the wrong message\n";
+      exit(-1);
+    }
+  }
+}
+
+void testMBoxOverflow() {
+  SoDa::MailBoxPtr<MyMsg> mailbox_p = SoDa::makeMailBox<MyMsg>("OverflowMailbox");
+
+  // the mailbox-wide limit applies to subscribers that are already there
+  auto oldest = mailbox_p->subscribe();
+  mailbox_p->setCapacity(3, SoDa::MailBoxBase::DROP_OLDEST);
+  auto newest = mailbox_p->subscribe();
+  mailbox_p->setCapacity(newest, 3, SoDa::MailBoxBase::DROP_NEWEST);
+  auto evicted = mailbox_p->subscribe();
+  mailbox_p->setCapacity(evicted, 3, SoDa::MailBoxBase::EVICT);
+
+  for(int i = 0; i < 5; i++) {
+    mailbox_p->put(MyMsg::makeMsg(0, i));
+  }
+
+  for(int i = 0; i < 3; i++) {
+    auto o = mailbox_p->get(oldest);
+    auto n = mailbox_p->get(newest);
+    if((o->v != (i + 2)) || (n->v != i)) {
+      std::cerr << "testMBoxOverflow: dropped the wrong messages\n";
+      exit(-1);
+    }
+  }
+
+  bool was_evicted = false; 
+  try {
+    mailbox_p->get(evicted);
+  }
+  catch (SoDa::MailBoxBase::SubscriberEvicted & e) {
+    was_evicted = true; 
+  }
+  
+  if(!was_evicted || 
+     (mailbox_p->droppedCount(oldest) != 2) || 
+     (mailbox_p->droppedCount(newest) != 2) ||
+     (mailbox_p->droppedCount(evicted) != 4) || 
+     (mailbox_p->droppedCount() != 8)) {
+    std::cerr << "testMBoxOverflow: bad eviction or drop counts\n";
+    exit(-1);
+  }
+
+  // now make sure that a producer waits for a slow consumer
+  SoDa::MailBoxPtr<MyMsg> block_p = SoDa::makeMailBox<MyMsg>("BlockingMailbox");
+  block_p->setCapacity(2);
+  auto reader = block_p->subscribe();
+  std::thread sender([block_p]() {
+      for(int i = 0; i < 6; i++) {
+	block_p->put(MyMsg::makeMsg(0, i));
+      }
+    });
+  for(int i = 0; i < 6; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if(block_p->readyCount(reader) > 2) {
+      std::cerr << "testMBoxOverflow: queue grew past its capacity\n";
+      exit(-1);
+    }
+    auto p = block_p->waitGet(reader, std::chrono::seconds(10));
+    if((p == nullptr) || (p->v != i)) {
+      std::cerr << "testMBoxOverflow: blocking put lost a message\n";
+      exit(-1);
+    }
+  }
+  sender.join();
+  if(block_p->droppedCount() != 0) {
+    std::cerr << "testMBoxOverflow: blocking put dropped a message\n";
+    exit(-1);
+  }
+}
+
+template<typename MBoxPtr>
+void testMBoxBatch(MBoxPtr mailbox_p, const std::string & engine) {
+  auto sender = mailbox_p->subscribe();
+  auto reader = mailbox_p->subscribe();
+
+  std::vector<std::shared_ptr<MyMsg>> burst;
+  for(int i = 0; i < 10; i++) {
+    burst.push_back(MyMsg::makeMsg(0, i));
+  }
+  // the sender should not see its own burst
+  mailbox_p->putBatch(burst.begin(), burst.end(), sender);
+  if(mailbox_p->get(sender) != nullptr) {
+    std::cerr << "testMBoxBatch: " << engine << " sender saw its own batch\n";
+    exit(-1);
+  }
+
+  std::vector<std::shared_ptr<MyMsg>> got; 
+  auto count = mailbox_p->getBatch(reader, got, 4);
+  if((count != 4) || (got.size() != 4) || (got[3]->v != 3)) {
+    std::cerr << "testMBoxBatch: " << engine << " getBatch returned the wrong messages\n";
+    exit(-1);
+  }
+
+  int expect = 4; 
+  count = mailbox_p->drain(reader, [&expect, engine](std::shared_ptr<MyMsg> p) {
+      if(p->v != expect) {
+	std::cerr << "testMBoxBatch: " << engine << " drain out of order\n";
+	exit(-1);
+      }
+      expect++;
+    });
+  if((count != 6) || (mailbox_p->get(reader) != nullptr)) {
+    std::cerr << "testMBoxBatch: " << engine << " drain didn't empty the mailbox\n";
+    exit(-1);
+  }
+}
+
+void testMBoxFilter() {
+  SoDa::MailBoxPtr<MyMsg> mailbox_p = SoDa::makeMailBox<MyMsg>("FilterMailbox");
+  auto all = mailbox_p->subscribe();
+  auto evens = mailbox_p->subscribe([](const MyMsg & m) { return (m.v & 1) == 0; });
+  // a full queue that wouldn't take the message shouldn't block the producer
+  mailbox_p->setCapacity(evens, 5, SoDa::MailBoxBase::BLOCK);
+
+  for(int i = 0; i < 10; i++) {
+    mailbox_p->put(MyMsg::makeMsg(0, i));
+  }
+  if((mailbox_p->readyCount(all) != 10) || (mailbox_p->readyCount(evens) != 5)) {
+    std::cerr << "testMBoxFilter: filter let the wrong messages through\n";
+    exit(-1);
+  }
+  for(int i = 0; i < 10; i += 2) {
+    auto p = mailbox_p->get(evens);
+    if((p == nullptr) || (p->v != i)) {
+      std::cerr << "testMBoxFilter: filtered subscriber got the wrong message\n";
+      exit(-1);
+    }
+  }
+  if(mailbox_p->stats(evens).enqueued != 5) {
+    std::cerr << "testMBoxFilter: rejected messages were counted as enqueued\n";
+    exit(-1);
+  }
+}
+
+void testMBoxGroup() {
+  SoDa::MailBoxPtr<MyMsg> mailbox_p = SoDa::makeMailBox<MyMsg>("GroupMailbox");
+  auto logger = mailbox_p->subscribe();
+  std::vector<SoDa::MailBox<MyMsg>::Subscription> workers;
+  for(int i = 0; i < 3; i++) {
+    workers.push_back(mailbox_p->subscribeGroup("workers"));
+  }
+
+  for(int i = 0; i < 30; i++) {
+    mailbox_p->put(MyMsg::makeMsg(0, i));
+  }
+  if(mailbox_p->readyCount(logger) != 30) {
+    std::cerr << "testMBoxGroup: ordinary subscriber missed group traffic\n";
+    exit(-1);
+  }
+  int sum = 0;
+  for(auto & w : workers) {
+    if(mailbox_p->readyCount(w) != 10) {
+      std::cerr << "testMBoxGroup: work wasn't balanced across the group\n";
+      exit(-1);
+    }
+    while(auto p = mailbox_p->get(w)) sum += p->v;
+  }
+  if(sum != (29 * 30) / 2) {
+    std::cerr << "testMBoxGroup: group members didn't get each message exactly once\n";
+    exit(-1);
+  }
+
+  // now let an idle worker steal from a busy one
+  mailbox_p->setWorkStealing("workers", true);
+  workers.pop_back();
+  for(int i = 0; i < 10; i++) {
+    mailbox_p->put(MyMsg::makeMsg(0, i));
+  }
+  int got = 0;
+  while(mailbox_p->get(workers[0]) != nullptr) got++;
+  if((got != 10) || (mailbox_p->readyCount(workers[1]) != 0)) {
+    std::cerr << "testMBoxGroup: idle worker didn't steal the backlog\n";
+    exit(-1);
+  }
+  // a stolen message moves between queues; it isn't enqueued twice.
+  auto thief = mailbox_p->stats(workers[0]);
+  auto victim = mailbox_p->stats(workers[1]);
+  if((thief.stolen_in != 5) || (victim.stolen_out != 5) || 
+     ((thief.enqueued + victim.enqueued) != 30) || 
+     ((thief.dequeued + victim.dequeued) != 30)) {
+    std::cerr << "testMBoxGroup: stolen messages weren't counted as transfers\n";
+    exit(-1);
+  }
+
+  // a member with a filter only steals what the filter passes.
+  auto picky = mailbox_p->subscribeGroup("picky", [](const MyMsg & m) { return (m.v % 2) == 0; });
+  auto loose = mailbox_p->subscribeGroup("picky");
+  mailbox_p->setWorkStealing("picky", true);
+  for(int i = 1; i < 6; i += 2) mailbox_p->put(MyMsg::makeMsg(0, i));
+  auto pm = mailbox_p->get(picky);
+  if((pm != nullptr) || (mailbox_p->readyCount(loose) != 3)) {
+    std::cerr << "testMBoxGroup: a filtered member stole a message it didn't want\n";
+    exit(-1);
+  }
+
+  // a member asleep with nothing to do is woken when a sibling backs
+  // up. Both messages go to busy: idle doesn't want the first, and
+  // is the sender of the second.
+  auto busy = mailbox_p->subscribeGroup("sleepy");
+  auto idle = mailbox_p->subscribeGroup("sleepy", [](const MyMsg & m) { return (m.v % 2) == 0; });
+  mailbox_p->setWorkStealing("sleepy", true);
+  std::shared_ptr<MyMsg> woke_with; 
+  std::thread sleeper([&]() { 
+      woke_with = mailbox_p->waitGet(idle, std::chrono::seconds(2));
+    });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  mailbox_p->put(MyMsg::makeMsg(0, 1));
+  mailbox_p->put(MyMsg::makeMsg(0, 2), idle);
+  sleeper.join();
+  if((woke_with == nullptr) || (woke_with->v != 2) || (mailbox_p->readyCount(busy) != 1)) {
+    std::cerr << "testMBoxGroup: sleeping member wasn't woken to steal\n";
+    exit(-1);
+  }
+}
+
+void testMBoxConflate() {
+  SoDa::MailBoxPtr<MyMsg> mailbox_p = SoDa::makeMailBox<MyMsg>("ConflateMailbox");
+  auto every = mailbox_p->subscribe();
+  auto latest = mailbox_p->subscribe();
+  auto per_sender = mailbox_p->subscribe();
+  mailbox_p->setConflation(latest, true);
+  mailbox_p->setConflation(per_sender, true, [](const MyMsg & m) { return (long) m.from; });
+
+  for(int i = 0; i < 100; i++) {
+    mailbox_p->put(MyMsg::makeMsg(i % 3, i));
+  }
+  if((mailbox_p->readyCount(every) != 100) || 
+     (mailbox_p->readyCount(latest) != 1) || 
+     (mailbox_p->readyCount(per_sender) != 3)) {
+    std::cerr << "testMBoxConflate: conflated queues kept stale messages\n";
+    exit(-1);
+  }
+  auto p = mailbox_p->get(latest);
+  if((p == nullptr) || (p->v != 99) || (mailbox_p->stats(latest).conflated != 99)) {
+    std::cerr << "testMBoxConflate: didn't keep the newest message\n";
+    exit(-1);
+  }
+  // the first sender to report keeps its place in line
+  for(int i = 0; i < 3; i++) {
+    p = mailbox_p->get(per_sender);
+    if((p == nullptr) || (p->from != i) || (p->v < 97)) {
+      std::cerr << "testMBoxConflate: keyed conflation kept the wrong message\n";
+      exit(-1);
+    }
+  }
+
+  // turning it on for the whole mailbox squeezes what's already there
+  mailbox_p->setConflation(true);
+  if((mailbox_p->readyCount(every) != 1) || (mailbox_p->get(every)->v != 99)) {
+    std::cerr << "testMBoxConflate: setConflation didn't squeeze the waiting messages\n";
+    exit(-1);
+  }
+}
+
+template<typename MBoxPtr>
+void testMBoxWaitStrategy(MBoxPtr mailbox_p, const std::string & engine) {
+  SoDa::WaitStrategy::Kind kinds[] = { SoDa::WaitStrategy::BUSY_SPIN, 
+				       SoDa::WaitStrategy::SPIN_YIELD, 
+				       SoDa::WaitStrategy::SPIN_PARK, 
+				       SoDa::WaitStrategy::TIMED_SPIN };
+  auto subs = mailbox_p->subscribe();
+  for(auto kind : kinds) {
+    mailbox_p->setWaitStrategy(subs, kind, 100);
+
+    // an empty mailbox should still time out
+    if(mailbox_p->waitGet(subs, std::chrono::milliseconds(2)) != nullptr) {
+      std::cerr << "testMBoxWaitStrategy: " << engine << " waitGet on an empty mailbox returned a message\n";
+      exit(-1);
+    }
+    
+    std::thread sender([mailbox_p]() {
+	for(int i = 0; i < 20; i++) {
+	  std::this_thread::sleep_for(std::chrono::microseconds(100));
+	  mailbox_p->put(MyMsg::makeMsg(0, i));
+	}
+      });
+    for(int i = 0; i < 20; i++) {
+      auto p = mailbox_p->waitGet(subs, std::chrono::seconds(10));
+      if((p == nullptr) || (p->v != i)) {
+	std::cerr << "testMBoxWaitStrategy: " << engine << " waitGet returned the wrong message\n";
+	exit(-1);
+      }
+    }
+    sender.join();
+
+    auto st = mailbox_p->waitStats(subs);
+    if((st.timeout != 1) || ((st.spin + st.yield + st.park) > 20) || 
+       ((kind == SoDa::WaitStrategy::BUSY_SPIN) && (st.park != 0))) {
+      std::cerr << "testMBoxWaitStrategy: " << engine << " bad wait counts for strategy " << kind << "\n";
+      exit(-1);
+    }
+  }
+}
+
+void testMBoxSpinWake() {
+  // a subscriber spinning with no timeout still sees an interrupt.
+  // (If it doesn't, the spinner never returns, so don't join it.)
+  auto mailbox_p = SoDa::makeMailBox<MyMsg>("SpinWakeMailbox");
+  auto subs = mailbox_p->subscribe();
+  mailbox_p->setWaitStrategy(subs, SoDa::WaitStrategy::BUSY_SPIN, 100);
+  std::atomic<bool> returned(false), got_msg(false);
+  std::thread spinner([&]() { 
+      got_msg = (mailbox_p->waitGet(subs) != nullptr);
+      returned = true; 
+    });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  mailbox_p->interrupt(subs);
+  for(int i = 0; (i < 200) && !returned; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if(!returned || got_msg) {
+    std::cerr << "testMBoxSpinWake: spinning waitGet missed the interrupt\n";
+    exit(-1);
+  }
+  spinner.join();
+
+  // and stops spinning to steal when a group sibling backs up.
+  auto group_p = SoDa::makeMailBox<MyMsg>("SpinWakeGroup");
+  auto busy = group_p->subscribeGroup("spin");
+  auto idle = group_p->subscribeGroup("spin");
+  group_p->setWorkStealing("spin", true);
+  group_p->setWaitStrategy(idle, SoDa::WaitStrategy::BUSY_SPIN, 100);
+  std::atomic<bool> stole(false);
+  std::thread thief([&]() { stole = (group_p->waitGet(idle) != nullptr); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  // idle is the sender, so both go to busy.
+  group_p->put(MyMsg::makeMsg(0, 1), idle);
+  group_p->put(MyMsg::makeMsg(0, 2), idle);
+  for(int i = 0; (i < 200) && !stole; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if(!stole || (group_p->readyCount(busy) != 1)) {
+    std::cerr << "testMBoxSpinWake: spinning group member didn't steal\n";
+    exit(-1);
+  }
+  thief.join();
+}
+
+void testMBoxSelector() {
+  auto msg_p = SoDa::makeMailBox<MyMsg>("SelectMsgMailbox");
+  auto int_p = SoDa::makeMailBox<int>("SelectIntMailbox");
+  auto str_p = SoDa::makeMailBox<std::string>("SelectStrMailbox");
+  auto msg_subs = msg_p->subscribe();
+  auto int_subs = int_p->subscribe();
+  auto str_subs = str_p->subscribe();
+
+  // mail that arrives before we start watching still counts
+  msg_p->put(MyMsg::makeMsg(0, 1));
+  
+  SoDa::MailBoxSelector sel("Selector");
+  auto msg_idx = sel.add(msg_p, msg_subs);
+  auto int_idx = sel.add(int_p, int_subs);
+  auto str_idx = sel.add(str_p, str_subs);
+
+  auto r = sel.waitAny(std::chrono::seconds(1));
+  if((r.size() != 1) || (r[0] != msg_idx)) {
+    std::cerr << "testMBoxSelector: missed mail that was already waiting\n";
+    exit(-1);
+  }
+  msg_p->get(msg_subs);
+
+  if(!sel.waitAny(std::chrono::milliseconds(2)).empty()) {
+    std::cerr << "testMBoxSelector: nothing was ready, but waitAny said otherwise\n";
+    exit(-1);
+  }
+
+  std::thread sender([str_p]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      str_p->put(std::make_shared<std::string>("hello"));
+    });
+  r = sel.waitAny(std::chrono::seconds(10));
+  sender.join();
+  if((r.size() != 1) || (r[0] != str_idx) || (*(str_p->get(str_subs)) != "hello")) {
+    std::cerr << "testMBoxSelector: didn't wake up for new mail\n";
+    exit(-1);
+  }
+
+  // when everyone is ready, take turns.
+  msg_p->put(MyMsg::makeMsg(0, 2));
+  int_p->put(std::make_shared<int>(3));
+  str_p->put(std::make_shared<std::string>("again"));
+  r = sel.waitAny();
+  auto r2 = sel.waitAny();
+  if((r.size() != 3) || (r2.size() != 3) || (r[0] != msg_idx) || (r2[0] != int_idx)) {
+    std::cerr << "testMBoxSelector: ready list wasn't in fairness order\n";
+    exit(-1);
+  }
+}
+
+void testMBoxMerge() {
+  std::vector<SoDa::MailBoxPtr<MyMsg>> boxes; 
+  std::vector<SoDa::MailBox<MyMsg>::Subscription> subs; 
+  for(int i = 0; i < 3; i++) {
+    boxes.push_back(SoDa::makeMailBox<MyMsg>("MergeMailbox"));
+    subs.push_back(boxes[i]->subscribe());
+  }
+
+  // in put order
+  SoDa::MergedReader<MyMsg> reader("Merge");
+  for(int i = 0; i < 3; i++) reader.add(boxes[i], subs[i]);
+  int order[] = { 2, 0, 0, 1, 2, 1, 1, 0, 2, 2 }; 
+  for(int i = 0; i < 10; i++) {
+    boxes[order[i]]->put(MyMsg::makeMsg(order[i], i));
+    // make sure the stamps differ
+    std::this_thread::sleep_for(std::chrono::microseconds(10));
+  }
+  for(int i = 0; i < 10; i++) {
+    unsigned int src; 
+    auto m = reader.next(src, std::chrono::seconds(1));
+    if((m == nullptr) || (m->v != i) || (int(src) != order[i])) {
+      std::cerr << "testMBoxMerge: expected message " << i << " from mailbox " << order[i] << "\n";
+      exit(-1);
+    }
+  }
+  if((reader.next(std::chrono::milliseconds(1)) != nullptr) || (reader.lateCount() != 0)) {
+    std::cerr << "testMBoxMerge: reader should be empty\n";
+    exit(-1);
+  }
+
+  // in time tag order
+  std::vector<SoDa::MailBox<MyMsg>::Subscription> tsubs; 
+  SoDa::MergedReader<MyMsg> treader("TagMerge", std::chrono::milliseconds(50));
+  treader.setTimeTag([](const MyMsg & m) { 
+      return SoDa::MergedReader<MyMsg>::TimePoint(std::chrono::microseconds(m.v)); 
+    });
+  for(int i = 0; i < 3; i++) tsubs.push_back(boxes[i]->subscribe());
+  // the reader keeps pointers to the subscriptions, so don't add them
+  // until the vector has stopped moving. 
+  for(int i = 0; i < 3; i++) treader.add(boxes[i], tsubs[i]);
+  auto tput = [&boxes](int box, int v) { boxes[box]->put(MyMsg::makeMsg(box, v), nullptr); };
+  tput(0, 1); tput(0, 4); tput(1, 2); tput(1, 5); tput(2, 3);
+  for(int i = 1; i <= 3; i++) {
+    auto m = treader.next(std::chrono::seconds(1));
+    if((m == nullptr) || (m->v != i)) {
+      std::cerr << "testMBoxMerge: expected tag " << i << "\n";
+      exit(-1);
+    }
+  }
+  // mailbox 2 is empty, and the lookahead hasn't expired
+  if(treader.next(std::chrono::milliseconds(1)) != nullptr) {
+    std::cerr << "testMBoxMerge: reader didn't wait for the empty mailbox\n";
+    exit(-1);
+  }
+  tput(2, 6); 
+  auto m = treader.next(std::chrono::seconds(1));
+  if((m == nullptr) || (m->v != 4)) {
+    std::cerr << "testMBoxMerge: expected tag 4\n";
+    exit(-1);
+  }
+  // mailbox 0 is empty now, but 5 will ripen. 
+  m = treader.next(std::chrono::seconds(1));
+  if((m == nullptr) || (m->v != 5)) {
+    std::cerr << "testMBoxMerge: lookahead should have let tag 5 through\n";
+    exit(-1);
+  }
+  // and a straggler is late
+  tput(0, 0); tput(1, 9); 
+  m = treader.next(std::chrono::seconds(1));
+  if((m == nullptr) || (m->v != 0) || (treader.lateCount() != 1)) {
+    std::cerr << "testMBoxMerge: expected a late tag 0\n";
+    exit(-1);
+  }
+
+  // a reader added after a selector mustn't take over its callback
+  auto shared_p = SoDa::makeMailBox<MyMsg>("MergeSelectMailbox");
+  auto shared_subs = shared_p->subscribe();
+  SoDa::MailBoxSelector sel("MergeSelector");
+  sel.add(shared_p, shared_subs);
+  SoDa::MergedReader<MyMsg> sreader("MergeSelect");
+  sreader.add(shared_p, shared_subs);
+  std::thread sender([shared_p]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      shared_p->put(MyMsg::makeMsg(0, 7));
+    });
+  auto r = sel.waitAny(std::chrono::seconds(2));
+  sender.join();
+  m = sreader.next(std::chrono::seconds(1));
+  if(r.empty() || (m == nullptr) || (m->v != 7)) {
+    std::cerr << "testMBoxMerge: reader and selector didn't share the subscription\n";
+    exit(-1);
+  }
+
+  // nor may a selector added after a reader.
+  auto shared2_p = SoDa::makeMailBox<MyMsg>("SelectMergeMailbox");
+  auto shared2_subs = shared2_p->subscribe();
+  SoDa::MergedReader<MyMsg> sreader2("SelectMerge");
+  sreader2.add(shared2_p, shared2_subs);
+  SoDa::MailBoxSelector sel2("SelectMergeSelector");
+  sel2.add(shared2_p, shared2_subs);
+  std::thread sender2([shared2_p]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      shared2_p->put(MyMsg::makeMsg(0, 8));
+    });
+  auto t0 = std::chrono::steady_clock::now();
+  m = sreader2.next(std::chrono::seconds(2));
+  auto took = std::chrono::steady_clock::now() - t0;
+  sender2.join();
+  if((m == nullptr) || (m->v != 8) || (took > std::chrono::seconds(1))) {
+    std::cerr << "testMBoxMerge: a selector took over the reader's callback\n";
+    exit(-1);
+  }
+}
+
+void testMBoxPipeline() {
+  auto src_p = SoDa::makeMailBox<int>("PipeSrc");
+  auto mid_p = SoDa::makeMailBox<long>("PipeMid");
+  auto out_p = SoDa::makeMailBox<std::string>("PipeOut");
+  auto out_subs = out_p->subscribe();
+
+  SoDa::Pipeline pipe("Pipe");
+  // square everything, in three replicas
+  auto sq = pipe.add<int, long>("square", src_p, mid_p, 
+				[](std::shared_ptr<int> v) { 
+				  return std::make_shared<long>(long(*v) * long(*v)); 
+				}, 3);
+  // and drop the odd ones
+  pipe.add<long, std::string>("even", mid_p, out_p, 
+			      [](std::shared_ptr<long> v) { 
+				return ((*v % 2) == 0) ? std::make_shared<std::string>(std::to_string(*v)) : nullptr;
+			      });
+  pipe.start();
+  
+  long expect = 0; 
+  for(int i = 0; i < 1000; i++) {
+    src_p->put(std::make_shared<int>(i));
+    if((i % 2) == 0) expect += long(i) * long(i);
+  }
+  long sum = 0; 
+  for(int i = 0; i < 500; i++) {
+    auto m = out_p->waitGet(out_subs, std::chrono::seconds(10));
+    if(m == nullptr) {
+      std::cerr << "testMBoxPipeline: only got " << i << " results\n";
+      exit(-1);
+    }
+    sum += std::stol(*m);
+  }
+  if(sum != expect) {
+    std::cerr << "testMBoxPipeline: sum was " << sum << " expected " << expect << "\n";
+    exit(-1);
+  }
+
+  // the workers count a batch after they put it, so stop them
+  // before we look. 
+  pipe.stop();
+  auto st = pipe.stats();
+  if((st.size() != 2) || (st[0].name != "square") || (st[0].replicas != 3) || 
+     (st[0].processed != 1000) || (st[1].processed != 1000) || (st[1].produced != 500) ||
+     (st[0].utilization < 0.0) || (st[0].utilization > 1.0)) {
+    std::cerr << "testMBoxPipeline: bad stats\n";
+    exit(-1);
+  }
+  if(sq->isRunning() || (src_p->subscriberCount() != 0)) {
+    std::cerr << "testMBoxPipeline: stop should unsubscribe the workers\n";
+    exit(-1);
+  }
+
+  // a stage function that throws costs one message, not the process.
+  auto bad_p = SoDa::makeMailBox<int>("PipeBad");
+  auto bad_out_p = SoDa::makeMailBox<int>("PipeBadOut");
+  auto bad_subs = bad_out_p->subscribe();
+  SoDa::Pipeline bad_pipe("BadPipe");
+  auto picky = bad_pipe.add<int, int>("picky", bad_p, bad_out_p, 
+				      [](std::shared_ptr<int> v) { 
+					if(*v == 3) throw std::runtime_error("don't like 3");
+					return v;
+				      });
+  bad_pipe.start();
+  for(int i = 0; i < 5; i++) bad_p->put(std::make_shared<int>(i));
+  int got = 0; 
+  while(bad_out_p->waitGet(bad_subs, std::chrono::milliseconds(200)) != nullptr) got++;
+  bad_pipe.stop();
+  if((got != 4) || (picky->stats().failed != 1) || (picky->stats().processed != 5)) {
+    std::cerr << "testMBoxPipeline: a throwing stage function wasn't counted\n";
+    exit(-1);
+  }
+
+  // a worker that an evicting input cuts off quits, and is counted.
+  auto evict_p = SoDa::makeMailBox<int>("PipeEvict");
+  evict_p->setCapacity(1, SoDa::MailBox<int>::EVICT);
+  std::atomic<bool> started(false), gate(false);
+  SoDa::Pipeline evict_pipe("EvictPipe");
+  auto slow = evict_pipe.add<int, int>("slow", evict_p, bad_out_p,
+				       [&started, &gate](std::shared_ptr<int> v) {
+					 started = true;
+					 while(!gate) std::this_thread::yield();
+					 return v;
+				       });
+  evict_pipe.start();
+  evict_p->put(std::make_shared<int>(0));
+  while(!started) std::this_thread::yield();
+  evict_p->put(std::make_shared<int>(1));
+  evict_p->put(std::make_shared<int>(2));
+  gate = true;
+  for(int i = 0; (i < 200) && (slow->stats().evicted == 0); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  auto est = slow->stats();
+  evict_pipe.stop();
+  if((est.evicted != 1) || (est.processed != 1) || (est.backlog != 0)) {
+    std::cerr << "testMBoxPipeline: an evicted worker wasn't counted\n";
+    exit(-1);
+  }
+}
+
+void testMBoxTimer() {
+  // lots of timers, spread over both of the bottom wheels
+  std::atomic<int> fired(0), early(0); 
+  SoDa::TimerWheel wheel("Wheel"); 
+  const int num_timers = 100000; 
+  std::vector<SoDa::TimerWheel::TimerID> ids; 
+  auto start = std::chrono::steady_clock::now(); 
+  for(int i = 0; i < num_timers; i++) {
+    auto when = start + std::chrono::microseconds((i * 7919) % 600000);
+    ids.push_back(wheel.schedule(when, [when, &fired, &early]() {
+	  if(std::chrono::steady_clock::now() < when) early++; 
+	  fired++; 
+	}));
+  }
+  int cancelled = 0; 
+  for(int i = 0; i < num_timers; i += 2) {
+    if(wheel.cancel(ids[i])) cancelled++; 
+  }
+  for(int i = 0; (i < 200) && (wheel.pending() != 0); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if((fired + cancelled != num_timers) || (early != 0) || wheel.cancel(ids[1])) {
+    std::cerr << "testMBoxTimer: " << fired << " fired " << cancelled << " cancelled " 
+	      << early << " early\n";
+    exit(-1);
+  }
+
+  // delayed puts
+  auto mailbox_p = SoDa::makeMailBox<MyMsg>("TimerMailbox");
+  auto subs = mailbox_p->subscribe();
+  start = std::chrono::steady_clock::now(); 
+  mailbox_p->putAfter(MyMsg::makeMsg(0, 1), std::chrono::milliseconds(20));
+  mailbox_p->putAfter(MyMsg::makeMsg(0, 2), std::chrono::milliseconds(5));
+  mailbox_p->putAt(MyMsg::makeMsg(0, 3), start + std::chrono::milliseconds(10));
+  auto id = mailbox_p->putAfter(MyMsg::makeMsg(0, 4), std::chrono::milliseconds(15));
+  if(!mailbox_p->cancelPut(id)) {
+    std::cerr << "testMBoxTimer: couldn't cancel a put\n";
+    exit(-1);
+  }
+  int expect[] = { 2, 3, 1 }; 
+  int due[] = { 5, 10, 20 }; 
+  for(int i = 0; i < 3; i++) {
+    auto m = mailbox_p->waitGet(subs, std::chrono::seconds(1));
+    if((m == nullptr) || (m->v != expect[i]) || 
+       (std::chrono::steady_clock::now() < start + std::chrono::milliseconds(due[i]))) {
+      std::cerr << "testMBoxTimer: delayed put " << expect[i] << " was missing or early\n";
+      exit(-1);
+    }
+  }
+  if(mailbox_p->waitGet(subs, std::chrono::milliseconds(30)) != nullptr) {
+    std::cerr << "testMBoxTimer: a cancelled put happened anyway\n";
+    exit(-1);
+  }
+
+  // a mailbox that goes away before its mail arrives
+  auto gone_p = SoDa::makeMailBox<MyMsg>("TimerMailbox");
+  gone_p->putAfter(MyMsg::makeMsg(0, 5), std::chrono::milliseconds(2));
+  gone_p = nullptr; 
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+void testMBoxRate() {
+  auto mailbox_p = SoDa::makeMailBox<long>("Rate"); 
+  auto all = mailbox_p->subscribe(); 
+  auto nth = mailbox_p->subscribe(SoDa::DeliveryRate::everyNth(10)); 
+  auto even_nth = mailbox_p->subscribe(SoDa::DeliveryRate::everyNth(2), 
+				       [](const long & v) { return (v % 2) == 0; }); 
+  auto limited = mailbox_p->subscribe(SoDa::DeliveryRate::perSecond(100.0, 5)); 
+
+  auto t0 = std::chrono::steady_clock::now(); 
+  for(long i = 0; i < 1000; i++) mailbox_p->put(std::make_shared<long>(i)); 
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  if(mailbox_p->readyCount(all) != 1000) {
+    std::cerr << "testMBoxRate: plain subscriber lost messages\n";
+    exit(-1);
+  }
+  for(long i = 0; i < 100; i++) {
+    auto m = mailbox_p->get(nth); 
+    if((m == nullptr) || (*m != i * 10)) {
+      std::cerr << "testMBoxRate: every 10th subscriber got the wrong messages\n";
+      exit(-1);
+    }
+  }
+  if((mailbox_p->get(nth) != nullptr) || (mailbox_p->stats(nth).decimated != 900)) {
+    std::cerr << "testMBoxRate: every 10th subscriber got too much\n";
+    exit(-1);
+  }
+  // the rate counts the messages that pass the filter
+  for(long i = 0; i < 250; i++) {
+    auto m = mailbox_p->get(even_nth); 
+    if((m == nullptr) || (*m != i * 4)) {
+      std::cerr << "testMBoxRate: filtered subscriber got the wrong messages\n";
+      exit(-1);
+    }
+  }
+  unsigned int got = mailbox_p->readyCount(limited); 
+  if((got < 5) || (got > (5 + (unsigned int)(secs * 100.0) + 1))) {
+    std::cerr << "testMBoxRate: rate limited subscriber got " << got << " messages\n";
+    exit(-1);
+  }
+  if(mailbox_p->stats(limited).decimated != (1000 - got)) {
+    std::cerr << "testMBoxRate: decimated count is off\n";
+    exit(-1);
+  }
+
+  // skipped messages don't fill the queue, so they can't block put.
+  mailbox_p->clear(all); 
+  mailbox_p->clear(limited); 
+  mailbox_p->clear(even_nth); 
+  mailbox_p->setCapacity(nth, 4, SoDa::MailBox<long>::BLOCK); 
+  std::thread producer([&mailbox_p]() {
+      for(long i = 0; i < 40; i++) mailbox_p->put(std::make_shared<long>(i)); 
+    });
+  producer.join(); 
+  if(mailbox_p->readyCount(nth) != 4) {
+    std::cerr << "testMBoxRate: bounded every 10th subscriber has " 
+	      << mailbox_p->readyCount(nth) << " messages\n";
+    exit(-1);
+  }
+
+  mailbox_p->clear(nth); 
+  mailbox_p->setDeliveryRate(nth, SoDa::DeliveryRate::all()); 
+  for(long i = 0; i < 3; i++) mailbox_p->put(std::make_shared<long>(i)); 
+  if(mailbox_p->readyCount(nth) != 3) {
+    std::cerr << "testMBoxRate: setDeliveryRate didn't take\n";
+    exit(-1);
+  }
+}
+
+struct MultiTune { double freq; };
+struct MultiMode { int mode; };
+struct MultiStop { };
+
+void testMBoxMulti() {
+  typedef std::shared_ptr<std::vector<int>> Block; 
+  auto cmd_p = SoDa::makeMultiMailBox<MultiTune, MultiMode, std::string, Block, MultiStop>("Multi"); 
+  auto all = cmd_p->subscribe(); 
+  auto modes = cmd_p->subscribeTo<MultiMode, MultiStop>(); 
+  auto block = std::make_shared<std::vector<int>>(100, 7); 
+
+  std::thread producer([&cmd_p, block]() {
+      cmd_p->put(MultiTune{ 144.2e6 });
+      cmd_p->put(MultiMode{ 2 });
+      cmd_p->put(std::string("hello"));
+      cmd_p->put(block); 
+      cmd_p->put(MultiStop()); 
+    });
+
+  std::string seen; 
+  bool done = false; 
+  auto handler = SoDa::overloaded([&seen](const MultiTune & t) { if(t.freq == 144.2e6) seen += "T"; },
+				  [&seen](const MultiMode & m) { seen += "M" + std::to_string(m.mode); },
+				  [&seen](const std::string & str) { seen += "S" + str; },
+				  [&seen](const Block & b) { seen += "B" + std::to_string(b->size()); },
+				  [&done](const MultiStop &) { done = true; });
+  while(!done) {
+    if(!cmd_p->waitDispatch(all, handler, std::chrono::seconds(1))) {
+      std::cerr << "testMBoxMulti: timed out after [" << seen << "]\n";
+      exit(-1);
+    }
+  }
+  producer.join(); 
+  if(seen != "TM2ShelloB100") {
+    std::cerr << "testMBoxMulti: saw [" << seen << "]\n";
+    exit(-1);
+  }
+
+  // the narrow subscriber only got the types it asked for.
+  seen.clear(); 
+  done = false; 
+  if((cmd_p->dispatchAll(modes, handler) != 2) || (seen != "M2") || !done) {
+    std::cerr << "testMBoxMulti: subscribeTo let the wrong types through\n";
+    exit(-1);
+  }
+
+  // the queues hold copies, and let go of them.
+  cmd_p->put(block, all); 
+  if((cmd_p->readyCount(all) != 0) || (cmd_p->readyCount(modes) != 0) || (block.use_count() != 1)) {
+    std::cerr << "testMBoxMulti: a message was kept where it shouldn't be\n";
+    exit(-1);
+  }
+  auto other = cmd_p->subscribe(); 
+  cmd_p->put(block); 
+  cmd_p->put(block); 
+  if(block.use_count() != 5) {
+    std::cerr << "testMBoxMulti: expected a copy in each queue\n";
+    exit(-1);
+  }
+  SoDa::MultiMailBox<MultiTune, MultiMode, std::string, Block, MultiStop>::Message m; 
+  if(!cmd_p->get(other, m) || !m.is<Block>() || (m.as<Block>() != block)) {
+    std::cerr << "testMBoxMulti: get returned the wrong message\n";
+    exit(-1);
+  }
+  bool threw = false; 
+  try {
+    m.as<std::string>(); 
+  }
+  catch (SoDa::Exception & e) {
+    threw = true; 
+  }
+  if(!threw) {
+    std::cerr << "testMBoxMulti: as<> didn't check the type\n";
+    exit(-1);
+  }
+  m.reset(); 
+  cmd_p->clear(all); 
+  cmd_p->clear(other); 
+  if(block.use_count() != 1) {
+    std::cerr << "testMBoxMulti: cleared messages weren't destroyed\n";
+    exit(-1);
+  }
+
+  // a visitor that throws loses only the message it threw on.
+  for(int i = 0; i < 4; i++) cmd_p->put(MultiMode{ i }, all);
+  seen.clear();
+  auto picky = SoDa::overloaded([&seen](const MultiMode & m) {
+      if(m.mode == 1) throw std::runtime_error("picky");
+      seen += "M" + std::to_string(m.mode);
+    },
+    [](const MultiTune &) { }, [](const std::string &) { },
+    [](const Block &) { }, [](const MultiStop &) { });
+  threw = false;
+  try {
+    cmd_p->dispatchAll(modes, picky);
+  }
+  catch (std::runtime_error & e) {
+    threw = true;
+  }
+  if(!threw || (seen != "M0") || (cmd_p->readyCount(modes) != 2) ||
+     (cmd_p->dispatchAll(modes, picky) != 2) || (seen != "M0M2M3")) {
+    std::cerr << "testMBoxMulti: dispatchAll lost messages when the visitor threw ["
+	      << seen << "]\n";
+    exit(-1);
+  }
+}
+
+void testMBoxReplay() {
+  auto mailbox_p = SoDa::makeMailBox<long>("Replay"); 
+  mailbox_p->retainLast(5); 
+  for(long i = 0; i < 10; i++) mailbox_p->put(std::make_shared<long>(i));
+  auto late = mailbox_p->subscribe(); 
+  mailbox_p->put(std::make_shared<long>(10));
+  for(long i = 5; i < 11; i++) {
+    auto m = mailbox_p->get(late); 
+    if((m == nullptr) || (*m != i)) {
+      std::cerr << "testMBoxReplay: late subscriber didn't get the history, then the news\n";
+      exit(-1);
+    }
+  }
+
+  // filters apply to the history, groups don't get it, and bounded
+  // queues get the newest that fit.
+  auto even = mailbox_p->subscribe([](const long & v) { return (v % 2) == 0; });
+  auto worker = mailbox_p->subscribeGroup("workers"); 
+  mailbox_p->setCapacity(2, SoDa::MailBox<long>::DROP_OLDEST); 
+  auto small = mailbox_p->subscribe(); 
+  mailbox_p->setCapacity(0); 
+  auto e0 = mailbox_p->get(even); 
+  auto s0 = mailbox_p->get(small); 
+  if((mailbox_p->readyCount(even) != 2) || (e0 == nullptr) || (*e0 != 6) || 
+     (mailbox_p->readyCount(worker) != 0) || 
+     (mailbox_p->readyCount(small) != 1) || (s0 == nullptr) || (*s0 != 9)) {
+    std::cerr << "testMBoxReplay: history went to the wrong places\n";
+    exit(-1);
+  }
+
+  // so does a delivery rate.
+  auto sampled = mailbox_p->subscribe(SoDa::DeliveryRate::everyNth(2));
+  auto p0 = mailbox_p->get(sampled);
+  if((p0 == nullptr) || (*p0 != 6) || (mailbox_p->readyCount(sampled) != 2) ||
+     (mailbox_p->stats(sampled).decimated != 2)) {
+    std::cerr << "testMBoxReplay: history ignored the delivery rate\n";
+    exit(-1);
+  }
+
+  // newest for each key, in the order they were last updated.
+  mailbox_p->retainLatest([](const long & v) { return v % 3; });
+  for(long i = 0; i < 9; i++) mailbox_p->put(std::make_shared<long>(i));
+  mailbox_p->put(std::make_shared<long>(3));
+  auto keyed = mailbox_p->subscribe(); 
+  std::vector<long> expect = { 7, 8, 3 }; 
+  for(auto v : expect) {
+    auto m = mailbox_p->get(keyed); 
+    if((m == nullptr) || (*m != v)) {
+      std::cerr << "testMBoxReplay: keyed history is wrong\n";
+      exit(-1);
+    }
+  }
+  if(mailbox_p->get(keyed) != nullptr) {
+    std::cerr << "testMBoxReplay: keyed history is too long\n";
+    exit(-1);
+  }
+  mailbox_p->retainLatest([](const long & v) { return v; }, 2);
+  for(long i = 0; i < 4; i++) mailbox_p->put(std::make_shared<long>(i));
+  if(mailbox_p->retainedCount() != 2) {
+    std::cerr << "testMBoxReplay: kept too many keys\n";
+    exit(-1);
+  }
+  mailbox_p->retainLast(0); 
+  if(mailbox_p->retainedCount() != 0) {
+    std::cerr << "testMBoxReplay: retainLast(0) kept something\n";
+    exit(-1);
+  }
+
+  // no gaps and no repeats when someone joins in the middle of a run.
+  auto run_p = SoDa::makeMailBox<long>("ReplayRun"); 
+  const long num_msgs = 20000; 
+  run_p->retainLast(num_msgs); 
+  std::thread producer([&run_p]() {
+      for(long i = 0; i < num_msgs; i++) run_p->put(std::make_shared<long>(i));
+    });
+  while(run_p->retainedCount() < (num_msgs / 4)) std::this_thread::yield(); 
+  auto joiner = run_p->subscribe(); 
+  for(long i = 0; i < num_msgs; i++) {
+    auto m = run_p->waitGet(joiner, std::chrono::seconds(1)); 
+    if((m == nullptr) || (*m != i)) {
+      std::cerr << "testMBoxReplay: expected message " << i << " after joining\n";
+      exit(-1);
+    }
+  }
+  producer.join(); 
+}
+
+struct JournalMsg {
+  long seq;
+  double val;
+};
+
+// too big for a one page segment
+struct JournalBig {
+  char bytes[8192];
+};
+
+// a codec for a type that isn't trivially copyable
+struct StringCodec {
+  static void encode(const std::string & msg, std::vector<char> & buf) {
+    buf.assign(msg.begin(), msg.end());
+  }
+  static std::shared_ptr<std::string> decode(const char * data, uint32_t len) {
+    return std::make_shared<std::string>(data, len);
+  }
+};
+
+void testMBoxJournal() {
+  std::string prefix = "/tmp/SoDaJournalTest." + std::to_string(getpid()); 
+  std::string sprefix = prefix + ".str"; 
+  auto src_p = SoDa::makeMailBox<JournalMsg>("JournalSrc"); 
+  const long num_msgs = 2000; 
+  unsigned int segments; 
+  {
+    // small segments, so that it has to rotate.
+    SoDa::JournalSink<JournalMsg> sink(src_p, prefix, 8192); 
+    for(long i = 0; i < num_msgs; i++) {
+      src_p->put(std::make_shared<JournalMsg>(JournalMsg{ i, 0.25 * i }));
+      // nothing to write, so it isn't counted.
+      if(i == (num_msgs / 2)) src_p->put(nullptr);
+    }
+    sink.stop(); 
+    segments = sink.segmentCount(); 
+    if((sink.recordedCount() != num_msgs) || (segments < 2)) {
+      std::cerr << "testMBoxJournal: recorded " << sink.recordedCount() 
+		<< " messages in " << segments << " segments\n";
+      exit(-1);
+    }
+  }
+  {
+    // stamps are system clock times.
+    SoDa::JournalReader r(prefix);
+    const char * data;
+    uint32_t len;
+    int64_t stamp;
+    auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::system_clock::now().time_since_epoch()).count();
+    if(!r.next(data, len, stamp) || (stamp > now_ns) || ((now_ns - stamp) > 60000000000L)) {
+      std::cerr << "testMBoxJournal: record stamp isn't the system time\n";
+      exit(-1);
+    }
+  }
+
+  // as fast as it can go
+  auto dst_p = SoDa::makeMailBox<JournalMsg>("JournalDst"); 
+  auto subs = dst_p->subscribe(); 
+  SoDa::JournalReplay<JournalMsg> replay(prefix, dst_p); 
+  if(replay.run(0.0) != num_msgs) {
+    std::cerr << "testMBoxJournal: replay lost messages\n";
+    exit(-1);
+  }
+  for(long i = 0; i < num_msgs; i++) {
+    auto m = dst_p->get(subs); 
+    if((m == nullptr) || (m->seq != i) || (m->val != 0.25 * i)) {
+      std::cerr << "testMBoxJournal: replayed message " << i << " is wrong\n";
+      exit(-1);
+    }
+  }
+  if(SoDa::JournalWriter::remove(prefix) != segments) {
+    std::cerr << "testMBoxJournal: segments aren't where they should be\n";
+    exit(-1);
+  }
+
+  // with a codec, and the original spacing
+  auto str_p = SoDa::makeMailBox<std::string>("JournalStr"); 
+  {
+    SoDa::JournalSink<std::string, StringCodec> sink(str_p, sprefix, 4096, SoDa::JournalWriter::SYNC); 
+    str_p->put(std::make_shared<std::string>("first"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    str_p->put(std::make_shared<std::string>(""));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    str_p->put(std::make_shared<std::string>("third"));
+  }
+  auto str_subs = str_p->subscribe(); 
+  SoDa::JournalReplay<std::string, StringCodec> sreplay(sprefix, str_p); 
+  auto t0 = std::chrono::steady_clock::now(); 
+  sreplay.run(); 
+  auto took = std::chrono::steady_clock::now() - t0; 
+  auto a = str_p->get(str_subs); 
+  auto b = str_p->get(str_subs); 
+  auto c = str_p->get(str_subs); 
+  if((a == nullptr) || (*a != "first") || (b == nullptr) || (*b != "") || 
+     (c == nullptr) || (*c != "third")) {
+    std::cerr << "testMBoxJournal: codec replay is wrong\n";
+    exit(-1);
+  }
+  if((took < std::chrono::milliseconds(90)) || (took > std::chrono::seconds(5))) {
+    std::cerr << "testMBoxJournal: replay at original speed took " 
+	      << std::chrono::duration_cast<std::chrono::milliseconds>(took).count() << " ms\n";
+    exit(-1);
+  }
+
+  // a record that was only partly written ends the journal.
+  {
+    SoDa::JournalWriter w(sprefix, 4096); 
+    w.append("good", 4, 1); 
+    w.append("damaged", 7, 2); 
+    w.commit(); 
+  }
+  {
+    FILE * f = fopen(SoDa::JournalWriter::segmentName(sprefix, 0).c_str(), "r+b");
+    // the second record's payload: segment header, first record, its header
+    fseek(f, 64 + 24 + 8 + 24, SEEK_SET);
+    fputc('X', f);
+    fclose(f);
+  }
+  SoDa::JournalReader r(sprefix); 
+  const char * data; 
+  uint32_t len; 
+  int64_t stamp; 
+  if(!r.next(data, len, stamp) || (len != 4) || (stamp != 1) || 
+     r.next(data, len, stamp) || (r.tornCount() != 1)) {
+    std::cerr << "testMBoxJournal: reader didn't stop at the damaged record\n";
+    exit(-1);
+  }
+  SoDa::JournalWriter::remove(sprefix); 
+
+  bool threw = false; 
+  try {
+    SoDa::JournalReader missing(sprefix); 
+  }
+  catch (SoDa::Exception & e) {
+    threw = true; 
+  }
+  if(!threw) {
+    std::cerr << "testMBoxJournal: opened a journal that isn't there\n";
+    exit(-1);
+  }
+
+  // a journal that can't be written stops the sink, and says why.
+  auto big_p = SoDa::makeMailBox<JournalBig>("JournalBig");
+  {
+    SoDa::JournalSink<JournalBig> sink(big_p, sprefix, 4096);
+    big_p->put(std::make_shared<JournalBig>());
+    for(int i = 0; (i < 500) && !sink.failed(); i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    threw = false;
+    try {
+      if(sink.error() != nullptr) std::rethrow_exception(sink.error());
+    }
+    catch (SoDa::JournalWriter::Exception & e) {
+      threw = true;
+    }
+    if(!sink.failed() || !threw || (sink.recordedCount() != 0) ||
+       (big_p->subscriberCount() != 0)) {
+      std::cerr << "testMBoxJournal: a failed sink didn't stop cleanly\n";
+      exit(-1);
+    }
+  }
+  SoDa::JournalWriter::remove(sprefix);
+}
+
+void testMBoxCoalesce() {
+  // the wheel outlives the mailbox, as setCoalescing asks.
+  SoDa::TimerWheel fine("CoalesceWheel", std::chrono::microseconds(20)); 
+  auto mailbox_p = SoDa::makeMailBox<long>("Coalesce"); 
+  mailbox_p->setCoalescing(64, std::chrono::microseconds(200), fine); 
+  auto subs = mailbox_p->subscribe(); 
+  auto sender = mailbox_p->subscribe(); 
+
+  // full frames, and a partial one at the end that the wheel delivers.
+  const long num_msgs = 1000; 
+  std::thread producer([&mailbox_p, &sender]() {
+      for(long i = 0; i < num_msgs; i++) {
+	mailbox_p->put(std::make_shared<long>(i), sender);
+      }
+    });
+  for(long i = 0; i < num_msgs; i++) {
+    auto m = mailbox_p->waitGet(subs, std::chrono::seconds(1)); 
+    if(m == nullptr) {
+      std::cerr << "testMBoxCoalesce: timed out waiting for message " << i << "\n";
+      exit(-1);
+    }
+    if(*m != i) {
+      std::cerr << "testMBoxCoalesce: got message " << *m << " expected " << i << "\n";
+      exit(-1);
+    }
+  }
+  producer.join(); 
+  if(mailbox_p->readyCount(sender) != 0) {
+    std::cerr << "testMBoxCoalesce: sender got its own messages\n";
+    exit(-1);
+  }
+
+  // a lone message shows up soon after the budget runs out.
+  auto t0 = std::chrono::steady_clock::now(); 
+  mailbox_p->put(std::make_shared<long>(42));
+  auto m = mailbox_p->waitGet(subs, std::chrono::seconds(1)); 
+  auto waited = std::chrono::steady_clock::now() - t0; 
+  if((m == nullptr) || (*m != 42) || (waited > std::chrono::milliseconds(100))) {
+    std::cerr << "testMBoxCoalesce: lone message was late or lost\n";
+    exit(-1);
+  }
+  mailbox_p->clear(sender); 
+
+  // with a long budget, nothing moves until the frame fills or is flushed.
+  mailbox_p->setCoalescing(8, std::chrono::seconds(10), fine); 
+  for(long i = 0; i < 3; i++) mailbox_p->put(std::make_shared<long>(i));
+  if(mailbox_p->readyCount(subs) != 0) {
+    std::cerr << "testMBoxCoalesce: partial frame was delivered early\n";
+    exit(-1);
+  }
+  mailbox_p->flush(); 
+  if(mailbox_p->readyCount(subs) != 3) {
+    std::cerr << "testMBoxCoalesce: flush didn't deliver the frame\n";
+    exit(-1);
+  }
+  for(long i = 3; i < 11; i++) mailbox_p->put(std::make_shared<long>(i));
+  if(mailbox_p->readyCount(subs) != 11) {
+    std::cerr << "testMBoxCoalesce: full frame wasn't delivered\n";
+    exit(-1);
+  }
+  // a batch goes after the frame, and turning coalescing off flushes.
+  std::vector<std::shared_ptr<long>> batch = { std::make_shared<long>(11), std::make_shared<long>(12) }; 
+  mailbox_p->putBatch(batch.begin(), batch.end()); 
+  mailbox_p->put(std::make_shared<long>(13));
+  mailbox_p->setCoalescing(0); 
+  for(long i = 0; i < 14; i++) {
+    auto m = mailbox_p->get(subs); 
+    if((m == nullptr) || (*m != i)) {
+      std::cerr << "testMBoxCoalesce: message " << i << " out of order\n";
+      exit(-1);
+    }
+  }
+}
+
+void testMBoxReact() {
+  // lots of subscriptions, a few threads.
+  const int num_boxes = 4; 
+  const int reactions_per_box = 50; 
+  const int num_msgs = 500; 
+  SoDa::Executor pool("ReactPool", 4); 
+  std::vector<SoDa::MailBoxPtr<long>> boxes; 
+  for(int i = 0; i < num_boxes; i++) {
+    boxes.push_back(SoDa::makeMailBox<long>("React" + std::to_string(i))); 
+  }
+
+  struct Seen {
+    long next = 0; 
+    std::atomic<int> running; 
+    std::atomic<bool> bad; 
+  };
+  std::atomic<long> total(0); 
+  std::atomic<int> overlapped(0), out_of_order(0); 
+  std::vector<std::unique_ptr<Seen>> seen; 
+  std::vector<SoDa::MailBox<long>::Reaction> reactions; 
+  for(int b = 0; b < num_boxes; b++) {
+    for(int r = 0; r < reactions_per_box; r++) {
+      seen.push_back(std::unique_ptr<Seen>(new Seen));
+      Seen * sp = seen.back().get(); 
+      sp->running = 0; 
+      reactions.push_back(boxes[b]->onMessage([sp, &total, &overlapped, &out_of_order](std::shared_ptr<long> m) {
+	    if(sp->running.fetch_add(1) != 0) overlapped++; 
+	    if(*m != sp->next) out_of_order++; 
+	    sp->next = *m + 1; 
+	    sp->running.fetch_sub(1);
+	    total++; 
+	  }, pool, 8));
+    }
+  }
+
+  std::vector<std::thread> producers; 
+  for(int b = 0; b < num_boxes; b++) {
+    producers.push_back(std::thread([&boxes, b]() {
+	  for(long i = 0; i < num_msgs; i++) {
+	    boxes[b]->put(std::make_shared<long>(i));
+	  }
+	}));
+  }
+  for(auto & t : producers) t.join();
+
+  long expect = long(num_boxes) * reactions_per_box * num_msgs; 
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20); 
+  while((total < expect) && (std::chrono::steady_clock::now() < deadline)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1)); 
+  }
+  if(total != expect) {
+    std::cerr << "testMBoxReact: handled " << total << " messages, expected " << expect << "\n";
+    exit(-1);
+  }
+  if(overlapped != 0) {
+    std::cerr << "testMBoxReact: a handler ran on two workers at once\n";
+    exit(-1);
+  }
+  if(out_of_order != 0) {
+    std::cerr << "testMBoxReact: " << out_of_order << " messages were handled out of order\n";
+    exit(-1);
+  }
+
+  // dropping a reaction unsubscribes, even with mail still coming.
+  auto extra = SoDa::makeMailBox<long>("ReactDrop"); 
+  std::atomic<long> dropped_total(0); 
+  auto rd = extra->onMessage([&dropped_total](std::shared_ptr<long>) { dropped_total++; }, pool);
+  for(long i = 0; i < 1000; i++) extra->put(std::make_shared<long>(i)); 
+  rd = nullptr; 
+  reactions.clear(); 
+  for(auto & b : boxes) {
+    if(b->subscriberCount() != 0) {
+      std::cerr << "testMBoxReact: reactions didn't unsubscribe\n";
+      exit(-1);
+    }
+  }
+  if(extra->subscriberCount() != 0) {
+    std::cerr << "testMBoxReact: dropped reaction didn't unsubscribe\n";
+    exit(-1);
+  }
+
+  // a handler that throws loses that message, and keeps going.
+  auto touchy = SoDa::makeMailBox<long>("ReactThrow"); 
+  std::atomic<long> handled(0), reported(0); 
+  auto rt = touchy->onMessage([&handled](std::shared_ptr<long> m) {
+      if((*m % 10) == 0) throw std::runtime_error("multiple of ten");
+      handled++; 
+    }, pool, 4);
+  rt->setErrorHandler([&reported](std::exception_ptr) { reported++; });
+  for(long i = 0; i < 100; i++) touchy->put(std::make_shared<long>(i)); 
+  deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10); 
+  while((handled < 90) && (std::chrono::steady_clock::now() < deadline)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1)); 
+  }
+  if((handled != 90) || (rt->failedCount() != 10) || (reported != 10)) {
+    std::cerr << "testMBoxReact: a throwing handler stopped the reaction\n";
+    exit(-1);
+  }
+}
+
+#ifdef __linux__
+struct SharedMsg {
+  int seq;
+  double val;
+};
+
+bool waitChild(pid_t pid) {
+  int status;
+  if(waitpid(pid, &status, 0) != pid) return false;
+  return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+void testMBoxShared() {
+  std::string name = "SharedTest." + std::to_string(getpid());
+  std::string bname = "SharedBytes." + std::to_string(getpid());
+  SoDa::SharedMailBox<SharedMsg>::remove(name);
+  SoDa::SharedMailBox<SharedMsg> box(name, 64, 4);
+  auto subs = box.subscribe();
+
+  // another process puts more than the ring holds, so it has to wait
+  // for us to read. The child must leave with _exit: it has none of
+  // our threads to join.
+  const int num_msgs = 1000;
+  pid_t pid = fork();
+  if(pid == 0) {
+    SoDa::SharedMailBox<SharedMsg> cbox(name);
+    for(int i = 0; i < num_msgs; i++) {
+      cbox.put(SharedMsg{ i, 0.5 * i });
+    }
+    _exit(0);
+  }
+  for(int i = 0; i < num_msgs; i++) {
+    SharedMsg m;
+    if(!box.waitGet(subs, m, std::chrono::seconds(10))) {
+      std::cerr << "testMBoxShared: timed out waiting for message " << i << "\n";
+      exit(-1);
+    }
+    if((m.seq != i) || (m.val != 0.5 * i)) {
+      std::cerr << "testMBoxShared: got message " << m.seq << " expected " << i << "\n";
+      exit(-1);
+    }
+  }
+  if(!waitChild(pid)) {
+    std::cerr << "testMBoxShared: sender failed\n";
+    exit(-1);
+  }
+
+  // we shouldn't see our own messages, unless we ask to.
+  box.put(SharedMsg{ 1, 1.0 }, subs);
+  box.put(std::make_shared<SharedMsg>(SharedMsg{ 2, 2.0 }));
+  auto mp = box.get(subs);
+  if((mp == nullptr) || (mp->seq != 2) || (box.get(subs) != nullptr)) {
+    std::cerr << "testMBoxShared: sender skip is broken\n";
+    exit(-1);
+  }
+
+  // asking for a different message type has to fail.
+  bool threw = false;
+  try {
+    SoDa::SharedMailBox<SoDa::ShmBytes<32>> wrong(name);
+  }
+  catch (SoDa::MailBoxBase::Exception & e) {
+    threw = true;
+  }
+  if(!threw) {
+    std::cerr << "testMBoxShared: opened a mailbox with the wrong message type\n";
+    exit(-1);
+  }
+
+  // a subscriber that dies without reading mustn't stall us forever.
+  pid = fork();
+  if(pid == 0) {
+    SoDa::SharedMailBox<SharedMsg> cbox(name);
+    auto csubs = cbox.subscribe();
+    csubs.release();
+    _exit(0);
+  }
+  if(!waitChild(pid) || (box.subscriberCount() != 2)) {
+    std::cerr << "testMBoxShared: subscriber in the child didn't take\n";
+    exit(-1);
+  }
+  subs = nullptr;
+  for(int i = 0; i < 200; i++) {
+    box.put(SharedMsg{ i, 0.0 });
+  }
+  if(box.subscriberCount() != 0) {
+    std::cerr << "testMBoxShared: dead subscriber was not reaped\n";
+    exit(-1);
+  }
+
+  // a producer that dies holding a claim mustn't stall us forever.
+  subs = box.subscribe();
+  pid = fork();
+  if(pid == 0) {
+    SoDa::SharedMailBox<SharedMsg> cbox(name);
+    // the last put claims a slot, then waits for us to read.
+    for(int i = 0; i <= 64; i++) cbox.put(SharedMsg{ i, 0.0 });
+    _exit(0);
+  }
+  for(int i = 0; (box.readyCount(subs) < 65) && (i < 10000); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  kill(pid, SIGKILL);
+  waitChild(pid);
+  for(int i = 0; i < 64; i++) {
+    SharedMsg m;
+    if(!box.waitGet(subs, m, std::chrono::seconds(10)) || (m.seq != i)) {
+      std::cerr << "testMBoxShared: lost message " << i << " before the dead producer's claim\n";
+      exit(-1);
+    }
+  }
+  box.put(SharedMsg{ 99, 0.0 });
+  SharedMsg after;
+  if(!box.waitGet(subs, after, std::chrono::seconds(2)) || (after.seq != 99)) {
+    std::cerr << "testMBoxShared: stuck on the dead producer's slot\n";
+    exit(-1);
+  }
+  threw = false;
+  try {
+    box.put(std::shared_ptr<SharedMsg>());
+  }
+  catch (SoDa::MailBoxBase::Exception & e) {
+    threw = true;
+  }
+  if(!threw) {
+    std::cerr << "testMBoxShared: put accepted a null message\n";
+    exit(-1);
+  }
+  subs = nullptr;
+
+  // bytes, read in place.
+  SoDa::SharedMailBox<SoDa::ShmBytes<64>>::remove(bname);
+  SoDa::SharedMailBox<SoDa::ShmBytes<64>> bbox(bname, 16, 2);
+  auto bsubs = bbox.subscribe();
+  pid = fork();
+  if(pid == 0) {
+    SoDa::SharedMailBox<SoDa::ShmBytes<64>> cbox(bname);
+    SoDa::ShmBytes<64> b;
+    b.assign("hello", 5);
+    cbox.put(b);
+    _exit(0);
+  }
+  std::string got;
+  bbox.waitRead(bsubs, [&got](const SoDa::ShmBytes<64> & b) {
+      got.assign(reinterpret_cast<const char *>(b.data), b.len);
+    }, std::chrono::seconds(10));
+  if(!waitChild(pid) || (got != "hello")) {
+    std::cerr << "testMBoxShared: byte message was [" << got << "]\n";
+    exit(-1);
+  }
+
+  if(!SoDa::SharedMailBox<SharedMsg>::remove(name) ||
+     !SoDa::SharedMailBox<SoDa::ShmBytes<64>>::remove(bname)) {
+    std::cerr << "testMBoxShared: couldn't remove the segments\n";
+    exit(-1);
+  }
+}
+#endif
+
+void testMBoxRegistry() {
+  SoDa::MailBoxRegistry reg("Registry");
+
+  std::vector<SoDa::MailBoxRegistry::Handle> watched;
+  reg.watch("rx.**", [&watched](SoDa::MailBoxRegistry::Handle h) { watched.push_back(h); });
+  
+  auto main_h = reg.add("rx.main.spectrum", SoDa::makeMailBox<MyMsg>("main"));
+  auto sub_h = reg.add("rx.sub.spectrum", SoDa::makeMailBox<MyMsg>("sub"));
+  reg.add("rx.main.status", SoDa::makeMailBox<int>("status"));
+  reg.add("tx.power", SoDa::makeMailBox<int>("power"));
+
+  if((reg.intern("rx.main.spectrum") != main_h) || (reg.topic(sub_h) != "rx.sub.spectrum")) {
+    std::cerr << "testMBoxRegistry: interned handles aren't stable\n";
+    exit(-1);
+  }
+
+  auto hits = reg.match("rx.*.spectrum");
+  if((hits.size() != 2) || (hits[0] != main_h) || (hits[1] != sub_h)) {
+    std::cerr << "testMBoxRegistry: wildcard match found the wrong topics\n";
+    exit(-1);
+  }
+  if((reg.match("**").size() != 4) || (reg.match("rx.main.**").size() != 2) || 
+     (watched.size() != 3)) {
+    std::cerr << "testMBoxRegistry: \"**\" matched the wrong topics\n";
+    exit(-1);
+  }
+
+  // lookups by handle and name find the same mailbox
+  auto mbox_p = reg.get<SoDa::MailBox<MyMsg>>(main_h);
+  if(mbox_p != reg.get<SoDa::MailBox<MyMsg>>("rx.main.spectrum")) {
+    std::cerr << "testMBoxRegistry: handle and name lookups disagree\n";
+    exit(-1);
+  }
+
+  bool caught = false;
+  try {
+    reg.get<SoDa::MailBox<int>>(main_h);
+  }
+  catch (SoDa::MailBoxRegistry::BadLookup & e) {
+    caught = true; 
+  }
+  try {
+    reg.intern("rx.*.spectrum");
+    caught = false;
+  }
+  catch (SoDa::MailBoxRegistry::BadTopic & e) {
+  }
+  if(!caught) {
+    std::cerr << "testMBoxRegistry: bad lookups didn't throw\n";
+    exit(-1);
+  }
+
+  // empty levels and white space are errors, not a different
+  // spelling of a good topic.
+  for(auto bad : { "", ".", "rx.main.", "rx..main", ".rx", "rx.ma in", "rx. main" }) {
+    try {
+      reg.intern(bad);
+      std::cerr << "testMBoxRegistry: bad topic [" << bad << "] was interned\n";
+      exit(-1);
+    }
+    catch (SoDa::MailBoxRegistry::BadTopic & e) {
+    }
+  }
+}
+
+void testMBoxStats() {
+  SoDa::MailBoxPtr<MyMsg> mailbox_p = SoDa::makeMailBox<MyMsg>("StatsMailbox");
+  mailbox_p->measureLatency(true);
+  auto fast = mailbox_p->subscribe();
+  auto slow = mailbox_p->subscribe();
+  mailbox_p->setCapacity(slow, 4, SoDa::MailBoxBase::DROP_OLDEST);
+
+  for(int i = 0; i < 6; i++) {
+    mailbox_p->put(MyMsg::makeMsg(0, i));
+    mailbox_p->get(fast);
+  }
+  mailbox_p->get(slow);
+
+  auto f = mailbox_p->stats(fast);
+  auto s = mailbox_p->stats(slow);
+  if((f.enqueued != 6) || (f.dequeued != 6) || (f.depth != 0) || (f.high_water != 1)) {
+    std::cerr << "testMBoxStats: bad counts for the fast subscriber\n";
+    exit(-1);
+  }
+  if((s.enqueued != 6) || (s.dequeued != 1) || (s.dropped != 2) || 
+     (s.depth != 3) || (s.high_water != 4)) {
+    std::cerr << "testMBoxStats: bad counts for the slow subscriber\n";
+    exit(-1);
+  }
+  unsigned long timed = 0;
+  for(auto b : f.latency) timed += b;
+  if((f.latency.size() != SoDa::MailBoxCounters::num_latency_buckets) || (timed != 6)) {
+    std::cerr << "testMBoxStats: latency histogram missed some messages\n";
+    exit(-1);
+  }
+  if(mailbox_p->stats().size() != 2) {
+    std::cerr << "testMBoxStats: stats() should report every subscriber\n";
+    exit(-1);
+  }
+}
+
+void testMBoxEventFD() {
+#ifdef __linux__
+  SoDa::MailBoxPtr<MyMsg> mailbox_p = SoDa::makeMailBox<MyMsg>("EventMailbox");
+  auto subs = mailbox_p->subscribe();
+  int efd = mailbox_p->eventFD(subs);
+
+  int ep = epoll_create1(0);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = efd;
+  epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev);
+
+  // nothing there yet
+  if(epoll_wait(ep, &ev, 1, 0) != 0) {
+    std::cerr << "testMBoxEventFD: empty mailbox made the eventfd readable\n";
+    exit(-1);
+  }
+
+  std::thread sender([mailbox_p]() {
+      for(int i = 0; i < 10; i++) {
+	mailbox_p->put(MyMsg::makeMsg(0, i));
+	std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+    });
+
+  int got = 0;
+  while(got < 10) {
+    if(epoll_wait(ep, &ev, 1, 10000) != 1) {
+      std::cerr << "testMBoxEventFD: timed out waiting for the eventfd\n";
+      exit(-1);
+    }
+    mailbox_p->consumeEvent(subs);
+    while(auto p = mailbox_p->get(subs)) {
+      if(p->v != got) {
+	std::cerr << "testMBoxEventFD: got the wrong message\n";
+	exit(-1);
+      }
+      got++;
+    }
+  }
+  sender.join();
+
+  if(epoll_wait(ep, &ev, 1, 0) != 0) {
+    // a stale edge is harmless, but there must be nothing to read.
+    mailbox_p->consumeEvent(subs);
+    if(mailbox_p->get(subs) != nullptr) {
+      std::cerr << "testMBoxEventFD: extra message\n";
+      exit(-1);
+    }
+  }
+  close(ep);
+#endif
+}
+
+void testMBoxPool() {
+  auto mailbox_p = SoDa::makePooledMailBox<MyMsg>("PooledMailbox", 16);
+  auto reader_a = mailbox_p->subscribe();
+  auto reader_b = mailbox_p->subscribe();
+
+  // Send far more messages than a slab holds, but never have more
+  // than a few outstanding. The pool should never grow past one slab.
+  for(int i = 0; i < 1000; i++) {
+    auto msg = mailbox_p->make(0, i);
+    mailbox_p->put(std::move(msg));
+    auto a = mailbox_p->get(reader_a);
+    auto b = mailbox_p->waitGet(reader_b, std::chrono::seconds(1));
+    if((a == nullptr) || (a != b) || (a->v != i) || (a.useCount() != 2)) {
+      std::cerr << "testMBoxPool: pooled message was not shared correctly\n";
+      exit(-1);
+    }
+  }
+  if(mailbox_p->poolCapacity() != 16) {
+    std::cerr << "testMBoxPool: pool grew to " << mailbox_p->poolCapacity() 
+	      << " it should have recycled its messages\n";
+    exit(-1);
+  }
+
+  // now make the pool grow
+  for(int i = 0; i < 40; i++) {
+    mailbox_p->put(mailbox_p->make(0, i));
+  }
+  if(mailbox_p->poolCapacity() < 40) {
+    std::cerr << "testMBoxPool: pool did not grow\n";
+    exit(-1);
+  }
+
+  // a message may outlive its mailbox
+  auto survivor = mailbox_p->get(reader_a);
+  mailbox_p->clear(reader_a);
+  reader_a = nullptr;
+  reader_b = nullptr;
+  mailbox_p = nullptr;
+  if((survivor == nullptr) || (survivor->v != 0)) {
+    std::cerr << "testMBoxPool: lost a message that outlived its mailbox\n";
+    exit(-1);
+  }
+}
+
 int main(int argc, char ** argv) {
   // create a mailbox
   SoDa::Options cmd;
 
   int msg_count, num_threads, num_trials; 
   bool no_echo; 
+  std::string engine; 
   cmd.add<int>(&msg_count, "msgs", 'm', 1, "Number of messages to send from each thread")
     .add<int>(&num_threads, "th", 't', 2, "Number of threads in test.")
     .add<int>(&num_trials, "trials", 'r', 1, "Number of trials to run.")
-    .addP(&no_echo, "noecho", 'n', "When present, a thread will not \"see\" its own outbound messages.");
+    .addP(&no_echo, "noecho", 'n', "When present, a thread will not \"see\" its own outbound messages.")
+    .add<std::string>(&engine, "engine", 'e', "locked", "Which mailbox to test: locked, lockfree, broadcast, or pooled.");
   
 
   if(!cmd.parse(argc, argv)) exit(-1);
 
   testMBoxConversion();
+  testMBoxWait();
+  testMBoxOverflow();
+  testMBoxFilter();
+  testMBoxGroup();
+  testMBoxConflate();
+  testMBoxStats();
+  testMBoxEventFD();
+  testMBoxBatch(SoDa::makeMailBox<MyMsg>("BatchMailbox"), "locked");
+  testMBoxBatch(SoDa::makeLockFreeMailBox<MyMsg>("BatchMailbox"), "lockfree");
+  testMBoxBatch(SoDa::makeBroadcastMailBox<MyMsg>("BatchMailbox"), "broadcast");
+  testMBoxPool();
+  testMBoxSelector();
+  testMBoxSpinWake();
+  testMBoxMerge();
+  testMBoxPipeline();
+  testMBoxTimer();
+  testMBoxReact();
+  testMBoxCoalesce();
+  testMBoxRate();
+  testMBoxMulti();
+  testMBoxReplay();
+  testMBoxJournal();
+#ifdef __linux__
+  testMBoxShared();
+#endif
+  testMBoxRegistry();
+  testMBoxWaitStrategy(SoDa::makeMailBox<MyMsg>("SpinMailbox"), "locked");
+  testMBoxWaitStrategy(SoDa::makeLockFreeMailBox<MyMsg>("SpinMailbox"), "lockfree");
   
   // std::cerr << "test 1\n";
   // testVectorMsg(msg_count, num_threads);
   
   std::cerr << "test 2\n";
-  testObjMessage(msg_count, num_threads, num_trials, no_echo);
+  if(engine == "lockfree") {
+    // each subscriber needs room for a whole trial's worth of messages, 
+    // as every thread sends all of its messages before reading any.
+    auto mailbox_p = SoDa::makeLockFreeMailBox<MyMsg>("LockFreeMailbox", 
+						      msg_count * num_threads);
+    // A LockFreeMailBox put isn't atomic across subscribers, so a fast
+    // thread's next trial can overtake a slow thread's last message.
+    // Keep the trials apart.
+    testObjMessage(mailbox_p, msg_count, num_threads, num_trials, no_echo, true);
+  }
+  else if(engine == "broadcast") {
+    // The slowest reader can be a trial behind everyone else, so the
+    // ring needs room for two trials' worth of messages. 
+    auto mailbox_p = SoDa::makeBroadcastMailBox<MyMsg>("BroadcastMailbox", 
+							2 * msg_count * num_threads);
+    testObjMessage(mailbox_p, msg_count, num_threads, num_trials, no_echo);
+  }
+  else if(engine == "pooled") {
+    auto mailbox_p = SoDa::makePooledMailBox<MyMsg>("PooledMailbox");
+    testObjMessage(mailbox_p, msg_count, num_threads, num_trials, no_echo);
+  }
+  else {
+    //! [create a mailbox]
+    SoDa::MailBoxPtr<MyMsg> mailbox_p = SoDa::makeMailBox<MyMsg>("MessageMailbox");
+    //! [create a mailbox]
+    testObjMessage(mailbox_p, msg_count, num_threads, num_trials, no_echo);
+  }
   
   if(MyMsg::tot_active > 0) {
     std::cerr << "There may be a leak in allocating messages: " << 